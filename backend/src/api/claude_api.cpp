@@ -1,17 +1,12 @@
 #include "claude_api.h"
 #include "../util/json.h"
 #include "../util/file_utils.h"
-#include <curl/curl.h>
+#include "../util/tokens.h"
 #include <cstring>
 
 namespace rpg {
 
 namespace {
-    size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string* data) {
-        data->append(ptr, size * nmemb);
-        return size * nmemb;
-    }
-
     std::string load_env_value(const std::string& key) {
         // Try .env file first
         std::string env_content = file::read_file(".env");
@@ -33,82 +28,247 @@ namespace {
         const char* val = std::getenv(key.c_str());
         return val ? val : "";
     }
-}
 
-ClaudeAPI::ClaudeAPI() {
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    api_key_ = load_env_value("ANTHROPIC_API_KEY");
-}
-
-ClaudeAPI::~ClaudeAPI() {
-    curl_global_cleanup();
-}
+    // The prompt is billed in three parts once caching is in play
+    void read_input_usage(std::string_view usage, ClaudeResponse& response) {
+        response.input_tokens = static_cast<int>(json::extract_int(usage, "input_tokens"));
+        response.cache_creation_input_tokens =
+            static_cast<int>(json::extract_int(usage, "cache_creation_input_tokens"));
+        response.cache_read_input_tokens =
+            static_cast<int>(json::extract_int(usage, "cache_read_input_tokens"));
+    }
 
-ClaudeResponse ClaudeAPI::send_message(std::string_view system_prompt,
-                                        std::string_view user_message) {
-    ClaudeResponse response;
+    // Tells the pool what the call really cost, so its buckets track the
+    // API's. Cache reads do not count towards the input limit.
+    void release_key(KeyPool& keys, const KeyPool::Lease& lease, const HttpResponse& http,
+                     const ClaudeResponse& response) {
+        long input = response.input_tokens + response.cache_creation_input_tokens;
+        bool reported = input > 0 || response.output_tokens > 0;
+        keys.release(lease, http, reported ? input : -1, reported ? response.output_tokens : -1);
+    }
 
-    if (api_key_.empty()) {
-        response.error = "ANTHROPIC_API_KEY not set";
-        return response;
+    long env_long(const std::string& key, long fallback) {
+        std::string value = load_env_value(key);
+        return value.empty() ? fallback : std::strtol(value.c_str(), nullptr, 10);
     }
 
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        response.error = "Failed to initialize curl";
-        return response;
+    // Accumulates a Messages API event stream (server-sent events)
+    struct StreamState {
+        std::string pending;
+        ClaudeResponse response;
+        ClaudeAPI::TextCallback on_text;
+        bool stopped = false;
+
+        bool feed(std::string_view chunk) {
+            pending.append(chunk.data(), chunk.size());
+            size_t end;
+            while ((end = pending.find("\n\n")) != std::string::npos) {
+                std::string_view block(pending.data(), end);
+                std::string data;
+                size_t line_start = 0;
+                while (line_start < block.size()) {
+                    size_t line_end = block.find('\n', line_start);
+                    if (line_end == std::string_view::npos) line_end = block.size();
+                    auto line = block.substr(line_start, line_end - line_start);
+                    if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+                    if (line.rfind("data:", 0) == 0) {
+                        line.remove_prefix(line.size() > 5 && line[5] == ' ' ? 6 : 5);
+                        data.append(line.data(), line.size());
+                    }
+                    line_start = line_end + 1;
+                }
+                pending.erase(0, end + 2);
+                if (!data.empty() && !handle_event(data)) return false;
+            }
+            return true;
+        }
+
+        bool handle_event(std::string_view data) {
+            auto type = json::extract_string(data, "type");
+            if (type == "content_block_delta") {
+                auto delta = json::extract_object(data, "delta");
+                auto delta_type = json::extract_string(delta, "type");
+                // Tool input arrives as fragments of its JSON, only whole at content_block_stop
+                if (delta_type == "input_json_delta") {
+                    if (!response.tool_calls.empty())
+                        response.tool_calls.back().input += json::unescape(json::extract_string(delta, "partial_json"));
+                    return true;
+                }
+                if (delta_type != "text_delta") return true;
+                std::string text = json::unescape(json::extract_string(delta, "text"));
+                response.content += text;
+                if (on_text && !stopped && !on_text(text)) {
+                    stopped = true;
+                    return false;
+                }
+            } else if (type == "content_block_start") {
+                auto block = json::extract_object(data, "content_block");
+                if (json::extract_string(block, "type") == "tool_use") {
+                    response.tool_calls.push_back({std::string(json::extract_string(block, "id")),
+                                                   std::string(json::extract_string(block, "name")), {}});
+                }
+            } else if (type == "message_start") {
+                read_input_usage(json::extract_object(data, "usage"), response);
+            } else if (type == "message_delta") {
+                response.stop_reason = std::string(json::extract_string(json::extract_object(data, "delta"),
+                                                                        "stop_reason"));
+                auto usage = json::extract_object(data, "usage");
+                response.output_tokens = static_cast<int>(json::extract_int(usage, "output_tokens"));
+            } else if (type == "message_stop") {
+                response.success = true;
+            } else if (type == "error") {
+                auto error = json::extract_object(data, "error");
+                response.error = std::string(json::extract_string(error, "message"));
+            }
+            return true;
+        }
+    };
+}
+
+ClaudeAPI::ClaudeAPI() {
+    // ANTHROPIC_API_KEYS holds a comma-separated pool; a single
+    // ANTHROPIC_API_KEY is a pool of one
+    std::vector<std::string> keys;
+    std::string list = load_env_value("ANTHROPIC_API_KEYS");
+    if (list.empty()) list = load_env_value("ANTHROPIC_API_KEY");
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        std::string key = list.substr(start, end - start);
+        while (!key.empty() && key.front() == ' ') key.erase(0, 1);
+        while (!key.empty() && key.back() == ' ') key.pop_back();
+        if (!key.empty()) keys.push_back(std::move(key));
+        start = end + 1;
     }
 
+    KeyPool::Config key_config;
+    key_config.requests_per_minute = env_long("RPG_KEY_RPM", key_config.requests_per_minute);
+    key_config.input_tokens_per_minute = env_long("RPG_KEY_INPUT_TPM", key_config.input_tokens_per_minute);
+    key_config.output_tokens_per_minute = env_long("RPG_KEY_OUTPUT_TPM", key_config.output_tokens_per_minute);
+    keys_ = std::make_shared<KeyPool>(key_config);
+    keys_->set_keys(std::move(keys));
+    base_url_ = load_env_value("ANTHROPIC_BASE_URL");
+    if (base_url_.empty()) base_url_ = "https://api.anthropic.com";
+
+    UpstreamPolicy::Config config;
+    config.deadline_ms = 120000;
+    config.hedge = load_env_value("RPG_HEDGE_CLAUDE") == "1";
+    policy_ = std::make_shared<UpstreamPolicy>("Claude", config);
+}
+
+HttpRequest ClaudeAPI::build_request(const Prompt& prompt, bool stream) const {
     // Build JSON payload
     json::JsonBuilder builder(4096);
     builder.begin_object();
-    builder.kv_string("model", model_);
-    builder.kv_int("max_tokens", max_tokens_);
-    builder.kv_string("system", system_prompt);
+    builder.kv_string("model", prompt.model.empty() ? model_ : prompt.model);
+    builder.kv_int("max_tokens", prompt.max_tokens > 0 ? prompt.max_tokens : max_tokens_);
+    if (!prompt.tools.empty()) {
+        json::JsonBuilder tools(1024);
+        tools.begin_array();
+        for (const auto& tool : prompt.tools) {
+            json::JsonBuilder item(tool.description.size() + tool.input_schema.size() + 64);
+            item.begin_object();
+            item.kv_string("name", tool.name);
+            item.kv_string("description", tool.description);
+            item.key("input_schema");
+            item.value_raw(tool.input_schema);
+            item.end_object();
+            tools.value_raw(item.str());
+        }
+        tools.end_array();
+        builder.key("tools");
+        builder.value_raw(tools.str());
+    }
+    builder.key("system");
+    builder.value_raw(blocks_json(prompt.system));
+    if (!prompt.stop_sequences.empty()) {
+        json::JsonBuilder stops(64);
+        stops.begin_array();
+        for (const auto& stop : prompt.stop_sequences) stops.value_string(stop);
+        stops.end_array();
+        builder.key("stop_sequences");
+        builder.value_raw(stops.str());
+    }
+    if (stream) {
+        builder.key("stream");
+        builder.value_bool(true);
+    }
     builder.key("messages");
     builder.begin_array();
-    builder.begin_object();
-    builder.kv_string("role", "user");
-    builder.kv_string("content", user_message);
-    builder.end_object();
+    for (const auto& turn : prompt.messages) {
+        json::JsonBuilder message(4096);
+        message.begin_object();
+        message.kv_string("role", turn.role);
+        message.key("content");
+        message.value_raw(blocks_json(turn.content));
+        message.end_object();
+        builder.value_raw(message.str());
+    }
     builder.end_array();
     builder.end_object();
 
-    std::string response_data;
-
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    std::string auth_header = "x-api-key: " + api_key_;
-    headers = curl_slist_append(headers, auth_header.c_str());
-    headers = curl_slist_append(headers, "anthropic-version: 2023-06-01");
-
-    curl_easy_setopt(curl, CURLOPT_URL, "https://api.anthropic.com/v1/messages");
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, builder.str().c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
+    HttpRequest request;
+    request.url = base_url_ + "/v1/messages";
+    request.headers.push_back("Content-Type: application/json");
+    request.headers.push_back("anthropic-version: 2023-06-01");
+    request.body = std::move(builder.str());
+    return request;
+}
 
-    CURLcode res = curl_easy_perform(curl);
+std::string ClaudeAPI::blocks_json(const std::vector<PromptBlock>& blocks) {
+    json::JsonBuilder array(4096);
+    array.begin_array();
+    for (const auto& block : blocks) {
+        // The API rejects empty text blocks
+        if (block.text.empty()) continue;
+        json::JsonBuilder item(block.text.size() + 128);
+        item.begin_object();
+        item.kv_string("type", "text");
+        item.kv_string("text", block.text);
+        if (block.cache) {
+            item.key("cache_control");
+            item.value_raw(R"({"type":"ephemeral"})");
+        }
+        item.end_object();
+        array.value_raw(item.str());
+    }
+    array.end_array();
+    return array.str();
+}
 
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
+ClaudeResponse ClaudeAPI::parse_response(const HttpResponse& http) {
+    ClaudeResponse response;
 
-    if (res != CURLE_OK) {
-        response.error = curl_easy_strerror(res);
+    if (!http.success) {
+        response.error = http.error;
+        response.cancelled = http.cancelled;
         return response;
     }
 
+    const std::string& response_data = http.body;
+
     // Parse response
     auto content_array = json::extract_object(response_data, "content");
     if (!content_array.empty()) {
-        auto text = json::extract_string(content_array, "text");
-        response.content = json::unescape(text);
+        for (auto block : json::split_array(content_array)) {
+            auto type = json::extract_string(block, "type");
+            if (type == "text") {
+                response.content += json::unescape(json::extract_string(block, "text"));
+            } else if (type == "tool_use") {
+                response.tool_calls.push_back({std::string(json::extract_string(block, "id")),
+                                               std::string(json::extract_string(block, "name")),
+                                               std::string(json::extract_object(block, "input"))});
+            }
+        }
         response.success = true;
     }
 
+    response.stop_reason = std::string(json::extract_string(response_data, "stop_reason"));
+
     auto usage = json::extract_object(response_data, "usage");
     if (!usage.empty()) {
-        response.input_tokens = static_cast<int>(json::extract_int(usage, "input_tokens"));
+        read_input_usage(usage, response);
         response.output_tokens = static_cast<int>(json::extract_int(usage, "output_tokens"));
     }
 
@@ -124,4 +284,108 @@ ClaudeResponse ClaudeAPI::send_message(std::string_view system_prompt,
     return response;
 }
 
+void ClaudeAPI::send_message_async(std::string_view system_prompt,
+                                   std::string_view user_message, Callback on_complete,
+                                   CancelCheck is_cancelled) {
+    send_message_async(Prompt::plain(system_prompt, user_message), std::move(on_complete),
+                       std::move(is_cancelled));
+}
+
+void ClaudeAPI::send_message_async(const Prompt& prompt, Callback on_complete,
+                                   CancelCheck is_cancelled, const UpstreamTag& tag) {
+    if (keys_->size() == 0) {
+        ClaudeResponse response;
+        response.error = "ANTHROPIC_API_KEY not set";
+        on_complete(std::move(response));
+        return;
+    }
+
+    HttpRequest request = build_request(prompt);
+    request.is_cancelled = std::move(is_cancelled);
+
+    dispatch(std::move(request), tag,
+        [keys = keys_, on_complete = std::move(on_complete)](HttpResponse http, const KeyPool::Lease& lease) {
+            ClaudeResponse response = parse_response(http);
+            release_key(*keys, lease, http, response);
+            on_complete(std::move(response));
+        });
+}
+
+void ClaudeAPI::dispatch(HttpRequest request, const UpstreamTag& tag, Dispatched on_complete) const {
+    // The key comes first: a call that waits for rate-limit headroom must
+    // not sit on a scheduler slot, interactive reserve slots included
+    long estimate = static_cast<long>(tokens::estimate(request.body));
+    auto is_cancelled = request.is_cancelled;
+    keys_->acquire(estimate, std::move(is_cancelled),
+        [keys = keys_, policy = policy_, tag, request = std::move(request),
+         on_complete = std::move(on_complete)](std::optional<KeyPool::Lease> lease) mutable {
+            if (!lease) {
+                HttpResponse response;
+                response.cancelled = request.is_cancelled && request.is_cancelled();
+                response.error = response.cancelled ? "Cancelled while waiting for an API key"
+                                                    : "Every API key is at its rate limit, try again shortly";
+                on_complete(std::move(response), KeyPool::Lease{});
+                return;
+            }
+
+            auto is_cancelled = request.is_cancelled;
+            UpstreamScheduler::instance().submit(tag, std::move(is_cancelled),
+                [keys, policy, lease = std::move(*lease), request = std::move(request),
+                 on_complete = std::move(on_complete)](UpstreamScheduler::Slot slot) mutable {
+                    if (!slot) {
+                        // Never sent; hand back the tokens reserved for it
+                        keys->release(lease, HttpResponse{}, 0, 0);
+                        HttpResponse response;
+                        response.cancelled = true;
+                        response.error = "Cancelled while waiting for upstream capacity";
+                        on_complete(std::move(response), KeyPool::Lease{});
+                        return;
+                    }
+                    // The slot stays taken until the call completes
+                    request.headers.push_back("x-api-key: " + lease.key);
+                    policy->submit(std::move(request),
+                        [slot, lease = std::move(lease), on_complete = std::move(on_complete)](HttpResponse http) {
+                            on_complete(std::move(http), lease);
+                        });
+                });
+        });
+}
+
+void ClaudeAPI::stream_message(const Prompt& prompt, TextCallback on_text, Callback on_complete,
+                               CancelCheck is_cancelled, const UpstreamTag& tag) {
+    if (keys_->size() == 0) {
+        ClaudeResponse response;
+        response.error = "ANTHROPIC_API_KEY not set";
+        on_complete(std::move(response));
+        return;
+    }
+
+    auto state = std::make_shared<StreamState>();
+    state->on_text = std::move(on_text);
+
+    HttpRequest request = build_request(prompt, true);
+    request.on_data = [state](std::string_view chunk) { return state->feed(chunk); };
+    request.is_cancelled = std::move(is_cancelled);
+
+    dispatch(std::move(request), tag,
+        [state, keys = keys_, on_complete = std::move(on_complete)](HttpResponse http,
+                                                                     const KeyPool::Lease& lease) {
+            // HTTP-level failures come back as a regular JSON error body
+            if (!http.success || http.status >= 400) {
+                ClaudeResponse response = parse_response(http);
+                release_key(*keys, lease, http, response);
+                if (state->stopped) response.error = "Stream aborted";
+                response.success = false;
+                on_complete(std::move(response));
+                return;
+            }
+
+            release_key(*keys, lease, http, state->response);
+            ClaudeResponse response = std::move(state->response);
+            if (!response.error.empty()) response.success = false;
+            else if (!response.success) response.error = "Stream ended before message_stop";
+            on_complete(std::move(response));
+        });
+}
+
 }
@@ -1,31 +1,131 @@
 #pragma once
+#include "http_client.h"
+#include "key_pool.h"
+#include "upstream_scheduler.h"
+#include "upstream_policy.h"
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <vector>
 
 namespace rpg {
 
+// One text block of a request. A cache breakpoint caches the prompt prefix up
+// to and including the block, so mark the last block of each stable layer
+// (the API honours at most four per request).
+struct PromptBlock {
+    std::string text;
+    bool cache = false;
+};
+
+// One conversation turn; roles alternate "user"/"assistant" and the last is "user"
+struct PromptMessage {
+    std::string role;
+    std::vector<PromptBlock> content;
+};
+
+// A client tool the model may call. input_schema is a JSON Schema object,
+// sent as is.
+struct PromptTool {
+    std::string name;
+    std::string description;
+    std::string input_schema;
+};
+
+// System blocks, then the conversation, ordered from most to least stable.
+// A final "assistant" message is a prefill the model continues from.
+struct Prompt {
+    std::vector<PromptBlock> system;
+    std::vector<PromptMessage> messages;
+    // Sent ahead of the system blocks, so they share its cache breakpoint
+    std::vector<PromptTool> tools;
+
+    // Generation ends before any of these; the sequence is not returned
+    std::vector<std::string> stop_sequences;
+    // Per-call overrides of the client's model and max_tokens when set
+    std::string model;
+    int max_tokens = 0;
+
+    static Prompt plain(std::string_view system_prompt, std::string_view user_message) {
+        Prompt prompt;
+        prompt.system.push_back({std::string(system_prompt), false});
+        prompt.messages.push_back({"user", {{std::string(user_message), false}}});
+        return prompt;
+    }
+};
+
+// A tool_use block of a response; input is its JSON object, undecoded
+struct ToolCall {
+    std::string id;
+    std::string name;
+    std::string input;
+};
+
 struct ClaudeResponse {
-    std::string content;
-    int input_tokens = 0;
+    std::string content;  // text blocks, concatenated
+    std::vector<ToolCall> tool_calls;
+    int input_tokens = 0;  // uncached part of the prompt
+    int cache_creation_input_tokens = 0;
+    int cache_read_input_tokens = 0;
     int output_tokens = 0;
+    std::string stop_reason;  // "end_turn", "stop_sequence", "tool_use", "max_tokens", ...
     bool success = false;
+    bool cancelled = false;  // the caller's is_cancelled check fired
     std::string error;
 };
 
 class ClaudeAPI {
 public:
+    using Callback = std::function<void(ClaudeResponse)>;
+    using TextCallback = std::function<bool(std::string_view)>;
+    // Polled while the request is in flight; returning true aborts it
+    using CancelCheck = std::function<bool()>;
+
     ClaudeAPI();
-    ~ClaudeAPI();
+    ~ClaudeAPI() = default;
+
+    // Dispatched on the shared HttpClient event loop; callbacks run on that
+    // thread and must not block
+    void send_message_async(std::string_view system_prompt,
+                            std::string_view user_message, Callback on_complete,
+                            CancelCheck is_cancelled = nullptr);
+    void send_message_async(const Prompt& prompt, Callback on_complete,
+                            CancelCheck is_cancelled = nullptr, const UpstreamTag& tag = {});
 
-    ClaudeResponse send_message(std::string_view system_prompt,
-                                 std::string_view user_message);
+    // Streaming Messages API: on_text receives each text delta as it arrives
+    // (return false to abort), on_complete the assembled response. Both run
+    // on the HttpClient event loop thread.
+    void stream_message(const Prompt& prompt, TextCallback on_text, Callback on_complete,
+                        CancelCheck is_cancelled = nullptr, const UpstreamTag& tag = {});
 
-    void set_api_key(const std::string& key) { api_key_ = key; }
+    // Exact body send_message would post, for keying response caches
+    std::string request_body(const Prompt& prompt) const { return build_request(prompt).body; }
+
+    void set_api_key(const std::string& key) { keys_->set_keys({key}); }
+
+    // Retry, hedging and breaker counters for the stats endpoint
+    std::string policy_stats_json() const { return policy_->stats_json(); }
+    // Per-key rate-limit headroom for the stats endpoint
+    std::string key_stats_json() const { return keys_->stats_json(); }
     void set_model(const std::string& model) { model_ = model; }
+    const std::string& model() const { return model_; }
     void set_max_tokens(int tokens) { max_tokens_ = tokens; }
 
 private:
-    std::string api_key_;
+    HttpRequest build_request(const Prompt& prompt, bool stream = false) const;
+    static std::string blocks_json(const std::vector<PromptBlock>& blocks);
+    static ClaudeResponse parse_response(const HttpResponse& http);
+
+    // Waits for a key from the pool, then for an upstream slot in tag's
+    // class, then submits through the policy. An unkeyed lease means the call
+    // never went out and the response carries the reason.
+    using Dispatched = std::function<void(HttpResponse, const KeyPool::Lease&)>;
+    void dispatch(HttpRequest request, const UpstreamTag& tag, Dispatched on_complete) const;
+
+    std::shared_ptr<UpstreamPolicy> policy_;
+    std::shared_ptr<KeyPool> keys_;
+    std::string base_url_;  // scheme and host, overridable for mock servers
     std::string model_ = "claude-sonnet-4-20250514";
     int max_tokens_ = 4096;
 };
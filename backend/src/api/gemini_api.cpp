@@ -1,16 +1,10 @@
 #include "gemini_api.h"
 #include "../util/json.h"
 #include "../util/file_utils.h"
-#include <curl/curl.h>
 
 namespace rpg {
 
 namespace {
-    size_t write_callback(char* ptr, size_t size, size_t nmemb, std::string* data) {
-        data->append(ptr, size * nmemb);
-        return size * nmemb;
-    }
-
     std::string load_env_value(const std::string& key) {
         std::string env_content = file::read_file(".env");
         if (!env_content.empty()) {
@@ -33,22 +27,16 @@ namespace {
 
 GeminiAPI::GeminiAPI() {
     api_key_ = load_env_value("GEMINI_API_KEY");
-}
+    base_url_ = load_env_value("GEMINI_BASE_URL");
+    if (base_url_.empty()) base_url_ = "https://generativelanguage.googleapis.com";
 
-GeminiImageResponse GeminiAPI::generate_image(std::string_view prompt) {
-    GeminiImageResponse response;
-
-    if (api_key_.empty()) {
-        response.error = "GEMINI_API_KEY not set";
-        return response;
-    }
-
-    CURL* curl = curl_easy_init();
-    if (!curl) {
-        response.error = "Failed to initialize curl";
-        return response;
-    }
+    UpstreamPolicy::Config config;
+    config.deadline_ms = 90000;
+    config.hedge = load_env_value("RPG_HEDGE_GEMINI") == "1";
+    policy_ = std::make_shared<UpstreamPolicy>("Gemini", config);
+}
 
+HttpRequest GeminiAPI::build_request(std::string_view prompt) const {
     // Build JSON payload for Gemini image generation
     json::JsonBuilder builder(2048);
     builder.begin_object();
@@ -69,29 +57,25 @@ GeminiImageResponse GeminiAPI::generate_image(std::string_view prompt) {
     builder.end_object();
     builder.end_object();
 
-    std::string response_data;
-    std::string url = "https://generativelanguage.googleapis.com/v1beta/models/" +
-                      model_ + ":generateContent?key=" + api_key_;
-
-    struct curl_slist* headers = nullptr;
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-
-    curl_easy_setopt(curl, CURLOPT_URL, url.c_str());
-    curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, builder.str().c_str());
-    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(curl, CURLOPT_WRITEDATA, &response_data);
-
-    CURLcode res = curl_easy_perform(curl);
+    HttpRequest request;
+    request.url = base_url_ + "/v1beta/models/" +
+                  model_ + ":generateContent?key=" + api_key_;
+    request.headers.push_back("Content-Type: application/json");
+    request.body = std::move(builder.str());
+    return request;
+}
 
-    curl_slist_free_all(headers);
-    curl_easy_cleanup(curl);
+GeminiImageResponse GeminiAPI::parse_response(const HttpResponse& http) {
+    GeminiImageResponse response;
 
-    if (res != CURLE_OK) {
-        response.error = curl_easy_strerror(res);
+    if (!http.success) {
+        response.error = http.error;
+        response.cancelled = http.cancelled;
         return response;
     }
 
+    const std::string& response_data = http.body;
+
     // Parse response - structure is:
     // { "candidates": [{ "content": { "parts": [{ "inlineData": { "mimeType": "...", "data": "..." } }] } }] }
     auto candidates = json::extract_object(response_data, "candidates");
@@ -135,4 +119,34 @@ GeminiImageResponse GeminiAPI::generate_image(std::string_view prompt) {
     return response;
 }
 
+void GeminiAPI::generate_image_async(std::string_view prompt, Callback on_complete,
+                                     CancelCheck is_cancelled, const UpstreamTag& tag) {
+    if (api_key_.empty()) {
+        GeminiImageResponse response;
+        response.error = "GEMINI_API_KEY not set";
+        on_complete(std::move(response));
+        return;
+    }
+
+    HttpRequest request = build_request(prompt);
+    request.is_cancelled = std::move(is_cancelled);
+
+    auto cancel = request.is_cancelled;
+    UpstreamScheduler::instance().submit(tag, std::move(cancel),
+        [policy = policy_, request = std::move(request),
+         on_complete = std::move(on_complete)](UpstreamScheduler::Slot slot) mutable {
+            if (!slot) {
+                GeminiImageResponse response;
+                response.cancelled = true;
+                response.error = "Cancelled while waiting for upstream capacity";
+                on_complete(std::move(response));
+                return;
+            }
+            policy->submit(std::move(request),
+                [slot, on_complete = std::move(on_complete)](HttpResponse http) {
+                    on_complete(parse_response(http));
+                });
+        });
+}
+
 }
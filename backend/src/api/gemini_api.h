@@ -1,4 +1,9 @@
 #pragma once
+#include "http_client.h"
+#include "upstream_policy.h"
+#include "upstream_scheduler.h"
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
 
@@ -8,20 +13,37 @@ struct GeminiImageResponse {
     std::string image_data;  // base64 encoded
     std::string mime_type;
     bool success = false;
+    bool cancelled = false;  // the caller's is_cancelled check fired
     std::string error;
 };
 
 class GeminiAPI {
 public:
+    using Callback = std::function<void(GeminiImageResponse)>;
+    // Polled while the request is in flight; returning true aborts it
+    using CancelCheck = std::function<bool()>;
+
     GeminiAPI();
     ~GeminiAPI() = default;
 
-    GeminiImageResponse generate_image(std::string_view prompt);
+    // Dispatched on the shared HttpClient event loop; on_complete runs on that
+    // thread and must not block. Waits for an upstream slot in tag's class
+    // before the call goes out.
+    void generate_image_async(std::string_view prompt, Callback on_complete,
+                              CancelCheck is_cancelled = nullptr, const UpstreamTag& tag = {});
 
     void set_api_key(const std::string& key) { api_key_ = key; }
 
+    // Retry, hedging and breaker counters for the stats endpoint
+    std::string policy_stats_json() const { return policy_->stats_json(); }
+
 private:
+    HttpRequest build_request(std::string_view prompt) const;
+    static GeminiImageResponse parse_response(const HttpResponse& http);
+
+    std::shared_ptr<UpstreamPolicy> policy_;
     std::string api_key_;
+    std::string base_url_;  // scheme and host, overridable for mock servers
     std::string model_ = "gemini-2.0-flash-exp-image-generation";
 };
 
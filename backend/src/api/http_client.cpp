@@ -0,0 +1,385 @@
+#include "http_client.h"
+#include "../util/json.h"
+#include <curl/curl.h>
+#include <algorithm>
+#include <cctype>
+
+namespace rpg {
+
+struct HttpClient::Transfer {
+    CURL* easy = nullptr;
+    std::string host;
+    curl_slist* headers = nullptr;
+    HttpRequest request;
+    HttpResponse response;
+    Callback on_complete;
+    std::chrono::steady_clock::time_point not_before;
+};
+
+namespace {
+    size_t write_header(char* ptr, size_t size, size_t nmemb, void* userdata) {
+        auto* response = static_cast<HttpResponse*>(userdata);
+        std::string_view line(ptr, size * nmemb);
+
+        // A new status line (redirect, 100-continue) resets the header list
+        if (line.rfind("HTTP/", 0) == 0) {
+            response->headers.clear();
+            return size * nmemb;
+        }
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) return size * nmemb;
+
+        std::string name(line.substr(0, colon));
+        std::transform(name.begin(), name.end(), name.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+        size_t start = colon + 1;
+        size_t end = line.size();
+        while (start < end && (line[start] == ' ' || line[start] == '\t')) ++start;
+        while (end > start && (line[end-1] == '\r' || line[end-1] == '\n' || line[end-1] == ' ')) --end;
+
+        response->headers.emplace_back(std::move(name), std::string(line.substr(start, end - start)));
+        return size * nmemb;
+    }
+}
+
+std::string HttpResponse::header(const std::string& name) const {
+    for (const auto& [key, value] : headers) {
+        if (key.size() != name.size()) continue;
+        bool match = std::equal(key.begin(), key.end(), name.begin(), [](char a, char b) {
+            return std::tolower(static_cast<unsigned char>(a)) ==
+                   std::tolower(static_cast<unsigned char>(b));
+        });
+        if (match) return value;
+    }
+    return "";
+}
+
+size_t HttpClient::write_body(char* ptr, size_t size, size_t nmemb, void* userdata) {
+    auto* t = static_cast<Transfer*>(userdata);
+    size_t bytes = size * nmemb;
+
+    // Error bodies are always collected so callers can report them
+    if (t->request.on_data) {
+        long status = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &status);
+        if (status < 400) {
+            return t->request.on_data(std::string_view(ptr, bytes)) ? bytes : 0;
+        }
+    }
+
+    t->response.body.append(ptr, bytes);
+    return bytes;
+}
+
+int HttpClient::check_cancelled(void* userdata, long long, long long, long long, long long) {
+    auto* t = static_cast<Transfer*>(userdata);
+    if (!t->request.is_cancelled()) return 0;
+    t->response.cancelled = true;
+    return 1;
+}
+
+HttpClient& HttpClient::instance() {
+    static HttpClient client;
+    return client;
+}
+
+HttpClient::HttpClient() {
+    curl_global_init(CURL_GLOBAL_DEFAULT);
+    multi_ = curl_multi_init();
+    curl_multi_setopt(static_cast<CURLM*>(multi_), CURLMOPT_MAXCONNECTS, MAX_CACHED_CONNECTIONS);
+
+    // The multi handle already keeps connections alive between transfers;
+    // the share adds DNS and TLS sessions. Only the loop thread uses it.
+    CURLSH* share = curl_share_init();
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    share_ = share;
+
+    loop_ = std::thread([this] { run(); });
+}
+
+HttpClient::~HttpClient() {
+    stopping_ = true;
+    curl_multi_wakeup(static_cast<CURLM*>(multi_));
+    loop_.join();
+
+    for (Transfer* t : active_) {
+        curl_multi_remove_handle(static_cast<CURLM*>(multi_), t->easy);
+        complete(t, false, "HTTP client shutting down");
+    }
+    active_.clear();
+    for (Transfer* t : pending_) {
+        complete(t, false, "HTTP client shutting down");
+    }
+    pending_.clear();
+    for (Transfer* t : delayed_) {
+        complete(t, false, "HTTP client shutting down");
+    }
+    delayed_.clear();
+
+    for (auto& [host, handles] : idle_handles_) {
+        for (void* easy : handles) curl_easy_cleanup(static_cast<CURL*>(easy));
+    }
+    idle_handles_.clear();
+
+    curl_multi_cleanup(static_cast<CURLM*>(multi_));
+    curl_share_cleanup(static_cast<CURLSH*>(share_));
+    curl_global_cleanup();
+}
+
+void HttpClient::submit(HttpRequest request, Callback on_complete) {
+    submit_after(std::chrono::milliseconds(0), std::move(request), std::move(on_complete));
+}
+
+void HttpClient::submit_after(std::chrono::milliseconds delay, HttpRequest request,
+                              Callback on_complete) {
+    auto* transfer = new Transfer;
+    transfer->request = std::move(request);
+    transfer->on_complete = std::move(on_complete);
+    transfer->not_before = std::chrono::steady_clock::now() + delay;
+    ++in_flight_;
+
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        pending_.push_back(transfer);
+    }
+    curl_multi_wakeup(static_cast<CURLM*>(multi_));
+}
+
+void HttpClient::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        tasks_.push_back(std::move(task));
+    }
+    curl_multi_wakeup(static_cast<CURLM*>(multi_));
+}
+
+std::future<HttpResponse> HttpClient::submit(HttpRequest request) {
+    auto promise = std::make_shared<std::promise<HttpResponse>>();
+    auto future = promise->get_future();
+    submit(std::move(request), [promise](HttpResponse response) {
+        promise->set_value(std::move(response));
+    });
+    return future;
+}
+
+void HttpClient::run() {
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    while (!stopping_) {
+        run_tasks();
+        start_pending();
+
+        int running = 0;
+        curl_multi_perform(multi, &running);
+        finish_completed();
+
+        curl_multi_poll(multi, nullptr, 0, static_cast<int>(poll_timeout_ms()), nullptr);
+    }
+}
+
+long HttpClient::poll_timeout_ms() const {
+    long timeout = POLL_TIMEOUT_MS;
+    auto now = std::chrono::steady_clock::now();
+    for (const Transfer* t : delayed_) {
+        auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(t->not_before - now).count();
+        timeout = std::min(timeout, std::max(0L, static_cast<long>(wait) + 1));
+    }
+    return timeout;
+}
+
+void HttpClient::run_tasks() {
+    std::vector<std::function<void()>> batch;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        batch.swap(tasks_);
+    }
+    for (auto& task : batch) task();
+}
+
+void HttpClient::start_pending() {
+    std::vector<Transfer*> batch;
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        batch.swap(pending_);
+    }
+
+    // Timers that came due, or whose caller no longer wants them, join the batch
+    auto now = std::chrono::steady_clock::now();
+    auto due = std::stable_partition(delayed_.begin(), delayed_.end(), [now](Transfer* t) {
+        return t->not_before > now && !(t->request.is_cancelled && t->request.is_cancelled());
+    });
+    batch.insert(batch.end(), due, delayed_.end());
+    delayed_.erase(due, delayed_.end());
+
+    for (Transfer* t : batch) {
+        if (t->not_before > now && !(t->request.is_cancelled && t->request.is_cancelled())) {
+            delayed_.push_back(t);
+            continue;
+        }
+
+        // Cancelled while queued: never reaches upstream
+        if (t->request.is_cancelled && t->request.is_cancelled()) {
+            t->response.cancelled = true;
+            complete(t, false, "Request cancelled");
+            continue;
+        }
+
+        t->host = host_of(t->request.url);
+        t->easy = static_cast<CURL*>(acquire_handle(t->host));
+        if (!t->easy) {
+            complete(t, false, "Failed to initialize curl");
+            continue;
+        }
+
+        for (const auto& header : t->request.headers) {
+            t->headers = curl_slist_append(t->headers, header.c_str());
+        }
+
+        curl_easy_setopt(t->easy, CURLOPT_URL, t->request.url.c_str());
+        curl_easy_setopt(t->easy, CURLOPT_HTTPHEADER, t->headers);
+        if (t->request.head_only) {
+            curl_easy_setopt(t->easy, CURLOPT_NOBODY, 1L);
+        } else {
+            curl_easy_setopt(t->easy, CURLOPT_POSTFIELDS, t->request.body.c_str());
+            curl_easy_setopt(t->easy, CURLOPT_POSTFIELDSIZE, static_cast<long>(t->request.body.size()));
+        }
+        curl_easy_setopt(t->easy, CURLOPT_SHARE, static_cast<CURLSH*>(share_));
+        curl_easy_setopt(t->easy, CURLOPT_TCP_KEEPALIVE, 1L);
+        if (t->request.connect_timeout_ms > 0) {
+            curl_easy_setopt(t->easy, CURLOPT_CONNECTTIMEOUT_MS, t->request.connect_timeout_ms);
+        }
+        if (t->request.timeout_ms > 0) {
+            curl_easy_setopt(t->easy, CURLOPT_TIMEOUT_MS, t->request.timeout_ms);
+        }
+        if (t->request.stall_timeout_ms > 0) {
+            // Below one byte a second for the whole window counts as stalled
+            curl_easy_setopt(t->easy, CURLOPT_LOW_SPEED_LIMIT, 1L);
+            curl_easy_setopt(t->easy, CURLOPT_LOW_SPEED_TIME,
+                             std::max(1L, t->request.stall_timeout_ms / 1000));
+        }
+        curl_easy_setopt(t->easy, CURLOPT_WRITEFUNCTION, write_body);
+        curl_easy_setopt(t->easy, CURLOPT_WRITEDATA, t);
+        curl_easy_setopt(t->easy, CURLOPT_HEADERFUNCTION, write_header);
+        curl_easy_setopt(t->easy, CURLOPT_HEADERDATA, &t->response);
+        curl_easy_setopt(t->easy, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(t->easy, CURLOPT_PRIVATE, t);
+        if (t->request.is_cancelled) {
+            curl_easy_setopt(t->easy, CURLOPT_XFERINFOFUNCTION, check_cancelled);
+            curl_easy_setopt(t->easy, CURLOPT_XFERINFODATA, t);
+            curl_easy_setopt(t->easy, CURLOPT_NOPROGRESS, 0L);
+        }
+
+        curl_multi_add_handle(static_cast<CURLM*>(multi_), t->easy);
+        active_.push_back(t);
+    }
+}
+
+void HttpClient::finish_completed() {
+    CURLM* multi = static_cast<CURLM*>(multi_);
+    int remaining = 0;
+    while (CURLMsg* msg = curl_multi_info_read(multi, &remaining)) {
+        if (msg->msg != CURLMSG_DONE) continue;
+
+        Transfer* t = nullptr;
+        curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &t);
+        CURLcode result = msg->data.result;
+
+        curl_multi_remove_handle(multi, t->easy);
+        active_.erase(std::find(active_.begin(), active_.end(), t));
+
+        long connects = 0;
+        curl_easy_getinfo(t->easy, CURLINFO_NUM_CONNECTS, &connects);
+        if (connects > 0) connections_opened_ += static_cast<size_t>(connects);
+        else if (result == CURLE_OK) ++connections_reused_;
+
+        // A streaming consumer that stops reading (write error) may also be
+        // doing so because its client left
+        if (result != CURLE_OK && !t->response.cancelled && t->request.is_cancelled) {
+            t->response.cancelled = t->request.is_cancelled();
+        }
+
+        if (result == CURLE_OPERATION_TIMEDOUT) t->response.timed_out = true;
+
+        if (result == CURLE_OK) {
+            curl_easy_getinfo(t->easy, CURLINFO_RESPONSE_CODE, &t->response.status);
+            complete(t, true, nullptr);
+        } else if (t->response.cancelled) {
+            complete(t, false, "Request cancelled");
+        } else {
+            complete(t, false, curl_easy_strerror(result));
+        }
+    }
+}
+
+void HttpClient::complete(Transfer* transfer, bool ok, const char* error) {
+    transfer->response.success = ok;
+    if (error) transfer->response.error = error;
+
+    if (transfer->easy) release_handle(transfer->host, transfer->easy);
+    if (transfer->headers) curl_slist_free_all(transfer->headers);
+
+    Callback on_complete = std::move(transfer->on_complete);
+    HttpResponse response = std::move(transfer->response);
+    delete transfer;
+
+    --in_flight_;
+    ++completed_;
+    if (response.cancelled) ++cancelled_;
+    if (response.timed_out) ++timed_out_;
+    if (on_complete) on_complete(std::move(response));
+}
+
+void* HttpClient::acquire_handle(const std::string& host) {
+    auto it = idle_handles_.find(host);
+    if (it != idle_handles_.end() && !it->second.empty()) {
+        void* easy = it->second.back();
+        it->second.pop_back();
+        ++pool_hits_;
+        return easy;
+    }
+    ++pool_misses_;
+    return curl_easy_init();
+}
+
+void HttpClient::release_handle(const std::string& host, void* easy) {
+    auto& handles = idle_handles_[host];
+    if (handles.size() >= MAX_IDLE_HANDLES_PER_HOST) {
+        curl_easy_cleanup(static_cast<CURL*>(easy));
+        return;
+    }
+    // Drops per-transfer options; connection and session caches live in the multi and share
+    curl_easy_reset(static_cast<CURL*>(easy));
+    handles.push_back(easy);
+}
+
+std::string HttpClient::host_of(const std::string& url) {
+    size_t scheme = url.find("://");
+    size_t start = scheme == std::string::npos ? 0 : scheme + 3;
+    return url.substr(0, url.find('/', start));
+}
+
+void HttpClient::warm_up(const std::string& url) {
+    HttpRequest request;
+    request.url = url;
+    request.head_only = true;
+    submit(std::move(request), nullptr);
+}
+
+std::string HttpClient::stats_json() const {
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_int("inFlight", static_cast<int64_t>(in_flight_.load()));
+    j.kv_int("completed", static_cast<int64_t>(completed_.load()));
+    j.kv_int("cancelled", static_cast<int64_t>(cancelled_.load()));
+    j.kv_int("timedOut", static_cast<int64_t>(timed_out_.load()));
+    j.kv_int("poolHits", static_cast<int64_t>(pool_hits_.load()));
+    j.kv_int("poolMisses", static_cast<int64_t>(pool_misses_.load()));
+    j.kv_int("connectionsReused", static_cast<int64_t>(connections_reused_.load()));
+    j.kv_int("connectionsOpened", static_cast<int64_t>(connections_opened_.load()));
+    j.end_object();
+    return j.str();
+}
+
+}
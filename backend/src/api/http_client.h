@@ -0,0 +1,134 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rpg {
+
+struct HttpRequest {
+    std::string url;
+    std::vector<std::string> headers;
+    std::string body;
+
+    // When set, successful response bytes are handed over as they arrive
+    // (on the event loop thread) instead of being collected in body.
+    // Returning false aborts the transfer.
+    std::function<bool(std::string_view)> on_data;
+
+    // Polled on the event loop while the transfer runs; returning true aborts
+    // it, e.g. once the client that asked for it has gone away
+    std::function<bool()> is_cancelled;
+
+    // Sends a HEAD request instead of POSTing body
+    bool head_only = false;
+
+    // Limits in milliseconds, 0 for none. stall_timeout_ms aborts a transfer
+    // that receives nothing for that long, which suits streams that may
+    // legitimately run longer than any total timeout.
+    long connect_timeout_ms = 0;
+    long timeout_ms = 0;
+    long stall_timeout_ms = 0;
+};
+
+struct HttpResponse {
+    long status = 0;
+    std::string body;
+    std::vector<std::pair<std::string, std::string>> headers;  // names lowercased
+    bool success = false;  // transport-level success; check status for HTTP errors
+    bool cancelled = false;  // aborted because is_cancelled returned true
+    bool timed_out = false;  // hit one of the request's time limits
+    std::string error;
+
+    std::string header(const std::string& name) const;
+};
+
+// Drives every upstream HTTP call from a single curl_multi event loop thread.
+// Callers get a callback or a future instead of blocking inside curl.
+class HttpClient {
+public:
+    using Callback = std::function<void(HttpResponse)>;
+
+    static HttpClient& instance();
+
+    // on_complete runs on the event loop thread and must not block
+    void submit(HttpRequest request, Callback on_complete);
+    std::future<HttpResponse> submit(HttpRequest request);
+
+    // Starts the transfer once delay has passed. is_cancelled is still
+    // checked at that point, so a timer that is no longer wanted costs nothing.
+    void submit_after(std::chrono::milliseconds delay, HttpRequest request, Callback on_complete);
+
+    // Runs task on the event loop thread, so it can share unlocked state with
+    // completion callbacks. Same rule: it must not block.
+    void post(std::function<void()> task);
+
+    size_t in_flight() const { return in_flight_.load(); }
+    size_t completed() const { return completed_.load(); }
+    size_t cancelled() const { return cancelled_.load(); }
+    size_t timed_out() const { return timed_out_.load(); }
+
+    // Opens a connection (DNS, TCP, TLS) to url's host ahead of the first call
+    void warm_up(const std::string& url);
+
+    // Counters for the stats endpoint, as a JSON object
+    std::string stats_json() const;
+
+private:
+    struct Transfer;
+
+    HttpClient();
+    ~HttpClient();
+    HttpClient(const HttpClient&) = delete;
+    HttpClient& operator=(const HttpClient&) = delete;
+
+    void run();
+    void run_tasks();
+    void start_pending();
+    long poll_timeout_ms() const;
+    void finish_completed();
+    void complete(Transfer* transfer, bool ok, const char* error);
+
+    // Easy handles are kept per upstream host and reset between transfers,
+    // so repeat calls skip handle setup and pick up cached TLS sessions
+    void* acquire_handle(const std::string& host);  // CURL*
+    void release_handle(const std::string& host, void* easy);
+    static std::string host_of(const std::string& url);
+
+    static size_t write_body(char* ptr, size_t size, size_t nmemb, void* userdata);
+    static int check_cancelled(void* userdata, long long, long long, long long, long long);
+
+    static constexpr int POLL_TIMEOUT_MS = 1000;
+    static constexpr size_t MAX_IDLE_HANDLES_PER_HOST = 16;
+    static constexpr long MAX_CACHED_CONNECTIONS = 64;
+
+    void* multi_ = nullptr;  // CURLM*
+    void* share_ = nullptr;  // CURLSH*, DNS and TLS session caches
+    std::thread loop_;
+    std::atomic<bool> stopping_{false};
+
+    std::mutex pending_mutex_;
+    std::vector<Transfer*> pending_;
+    std::vector<std::function<void()>> tasks_;
+    std::vector<Transfer*> active_;  // loop thread only
+    std::vector<Transfer*> delayed_;  // loop thread only, waiting for not_before
+    std::unordered_map<std::string, std::vector<void*>> idle_handles_;  // loop thread only
+
+    std::atomic<size_t> in_flight_{0};
+    std::atomic<size_t> completed_{0};
+    std::atomic<size_t> cancelled_{0};
+    std::atomic<size_t> timed_out_{0};
+    std::atomic<size_t> pool_hits_{0};
+    std::atomic<size_t> pool_misses_{0};
+    std::atomic<size_t> connections_reused_{0};
+    std::atomic<size_t> connections_opened_{0};
+};
+
+}
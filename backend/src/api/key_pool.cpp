@@ -0,0 +1,270 @@
+#include "key_pool.h"
+#include "../util/json.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace rpg {
+
+namespace {
+    // Queued calls are checked for cancellation at least this often
+    constexpr long CANCEL_POLL_MS = 250;
+
+    long elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+        return static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count());
+    }
+}
+
+void KeyPool::Bucket::refill(double elapsed_ms) {
+    level = std::min(capacity, level + capacity * elapsed_ms / 60000.0);
+}
+
+double KeyPool::Bucket::wait_ms(double amount) const {
+    if (level >= amount) return 0;
+    if (capacity <= 0) return 60000;
+    return std::ceil((amount - level) * 60000.0 / capacity);
+}
+
+void KeyPool::Bucket::sync(const HttpResponse& response, const std::string& prefix) {
+    std::string limit = response.header(prefix + "-limit");
+    std::string remaining = response.header(prefix + "-remaining");
+    if (!limit.empty()) {
+        double value = std::strtod(limit.c_str(), nullptr);
+        if (value > 0) capacity = value;
+    }
+    if (!remaining.empty()) level = std::min(capacity, std::strtod(remaining.c_str(), nullptr));
+}
+
+KeyPool::KeyPool(Config config) : config_(config) {
+    thread_ = std::thread([this] { run(); });
+}
+
+KeyPool::~KeyPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) thread_.join();
+    for (auto& waiter : queue_) waiter.grant(std::nullopt);
+}
+
+void KeyPool::set_keys(std::vector<std::string> keys) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    keys_.clear();
+    auto now = Clock::now();
+    for (auto& value : keys) {
+        if (value.empty()) continue;
+        Key key;
+        key.value = std::move(value);
+        key.requests.capacity = key.requests.level = static_cast<double>(config_.requests_per_minute);
+        key.input_tokens.capacity = key.input_tokens.level = static_cast<double>(config_.input_tokens_per_minute);
+        key.output_tokens.capacity = key.output_tokens.level = static_cast<double>(config_.output_tokens_per_minute);
+        key.updated = now;
+        keys_.push_back(std::move(key));
+    }
+}
+
+size_t KeyPool::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return keys_.size();
+}
+
+void KeyPool::acquire(long estimated_input_tokens, std::function<bool()> is_cancelled, Grant grant) {
+    std::optional<Lease> lease;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!keys_.empty() && queue_.empty()) {
+            size_t index = pick(estimated_input_tokens, Clock::now());
+            if (index != Lease::NONE) lease = take(index, estimated_input_tokens);
+        }
+        if (!lease && !keys_.empty()) {
+            ++queued_;
+            queue_.push_back(Waiter{estimated_input_tokens, std::move(is_cancelled), std::move(grant),
+                                    Clock::now() + std::chrono::milliseconds(config_.max_wait_ms)});
+            wake_.notify_one();
+            return;
+        }
+    }
+    grant(std::move(lease));
+}
+
+void KeyPool::release(const Lease& lease, const HttpResponse& response,
+                      long input_tokens, long output_tokens) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (lease.index >= keys_.size() || keys_[lease.index].value != lease.key) return;
+
+        auto now = Clock::now();
+        Key& key = keys_[lease.index];
+        refill(key, now);
+        if (key.in_flight > 0) --key.in_flight;
+
+        if (input_tokens >= 0) key.input_tokens.level -= static_cast<double>(input_tokens - lease.reserved_tokens);
+        if (output_tokens >= 0) key.output_tokens.level -= static_cast<double>(output_tokens);
+
+        // The API's own count wins over ours
+        key.requests.sync(response, "anthropic-ratelimit-requests");
+        key.input_tokens.sync(response, "anthropic-ratelimit-input-tokens");
+        key.output_tokens.sync(response, "anthropic-ratelimit-output-tokens");
+
+        if (response.status == 429) {
+            ++key.throttled;
+            long park_ms = config_.throttle_ms;
+            std::string retry_after = response.header("retry-after");
+            if (!retry_after.empty()) {
+                double seconds = std::strtod(retry_after.c_str(), nullptr);
+                if (seconds > 0) park_ms = static_cast<long>(seconds * 1000);
+            }
+            key.parked_until = now + std::chrono::milliseconds(park_ms);
+        }
+    }
+    wake_.notify_one();
+}
+
+void KeyPool::refill(Key& key, Clock::time_point now) {
+    double elapsed = static_cast<double>(elapsed_ms(key.updated, now));
+    if (elapsed <= 0) return;
+    key.requests.refill(elapsed);
+    key.input_tokens.refill(elapsed);
+    key.output_tokens.refill(elapsed);
+    key.updated = now;
+}
+
+size_t KeyPool::pick(long tokens, Clock::time_point now) {
+    size_t best = Lease::NONE;
+    double best_headroom = -1;
+    for (size_t i = 0; i < keys_.size(); ++i) {
+        Key& key = keys_[i];
+        refill(key, now);
+        if (now < key.parked_until) continue;
+        double need = std::min(static_cast<double>(tokens), key.input_tokens.capacity);
+        if (key.requests.level < 1 || key.input_tokens.level < need || key.output_tokens.level <= 0) continue;
+
+        // Headroom is the scarcest of the three buckets after this call
+        double headroom = std::min({(key.requests.level - 1) / key.requests.capacity,
+                                    (key.input_tokens.level - need) / key.input_tokens.capacity,
+                                    key.output_tokens.fraction()});
+        if (headroom > best_headroom) {
+            best_headroom = headroom;
+            best = i;
+        }
+    }
+    return best;
+}
+
+KeyPool::Lease KeyPool::take(size_t index, long tokens) {
+    Key& key = keys_[index];
+    long need = static_cast<long>(std::min(static_cast<double>(tokens), key.input_tokens.capacity));
+    key.requests.level -= 1;
+    key.input_tokens.level -= static_cast<double>(need);
+    ++key.in_flight;
+    ++key.calls;
+
+    Lease lease;
+    lease.index = index;
+    lease.key = key.value;
+    lease.reserved_tokens = need;
+    return lease;
+}
+
+long KeyPool::wait_ms(long tokens, Clock::time_point now) {
+    double best = -1;
+    for (Key& key : keys_) {
+        refill(key, now);
+        double need = std::min(static_cast<double>(tokens), key.input_tokens.capacity);
+        double wait = std::max({static_cast<double>(std::max(0L, elapsed_ms(now, key.parked_until))),
+                                key.requests.wait_ms(1), key.input_tokens.wait_ms(need),
+                                key.output_tokens.wait_ms(1)});
+        if (best < 0 || wait < best) best = wait;
+    }
+    return best < 0 ? CANCEL_POLL_MS : static_cast<long>(best);
+}
+
+void KeyPool::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<std::pair<Grant, std::optional<Lease>>> ready;
+    while (!stopping_) {
+        if (queue_.empty()) {
+            wake_.wait(lock);
+            continue;
+        }
+
+        // Strictly first come, first served, so a large prompt is not starved
+        // by a stream of small ones
+        auto now = Clock::now();
+        while (!queue_.empty()) {
+            Waiter& waiter = queue_.front();
+            if (now >= waiter.deadline || (waiter.is_cancelled && waiter.is_cancelled())) {
+                ++gave_up_;
+                ready.emplace_back(std::move(waiter.grant), std::nullopt);
+                queue_.pop_front();
+                continue;
+            }
+            size_t index = pick(waiter.tokens, now);
+            if (index == Lease::NONE) break;
+            long waited = config_.max_wait_ms - elapsed_ms(now, waiter.deadline);
+            max_waited_ms_ = std::max(max_waited_ms_, waited);
+            ready.emplace_back(std::move(waiter.grant), take(index, waiter.tokens));
+            queue_.pop_front();
+        }
+
+        if (!ready.empty()) {
+            lock.unlock();
+            for (auto& [grant, lease] : ready) grant(std::move(lease));
+            ready.clear();
+            lock.lock();
+            continue;
+        }
+
+        long wait = std::clamp(wait_ms(queue_.front().tokens, now), 1L, CANCEL_POLL_MS);
+        wake_.wait_for(lock, std::chrono::milliseconds(wait));
+    }
+}
+
+std::string KeyPool::stats_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = Clock::now();
+
+    json::JsonBuilder keys(256 * keys_.size() + 16);
+    keys.begin_array();
+    for (const Key& key : keys_) {
+        Key current = key;
+        double elapsed = static_cast<double>(elapsed_ms(current.updated, now));
+        current.requests.refill(elapsed);
+        current.input_tokens.refill(elapsed);
+        current.output_tokens.refill(elapsed);
+
+        json::JsonBuilder k(256);
+        k.begin_object();
+        // Enough of the key to tell them apart, never the whole thing
+        k.kv_string("key", "..." + key.value.substr(key.value.size() - std::min<size_t>(4, key.value.size())));
+        k.kv_int("calls", static_cast<int64_t>(key.calls));
+        k.kv_int("inFlight", static_cast<int64_t>(key.in_flight));
+        k.kv_int("throttled", static_cast<int64_t>(key.throttled));
+        k.kv_int("requestsLeft", static_cast<int64_t>(current.requests.level));
+        k.kv_int("requestsPerMinute", static_cast<int64_t>(current.requests.capacity));
+        k.kv_int("inputTokensLeft", static_cast<int64_t>(current.input_tokens.level));
+        k.kv_int("inputTokensPerMinute", static_cast<int64_t>(current.input_tokens.capacity));
+        k.kv_int("outputTokensLeft", static_cast<int64_t>(current.output_tokens.level));
+        k.kv_int("outputTokensPerMinute", static_cast<int64_t>(current.output_tokens.capacity));
+        k.key("parked");
+        k.value_bool(now < key.parked_until);
+        k.end_object();
+        keys.value_raw(k.str());
+    }
+    keys.end_array();
+
+    json::JsonBuilder j(keys.str().size() + 128);
+    j.begin_object();
+    j.kv_int("waiting", static_cast<int64_t>(queue_.size()));
+    j.kv_int("queued", static_cast<int64_t>(queued_));
+    j.kv_int("gaveUp", static_cast<int64_t>(gave_up_));
+    j.kv_int("maxWaitedMs", max_waited_ms_);
+    j.key("keys");
+    j.value_raw(keys.str());
+    j.end_object();
+    return j.str();
+}
+
+}
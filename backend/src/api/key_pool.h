@@ -0,0 +1,120 @@
+#pragma once
+#include "http_client.h"
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rpg {
+
+// Spreads calls over several API keys by tracking each key's rate limits on
+// the client. Every key has token buckets for requests, input tokens and
+// output tokens per minute, refilled continuously as the API does. They
+// start from configured guesses and are corrected by the
+// anthropic-ratelimit-* headers and the usage of every response.
+//
+// A call takes the key with the most headroom. When no key can take it, the
+// call waits in a FIFO queue until one can, rather than failing with a 429.
+class KeyPool {
+public:
+    struct Config {
+        // Assumed until a response reports the key's real limits
+        long requests_per_minute = 50;
+        long input_tokens_per_minute = 30000;
+        long output_tokens_per_minute = 8000;
+
+        long max_wait_ms = 120000;  // queued longer than this fails
+        long throttle_ms = 5000;    // 429 without retry-after parks the key this long
+    };
+
+    struct Lease {
+        static constexpr size_t NONE = static_cast<size_t>(-1);
+        size_t index = NONE;
+        std::string key;
+        long reserved_tokens = 0;  // input tokens taken up front
+    };
+
+    // Runs with a lease, or nullopt when the call was cancelled or waited too
+    // long. May run on the acquiring thread or on the pool's own thread, and
+    // must not block.
+    using Grant = std::function<void(std::optional<Lease>)>;
+
+    explicit KeyPool(Config config);
+    ~KeyPool();
+    KeyPool(const KeyPool&) = delete;
+    KeyPool& operator=(const KeyPool&) = delete;
+
+    // Replaces the pool's keys; call before serving
+    void set_keys(std::vector<std::string> keys);
+    size_t size() const;
+
+    void acquire(long estimated_input_tokens, std::function<bool()> is_cancelled, Grant grant);
+
+    // Returns the lease with what the call really cost (-1 when unknown) and
+    // learns the key's limits from the response headers
+    void release(const Lease& lease, const HttpResponse& response,
+                 long input_tokens, long output_tokens);
+
+    // Per-key headroom and counters for the stats endpoint, as a JSON object
+    std::string stats_json() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Bucket {
+        double capacity = 0;  // per minute
+        double level = 0;
+
+        void refill(double elapsed_ms);
+        double fraction() const { return capacity > 0 ? level / capacity : 0; }
+        // Milliseconds until level reaches amount; 0 if it already has
+        double wait_ms(double amount) const;
+        void sync(const HttpResponse& response, const std::string& prefix);
+    };
+
+    struct Key {
+        std::string value;
+        Bucket requests, input_tokens, output_tokens;
+        Clock::time_point updated;
+        Clock::time_point parked_until;  // after a 429
+        size_t in_flight = 0;
+        size_t calls = 0;
+        size_t throttled = 0;
+    };
+
+    struct Waiter {
+        long tokens;
+        std::function<bool()> is_cancelled;
+        Grant grant;
+        Clock::time_point deadline;
+    };
+
+    // All mutex_ held
+    void refill(Key& key, Clock::time_point now);
+    long fit(long tokens) const;  // a prompt larger than a bucket must still fit one
+    size_t pick(long tokens, Clock::time_point now);  // Lease::NONE if no key can take it
+    Lease take(size_t index, long tokens);
+    long wait_ms(long tokens, Clock::time_point now);  // until some key could take it
+
+    void run();
+
+    Config config_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    std::vector<Key> keys_;
+    std::deque<Waiter> queue_;
+    bool stopping_ = false;
+    std::thread thread_;
+
+    size_t queued_ = 0;     // calls that had to wait
+    size_t gave_up_ = 0;    // waited past max_wait_ms or were cancelled
+    long max_waited_ms_ = 0;
+};
+
+}
@@ -0,0 +1,255 @@
+#include "synthetic.h"
+#include "../util/json.h"
+#include "../util/tokens.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+namespace rpg { namespace synthetic {
+
+namespace {
+    // 1x1 transparent PNG
+    constexpr const char* TINY_PNG =
+        "iVBORw0KGgoAAAANSUhEUgAAAAEAAAABCAQAAAC1HAwCAAAAC0lEQVR42mNkYAAAAAYAAjCB0C8AAAAASUVORK5CYII=";
+
+    std::string sse(std::string_view event, const std::string& data) {
+        return "event: " + std::string(event) + "\ndata: " + data + "\n\n";
+    }
+
+    std::string canned_text(std::string_view request_body) {
+        if (request_body.find("[APPEARANCE]") != std::string_view::npos) {
+            return "[APPEARANCE]\nA weathered figure in a travel-stained cloak.\n[/APPEARANCE]\n\n"
+                   "[BACKGROUND]\nGrew up on the river docks and left to seek a fortune.\n[/BACKGROUND]\n\n"
+                   "[MOTIVATIONS]\n- Repay an old debt\n- Find a lost sibling\n[/MOTIVATIONS]\n\n"
+                   "[PERSONALITY]\nWary but fair, with a dry sense of humour.\n[/PERSONALITY]\n";
+        }
+        if (request_body.find("[DESCRIPTION]") != std::string_view::npos) {
+            return "[DESCRIPTION]\nA narrow stone hall lit by guttering lamps.\n[/DESCRIPTION]\n\n"
+                   "[ATMOSPHERE]\nDamp air, distant dripping, the smell of old smoke.\n[/ATMOSPHERE]\n\n"
+                   "[NOTABLE_FEATURES]\n- A sealed iron door\n- Faded murals\n- A dry well\n[/NOTABLE_FEATURES]\n";
+        }
+        return "[NARRATIVE]\nThe lamps flicker as the innkeeper looks up from the bar. "
+               "\"Another traveller,\" she says. \"Sit. The stew is almost warm.\"\n[/NARRATIVE]\n\n"
+               "[UPDATE:player.md]\n- The innkeeper offered a seat and stew\n[/UPDATE]\n";
+    }
+
+    constexpr const char* CANNED_STATE_OPS =
+        R"({"operations":[{"op":"add_item","item":"Bowl of stew"},)"
+        R"({"op":"add_note","text":"The innkeeper offered a seat and stew"}]})";
+
+    // Text of the final message if it is the assistant's (a prefill)
+    std::string prefill_of(std::string_view request_body) {
+        auto messages = json::split_array(json::extract_object(request_body, "messages"));
+        if (messages.empty() || json::extract_string(messages.back(), "role") != "assistant") return {};
+        std::string text;
+        for (auto block : json::split_array(json::extract_object(messages.back(), "content")))
+            text += json::unescape(json::extract_string(block, "text"));
+        return text;
+    }
+}
+
+int count_tokens(std::string_view text) {
+    return static_cast<int>(tokens::estimate(text));
+}
+
+Reply reply(std::string_view request_body) {
+    Reply out;
+    out.text = canned_text(request_body);
+
+    auto tools = json::split_array(json::extract_object(request_body, "tools"));
+    size_t update = out.text.find("[UPDATE:");
+    if (!tools.empty() && update != std::string::npos) {
+        out.text.resize(update);
+        out.tool_name = json::unescape(json::extract_string(tools.front(), "name"));
+        out.tool_input = CANNED_STATE_OPS;
+        out.stop_reason = "tool_use";
+    }
+
+    std::string prefill = prefill_of(request_body);
+    if (!prefill.empty()) {
+        // Continue after the prefill's last line, as if the model had written it
+        size_t tail = prefill.rfind('\n');
+        std::string last_line = prefill.substr(tail == std::string::npos ? 0 : tail + 1);
+        size_t at = out.text.find(last_line);
+        out.text = at == std::string::npos ? std::string() : out.text.substr(at + last_line.size());
+    }
+
+    size_t cut = std::string::npos;
+    for (auto stop : json::split_array(json::extract_object(request_body, "stop_sequences"))) {
+        std::string sequence = json::unescape(stop.substr(1, stop.size() - 2));
+        if (!sequence.empty()) cut = std::min(cut, out.text.find(sequence));
+    }
+    if (cut != std::string::npos) {
+        out.text.resize(cut);
+        out.tool_name.clear();
+        out.tool_input.clear();
+        out.stop_reason = "stop_sequence";
+    }
+    return out;
+}
+
+std::string claude_message(const Reply& reply, int input_tokens, int output_tokens) {
+    std::string_view text = reply.text;
+    json::JsonBuilder content(text.size() + reply.tool_input.size() + 128);
+    content.begin_array();
+    if (!text.empty() || reply.tool_name.empty()) {
+        json::JsonBuilder block(text.size() + 64);
+        block.begin_object();
+        block.kv_string("type", "text");
+        block.kv_string("text", text);
+        block.end_object();
+        content.value_raw(block.str());
+    }
+    if (!reply.tool_name.empty()) {
+        json::JsonBuilder block(reply.tool_input.size() + 96);
+        block.begin_object();
+        block.kv_string("type", "tool_use");
+        block.kv_string("id", "toolu_synthetic");
+        block.kv_string("name", reply.tool_name);
+        block.key("input");
+        block.value_raw(reply.tool_input);
+        block.end_object();
+        content.value_raw(block.str());
+    }
+    content.end_array();
+
+    json::JsonBuilder usage(128);
+    usage.begin_object();
+    usage.kv_int("input_tokens", input_tokens);
+    usage.kv_int("cache_creation_input_tokens", 0);
+    usage.kv_int("cache_read_input_tokens", 0);
+    usage.kv_int("output_tokens", output_tokens);
+    usage.end_object();
+
+    json::JsonBuilder j(text.size() + 256);
+    j.begin_object();
+    j.kv_string("id", "msg_synthetic");
+    j.kv_string("type", "message");
+    j.kv_string("role", "assistant");
+    j.key("content");
+    j.value_raw(content.str());
+    j.kv_string("stop_reason", reply.stop_reason);
+    j.key("usage");
+    j.value_raw(usage.str());
+    j.end_object();
+    return j.str();
+}
+
+std::string claude_stream(const Reply& reply, int input_tokens, int output_tokens) {
+    std::string_view text = reply.text;
+    std::string out;
+    out += sse("message_start", R"({"type":"message_start","message":{"id":"msg_synthetic","usage":{"input_tokens":)" +
+                                std::to_string(input_tokens) + "}}}");
+
+    // A few words per delta, like the real API
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t end = pos;
+        for (int words = 0; end < text.size() && words < 3; ++words) {
+            end = text.find(' ', end + 1);
+            if (end == std::string_view::npos) end = text.size();
+        }
+        json::JsonBuilder delta(end - pos + 96);
+        delta.begin_object();
+        delta.kv_string("type", "content_block_delta");
+        delta.kv_int("index", 0);
+        delta.key("delta");
+        json::JsonBuilder inner(end - pos + 48);
+        inner.begin_object();
+        inner.kv_string("type", "text_delta");
+        inner.kv_string("text", text.substr(pos, end - pos));
+        inner.end_object();
+        delta.value_raw(inner.str());
+        delta.end_object();
+        out += sse("content_block_delta", delta.str());
+        pos = end;
+    }
+
+    if (!reply.tool_name.empty()) {
+        json::JsonBuilder start(128);
+        start.begin_object();
+        start.kv_string("type", "content_block_start");
+        start.kv_int("index", 1);
+        start.key("content_block");
+        json::JsonBuilder block(96);
+        block.begin_object();
+        block.kv_string("type", "tool_use");
+        block.kv_string("id", "toolu_synthetic");
+        block.kv_string("name", reply.tool_name);
+        block.key("input");
+        block.value_raw("{}");
+        block.end_object();
+        start.value_raw(block.str());
+        start.end_object();
+        out += sse("content_block_start", start.str());
+
+        // The input in a few fragments, split anywhere as the real API does
+        std::string_view input = reply.tool_input;
+        size_t step = input.size() / 3 + 1;
+        for (size_t at = 0; at < input.size(); at += step) {
+            json::JsonBuilder delta(step + 96);
+            delta.begin_object();
+            delta.kv_string("type", "content_block_delta");
+            delta.kv_int("index", 1);
+            delta.key("delta");
+            json::JsonBuilder inner(step + 48);
+            inner.begin_object();
+            inner.kv_string("type", "input_json_delta");
+            inner.kv_string("partial_json", input.substr(at, step));
+            inner.end_object();
+            delta.value_raw(inner.str());
+            delta.end_object();
+            out += sse("content_block_delta", delta.str());
+        }
+        out += sse("content_block_stop", R"({"type":"content_block_stop","index":1})");
+    }
+
+    out += sse("message_delta", R"({"type":"message_delta","delta":{"stop_reason":")" + reply.stop_reason +
+                                R"("},"usage":{"output_tokens":)" + std::to_string(output_tokens) + "}}");
+    out += sse("message_stop", R"({"type":"message_stop"})");
+    return out;
+}
+
+std::string gemini_image() {
+    return std::string(R"({"candidates":[{"content":{"parts":[{"inlineData":{"mimeType":"image/png","data":")") +
+           TINY_PNG + R"("}}]}}]})";
+}
+
+LatencyModel LatencyModel::parse(std::string_view spec, unsigned seed) {
+    LatencyModel model;
+    model.rng_.seed(seed);
+
+    std::string s(spec);
+    size_t colon = s.find(':');
+    std::string kind = s.substr(0, colon);
+    double args[2] = {0, 0};
+    for (int i = 0; i < 2 && colon != std::string::npos; ++i) {
+        args[i] = std::strtod(s.c_str() + colon + 1, nullptr);
+        colon = s.find(':', colon + 1);
+    }
+
+    if (kind == "fixed") model.kind_ = Kind::Fixed;
+    else if (kind == "uniform") model.kind_ = Kind::Uniform;
+    else if (kind == "lognormal") model.kind_ = Kind::LogNormal;
+    model.a_ = args[0];
+    model.b_ = args[1];
+    return model;
+}
+
+long LatencyModel::sample_ms(long recorded_ms) {
+    switch (kind_) {
+        case Kind::Recorded:
+            return std::max(0L, recorded_ms);
+        case Kind::Fixed:
+            return static_cast<long>(a_);
+        case Kind::Uniform:
+            return static_cast<long>(std::uniform_real_distribution<double>(a_, std::max(a_, b_))(rng_));
+        case Kind::LogNormal:
+            // a_ is the median, b_ the sigma of the underlying normal
+            return static_cast<long>(std::lognormal_distribution<double>(
+                std::log(std::max(1.0, a_)), b_)(rng_));
+    }
+    return 0;
+}
+
+} }
@@ -0,0 +1,57 @@
+#pragma once
+#include <random>
+#include <string>
+#include <string_view>
+
+namespace rpg {
+
+// Canned upstream responses in the exact wire formats ClaudeAPI and
+// GeminiAPI parse, for offline runs (replay transport, mock_llm server)
+namespace synthetic {
+
+    struct Reply {
+        std::string text;
+        std::string tool_name;   // a tool_use block follows the text when set
+        std::string tool_input;  // its JSON input
+        std::string stop_reason = "end_turn";
+    };
+
+    // Text shaped like what a Messages request asks for: character or
+    // location sections for the generate prompts, a narrator turn with an
+    // update block otherwise. When the request offers tools, the turn's
+    // changes come as a call to the first one instead. Honours the request's
+    // stop_sequences and continues an assistant prefill from where it ends.
+    Reply reply(std::string_view request_body);
+
+    // Messages API: a complete JSON response, or the SSE stream of one
+    std::string claude_message(const Reply& reply, int input_tokens, int output_tokens);
+    std::string claude_stream(const Reply& reply, int input_tokens, int output_tokens);
+
+    // generateContent response carrying a 1x1 PNG
+    std::string gemini_image();
+
+    // Rough token count used for the usage fields
+    int count_tokens(std::string_view text);
+
+    // Response delay: "fixed:MS", "uniform:MIN:MAX", "lognormal:MEDIAN:SIGMA"
+    // or "recorded" (use the capture's own latency). Sampling is seeded, so
+    // the same sequence of calls gets the same delays.
+    class LatencyModel {
+    public:
+        static LatencyModel parse(std::string_view spec, unsigned seed = 1);
+
+        // recorded_ms is used by "recorded" and ignored otherwise; -1 if unknown
+        long sample_ms(long recorded_ms = -1);
+
+        bool recorded() const { return kind_ == Kind::Recorded; }
+
+    private:
+        enum class Kind { Recorded, Fixed, Uniform, LogNormal };
+        Kind kind_ = Kind::Recorded;
+        double a_ = 0, b_ = 0;
+        std::mt19937 rng_;
+    };
+
+}
+
+}
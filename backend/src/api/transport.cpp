@@ -0,0 +1,320 @@
+#include "transport.h"
+#include "synthetic.h"
+#include "../util/file_utils.h"
+#include "../util/hash.h"
+#include "../util/json.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <queue>
+
+namespace rpg {
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    std::string env_or(const char* name, const char* fallback) {
+        const char* value = std::getenv(name);
+        return value && *value ? value : fallback;
+    }
+
+    std::string strip_query(const std::string& url) {
+        return url.substr(0, url.find('?'));
+    }
+
+    // "/v1/messages" from "https://host/v1/messages?key=..."
+    std::string path_of(const std::string& url) {
+        size_t scheme = url.find("://");
+        size_t start = url.find('/', scheme == std::string::npos ? 0 : scheme + 3);
+        return start == std::string::npos ? "/" : strip_query(url.substr(start));
+    }
+
+    class LiveTransport : public Transport {
+    public:
+        void submit_after(std::chrono::milliseconds delay, HttpRequest request,
+                          Callback on_complete) override {
+            HttpClient::instance().submit_after(delay, std::move(request), std::move(on_complete));
+        }
+
+        void post(std::function<void()> task) override {
+            HttpClient::instance().post(std::move(task));
+        }
+
+        const char* mode() const override { return "live"; }
+    };
+
+    // Live calls, with each completed exchange written to dir/<key>.json.
+    // Only the URL without its query, the request body and the response are
+    // stored; headers (and so API keys) never reach disk.
+    class RecordingTransport : public Transport {
+    public:
+        explicit RecordingTransport(std::string dir) : dir_(std::move(dir)) {
+            file::make_dirs(dir_);
+        }
+
+        void submit_after(std::chrono::milliseconds delay, HttpRequest request,
+                          Callback on_complete) override {
+            auto streamed = std::make_shared<std::string>();
+            if (request.on_data) {
+                request.on_data = [streamed, inner = std::move(request.on_data)](std::string_view chunk) {
+                    streamed->append(chunk);
+                    return inner(chunk);
+                };
+            }
+
+            std::string path = dir_ + "/" + exchange_key(request) + ".json";
+            std::string url = strip_query(request.url);
+            std::string body = request.body;
+            auto started = Clock::now() + delay;
+
+            HttpClient::instance().submit_after(delay, std::move(request),
+                [path = std::move(path), url = std::move(url), body = std::move(body),
+                 started, streamed, on_complete = std::move(on_complete)](HttpResponse response) {
+                    if (response.success) {
+                        long latency = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                            Clock::now() - started).count());
+                        json::JsonBuilder j(body.size() + response.body.size() + streamed->size() + 256);
+                        j.begin_object();
+                        j.kv_string("url", url);
+                        j.kv_string("request", body);
+                        j.kv_int("status", response.status);
+                        j.kv_string("contentType", response.header("content-type"));
+                        j.kv_int("latencyMs", latency);
+                        j.kv_string("body", streamed->empty() ? response.body : *streamed);
+                        j.end_object();
+                        if (!file::write_file(path, j.str()))
+                            fprintf(stderr, "Could not record exchange to %s\n", path.c_str());
+                    }
+                    on_complete(std::move(response));
+                });
+        }
+
+        void post(std::function<void()> task) override {
+            HttpClient::instance().post(std::move(task));
+        }
+
+        const char* mode() const override { return "record"; }
+
+    private:
+        std::string dir_;
+    };
+
+    // Serves captures from dir, falling back to synthetic responses, without
+    // touching the network. A single scheduler thread plays the role of the
+    // event loop: tasks run in due order and never sleep while running.
+    class ReplayTransport : public Transport {
+    public:
+        ReplayTransport(std::string dir, synthetic::LatencyModel latency, long event_ms)
+            : dir_(std::move(dir)), latency_(std::move(latency)), event_ms_(event_ms),
+              replaying_recorded_(latency_.recorded()) {
+            thread_ = std::thread([this] { run(); });
+        }
+
+        ~ReplayTransport() override {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+            }
+            wake_.notify_all();
+            if (thread_.joinable()) thread_.join();
+        }
+
+        void submit_after(std::chrono::milliseconds delay, HttpRequest request,
+                          Callback on_complete) override {
+            auto exchange = std::make_shared<Exchange>();
+            exchange->request = std::move(request);
+            exchange->on_complete = std::move(on_complete);
+            schedule(Clock::now() + delay, [this, exchange] { start(exchange); });
+        }
+
+        void post(std::function<void()> task) override {
+            schedule(Clock::now(), std::move(task));
+        }
+
+        const char* mode() const override { return "replay"; }
+
+    private:
+        struct Exchange {
+            HttpRequest request;
+            Callback on_complete;
+            HttpResponse response;
+            std::vector<std::string> events;  // SSE events still to hand to on_data
+            size_t next_event = 0;
+        };
+
+        struct Task {
+            Clock::time_point due;
+            uint64_t seq;
+            std::function<void()> run;
+            bool operator>(const Task& other) const {
+                return due != other.due ? due > other.due : seq > other.seq;
+            }
+        };
+
+        void schedule(Clock::time_point due, std::function<void()> fn) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_.push(Task{due, next_seq_++, std::move(fn)});
+            }
+            wake_.notify_one();
+        }
+
+        void run() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopping_) {
+                if (tasks_.empty()) {
+                    wake_.wait(lock);
+                    continue;
+                }
+                if (Clock::now() < tasks_.top().due) {
+                    wake_.wait_until(lock, tasks_.top().due);
+                    continue;
+                }
+                Task task = tasks_.top();
+                tasks_.pop();
+                lock.unlock();
+                task.run();
+                lock.lock();
+            }
+        }
+
+        bool cancelled(const std::shared_ptr<Exchange>& exchange) {
+            if (!exchange->request.is_cancelled || !exchange->request.is_cancelled()) return false;
+            HttpResponse response;
+            response.cancelled = true;
+            response.error = "cancelled";
+            exchange->on_complete(std::move(response));
+            return true;
+        }
+
+        // Picks the answer and its delay; runs when the request would have been sent
+        void start(const std::shared_ptr<Exchange>& exchange) {
+            if (cancelled(exchange)) return;
+
+            const HttpRequest& request = exchange->request;
+            HttpResponse& response = exchange->response;
+            response.success = true;
+            long recorded_ms = -1;
+
+            std::string capture = file::read_file(dir_ + "/" + exchange_key(request) + ".json");
+            std::string content_type = "application/json";
+            if (!capture.empty()) {
+                response.status = json::extract_int(capture, "status", 200);
+                response.body = json::unescape(json::extract_string(capture, "body"));
+                content_type = json::unescape(json::extract_string(capture, "contentType"));
+                recorded_ms = json::extract_int(capture, "latencyMs", -1);
+            } else {
+                response.status = 200;
+                std::string url = path_of(request.url);
+                if (url.find(":generateContent") != std::string::npos) {
+                    response.body = synthetic::gemini_image();
+                } else if (url.find("/v1/messages") != std::string::npos) {
+                    auto reply = synthetic::reply(request.body);
+                    int in = synthetic::count_tokens(request.body);
+                    int out = synthetic::count_tokens(reply.text) + synthetic::count_tokens(reply.tool_input);
+                    if (json::extract_bool(request.body, "stream")) {
+                        response.body = synthetic::claude_stream(reply, in, out);
+                        content_type = "text/event-stream";
+                    } else {
+                        response.body = synthetic::claude_message(reply, in, out);
+                    }
+                }
+            }
+            response.headers.emplace_back("content-type", content_type);
+
+            long delay_ms;
+            {
+                std::lock_guard<std::mutex> lock(latency_mutex_);
+                delay_ms = latency_.sample_ms(recorded_ms);
+            }
+
+            // A sampled delay past the request's own limit plays out as a timeout
+            if (request.timeout_ms > 0 && delay_ms >= request.timeout_ms) {
+                schedule(Clock::now() + std::chrono::milliseconds(request.timeout_ms), [exchange] {
+                    HttpResponse timed_out;
+                    timed_out.timed_out = true;
+                    timed_out.error = "timed out (replay)";
+                    exchange->on_complete(std::move(timed_out));
+                });
+                return;
+            }
+
+            // Streams trickle out one SSE event at a time, like the real thing
+            if (request.on_data && response.status < 400) {
+                std::string_view body = response.body;
+                size_t pos = 0;
+                while (pos < body.size()) {
+                    size_t end = body.find("\n\n", pos);
+                    end = end == std::string_view::npos ? body.size() : end + 2;
+                    exchange->events.emplace_back(body.substr(pos, end - pos));
+                    pos = end;
+                }
+                response.body.clear();
+
+                // A recorded latency already covers the whole stream
+                long spacing = exchange->events.empty() ? 0 : event_ms_ * static_cast<long>(exchange->events.size() - 1);
+                if (replaying_recorded_ && recorded_ms >= 0) delay_ms = std::max(0L, delay_ms - spacing);
+            }
+
+            schedule(Clock::now() + std::chrono::milliseconds(delay_ms), [this, exchange] { deliver(exchange); });
+        }
+
+        void deliver(const std::shared_ptr<Exchange>& exchange) {
+            if (cancelled(exchange)) return;
+
+            if (exchange->next_event < exchange->events.size()) {
+                if (!exchange->request.on_data(exchange->events[exchange->next_event++])) {
+                    HttpResponse aborted;
+                    aborted.status = exchange->response.status;
+                    aborted.error = "aborted by receiver";
+                    exchange->on_complete(std::move(aborted));
+                    return;
+                }
+                if (exchange->next_event < exchange->events.size()) {
+                    schedule(Clock::now() + std::chrono::milliseconds(event_ms_),
+                             [this, exchange] { deliver(exchange); });
+                    return;
+                }
+            }
+            exchange->on_complete(std::move(exchange->response));
+        }
+
+        std::string dir_;
+        std::mutex latency_mutex_;
+        synthetic::LatencyModel latency_;
+        long event_ms_;
+        bool replaying_recorded_;
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        std::priority_queue<Task, std::vector<Task>, std::greater<Task>> tasks_;
+        uint64_t next_seq_ = 0;
+        bool stopping_ = false;
+        std::thread thread_;
+    };
+}
+
+std::string Transport::exchange_key(const HttpRequest& request) {
+    return hash::digest128(path_of(request.url) + "\n" + request.body);
+}
+
+Transport& Transport::instance() {
+    static std::unique_ptr<Transport> transport = [] () -> std::unique_ptr<Transport> {
+        std::string mode = env_or("RPG_TRANSPORT", "live");
+        std::string dir = env_or("RPG_TRANSPORT_DIR", "recordings");
+        if (mode == "record") return std::make_unique<RecordingTransport>(dir);
+        if (mode == "replay") {
+            auto seed = static_cast<unsigned>(std::strtoul(env_or("RPG_REPLAY_SEED", "1").c_str(), nullptr, 10));
+            long event_ms = std::strtol(env_or("RPG_REPLAY_EVENT_MS", "20").c_str(), nullptr, 10);
+            return std::make_unique<ReplayTransport>(
+                dir, synthetic::LatencyModel::parse(env_or("RPG_REPLAY_LATENCY", "recorded"), seed), event_ms);
+        }
+        if (mode != "live") fprintf(stderr, "Unknown RPG_TRANSPORT '%s', using live\n", mode.c_str());
+        return std::make_unique<LiveTransport>();
+    }();
+    return *transport;
+}
+
+}
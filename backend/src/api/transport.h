@@ -0,0 +1,42 @@
+#pragma once
+#include "http_client.h"
+#include <chrono>
+
+namespace rpg {
+
+// Where upstream calls actually go. Chosen once at startup from
+// RPG_TRANSPORT:
+//   live    (default) HttpClient, i.e. the real APIs
+//   record  live, and every exchange is also written to RPG_TRANSPORT_DIR
+//   replay  no network: answers come from RPG_TRANSPORT_DIR, or are
+//           synthesized when nothing was captured for a request
+// Replay delays each answer by RPG_REPLAY_LATENCY (see
+// synthetic::LatencyModel; default "recorded") and streams SSE bodies one
+// event per RPG_REPLAY_EVENT_MS. Callbacks follow the HttpClient contract:
+// one thread, must not block.
+class Transport {
+public:
+    using Callback = HttpClient::Callback;
+
+    virtual ~Transport() = default;
+
+    static Transport& instance();
+
+    virtual void submit_after(std::chrono::milliseconds delay, HttpRequest request,
+                              Callback on_complete) = 0;
+    void submit(HttpRequest request, Callback on_complete) {
+        submit_after(std::chrono::milliseconds(0), std::move(request), std::move(on_complete));
+    }
+
+    // Runs task on the callback thread; it must not block either
+    virtual void post(std::function<void()> task) = 0;
+
+    virtual const char* mode() const = 0;
+
+    // Captures are keyed by URL path and request body. Host and query are
+    // left out, so a capture replays whatever base URL it was recorded
+    // against, and API keys in query strings never end up in a key.
+    static std::string exchange_key(const HttpRequest& request);
+};
+
+}
@@ -0,0 +1,253 @@
+#include "upstream_policy.h"
+#include "transport.h"
+#include "../util/json.h"
+#include <algorithm>
+#include <cstdlib>
+#include <random>
+
+namespace rpg {
+
+struct UpstreamPolicy::Call {
+    HttpRequest request;  // copied for each attempt
+    HttpClient::Callback on_complete;
+    std::function<bool()> caller_cancelled;
+    Clock::time_point deadline;
+
+    // Event loop thread only; submit() hands the call over before any attempt starts
+    int attempts = 0;
+    int outstanding = 0;
+    bool done = false;
+    bool delivered = false;  // streamed bytes reached the caller; no more retries
+    bool probe = false;      // admitted as the half-open breaker's single probe
+};
+
+UpstreamPolicy::UpstreamPolicy(std::string name, Config config)
+    : name_(std::move(name)), config_(config) {
+    latencies_ms_.reserve(LATENCY_SAMPLES);
+}
+
+void UpstreamPolicy::submit(HttpRequest request, HttpClient::Callback on_complete) {
+    ++calls_;
+    auto call = std::make_shared<Call>();
+    call->on_complete = std::move(on_complete);
+    call->caller_cancelled = std::move(request.is_cancelled);
+    call->deadline = Clock::now() + std::chrono::milliseconds(config_.deadline_ms);
+
+    // Losing attempts and timers for a finished call stop on their own. A raw
+    // pointer avoids a cycle through call->request; every attempt's completion
+    // callback keeps the call alive while these can run.
+    Call* c = call.get();
+    request.is_cancelled = [c] {
+        return c->done || (c->caller_cancelled && c->caller_cancelled());
+    };
+    if (request.on_data) {
+        request.on_data = [c, on_data = std::move(request.on_data)](std::string_view chunk) {
+            c->delivered = true;
+            return on_data(chunk);
+        };
+    }
+    request.connect_timeout_ms = config_.connect_timeout_ms;
+    call->request = std::move(request);
+
+    // Everything from here, the fast failure included, runs on the event
+    // loop, so the call's state has a single owner and on_complete always
+    // arrives on the same thread
+    Transport::instance().post([self = shared_from_this(), call] { self->begin(call); });
+}
+
+void UpstreamPolicy::begin(const std::shared_ptr<Call>& call) {
+    if (!breaker_allows(call->probe)) {
+        ++fast_failures_;
+        HttpResponse response;
+        response.error = name_ + " is unavailable (circuit open), try again shortly";
+        call->done = true;
+        call->on_complete(std::move(response));
+        return;
+    }
+
+    start_attempt(call, 0, false);
+
+    long hedge_after = config_.hedge && !call->request.on_data ? hedge_delay_ms() : -1;
+    if (hedge_after >= 0 && !call->probe) {
+        ++hedges_;
+        start_attempt(call, hedge_after, true);
+    }
+}
+
+void UpstreamPolicy::start_attempt(const std::shared_ptr<Call>& call, long delay_ms, bool hedge) {
+    HttpRequest request = call->request;
+    if (!request.on_data) {
+        // The attempt may not outlive the call's deadline
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            call->deadline - Clock::now()).count() - delay_ms;
+        request.timeout_ms = std::max<long>(1, static_cast<long>(remaining));
+    } else {
+        request.stall_timeout_ms = config_.stall_timeout_ms;
+    }
+
+    ++call->attempts;
+    ++call->outstanding;
+    auto self = shared_from_this();
+    auto started = Clock::now() + std::chrono::milliseconds(delay_ms);
+    Transport::instance().submit_after(std::chrono::milliseconds(delay_ms), std::move(request),
+        [self, call, started, hedge](HttpResponse response) {
+            self->attempt_done(call, std::move(response), started, hedge);
+        });
+}
+
+void UpstreamPolicy::attempt_done(const std::shared_ptr<Call>& call, HttpResponse response,
+                                  Clock::time_point started, bool hedge) {
+    --call->outstanding;
+    if (call->done) return;  // lost the race to another attempt
+
+    // Cancelled by the caller, or an answer that another attempt would not change
+    if (response.cancelled || !retryable(response)) {
+        if (!response.cancelled) {
+            breaker_record(true);
+            if (response.status < 400) {
+                record_latency(static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    Clock::now() - started).count()));
+                if (hedge) ++hedge_wins_;
+            }
+        } else if (call->probe) {
+            // Inconclusive probe; let the next call try
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (breaker_ == Breaker::HalfOpen) breaker_ = Breaker::Open;
+        }
+        finish(call, std::move(response));
+        return;
+    }
+
+    if (unhealthy(response)) breaker_record(false);
+    else breaker_record(true);
+
+    // The other copy of a hedged call may still succeed
+    if (call->outstanding > 0) return;
+
+    long delay = backoff_ms(call->attempts, response);
+    auto retry_at = Clock::now() + std::chrono::milliseconds(delay);
+    bool can_retry = call->attempts < config_.max_attempts && !call->delivered &&
+                     retry_at < call->deadline && breaker_allows(call->probe);
+    if (!can_retry) {
+        finish(call, std::move(response));
+        return;
+    }
+
+    ++retries_;
+    start_attempt(call, delay, false);
+}
+
+void UpstreamPolicy::finish(const std::shared_ptr<Call>& call, HttpResponse response) {
+    call->done = true;
+    if (!response.cancelled && (!response.success || response.status >= 400)) ++failures_;
+    if (call->on_complete) call->on_complete(std::move(response));
+}
+
+long UpstreamPolicy::backoff_ms(int attempt, const HttpResponse& response) const {
+    // Equal jitter: half the exponential step, plus up to the other half at random
+    long step = config_.backoff_base_ms << std::min(attempt - 1, 16);
+    step = std::min(step, config_.backoff_max_ms);
+    thread_local std::mt19937 rng{std::random_device{}()};
+    long delay = step / 2 + std::uniform_int_distribution<long>(0, step / 2)(rng);
+
+    // retry-after is in seconds; the HTTP-date form is not used by these APIs
+    std::string retry_after = response.header("retry-after");
+    if (!retry_after.empty()) {
+        char* end = nullptr;
+        double seconds = std::strtod(retry_after.c_str(), &end);
+        if (end != retry_after.c_str() && seconds > 0) {
+            delay = std::max(delay, static_cast<long>(seconds * 1000));
+        }
+    }
+    return delay;
+}
+
+long UpstreamPolicy::hedge_delay_ms() const {
+    std::vector<long> samples;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (latencies_ms_.size() < config_.hedge_min_samples) return -1;
+        samples = latencies_ms_;
+    }
+    auto p95 = samples.begin() + (samples.size() * 95) / 100;
+    std::nth_element(samples.begin(), p95, samples.end());
+    return std::max(config_.hedge_min_delay_ms, *p95);
+}
+
+void UpstreamPolicy::record_latency(long ms) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (latencies_ms_.size() < LATENCY_SAMPLES) {
+        latencies_ms_.push_back(ms);
+    } else {
+        latencies_ms_[latency_next_] = ms;
+        latency_next_ = (latency_next_ + 1) % LATENCY_SAMPLES;
+    }
+}
+
+bool UpstreamPolicy::breaker_allows(bool& probe) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    switch (breaker_) {
+        case Breaker::Closed:
+            return true;
+        case Breaker::Open:
+            if (Clock::now() < open_until_) return false;
+            breaker_ = Breaker::HalfOpen;
+            probe = true;
+            return true;
+        case Breaker::HalfOpen:
+            // One probe at a time; its result closes or reopens the breaker
+            return false;
+    }
+    return false;
+}
+
+void UpstreamPolicy::breaker_record(bool healthy) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (healthy) {
+        consecutive_failures_ = 0;
+        breaker_ = Breaker::Closed;
+        return;
+    }
+    ++consecutive_failures_;
+    if (breaker_ == Breaker::HalfOpen || consecutive_failures_ >= config_.breaker_threshold) {
+        breaker_ = Breaker::Open;
+        open_until_ = Clock::now() + std::chrono::milliseconds(config_.breaker_cooldown_ms);
+    }
+}
+
+bool UpstreamPolicy::retryable(const HttpResponse& response) {
+    if (response.cancelled) return false;
+    if (!response.success) return true;
+    return response.status == 429 || response.status >= 500;
+}
+
+bool UpstreamPolicy::unhealthy(const HttpResponse& response) {
+    // 429 means this client is over its rate limit, not that the upstream is down
+    if (response.cancelled) return false;
+    return !response.success || response.status >= 500;
+}
+
+std::string UpstreamPolicy::stats_json() const {
+    const char* state = "closed";
+    long p95 = hedge_delay_ms();
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (breaker_ == Breaker::Open) state = "open";
+        else if (breaker_ == Breaker::HalfOpen) state = "halfOpen";
+    }
+
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_string("breaker", state);
+    j.kv_int("calls", static_cast<int64_t>(calls_.load()));
+    j.kv_int("retries", static_cast<int64_t>(retries_.load()));
+    j.kv_int("hedges", static_cast<int64_t>(hedges_.load()));
+    j.kv_int("hedgeWins", static_cast<int64_t>(hedge_wins_.load()));
+    j.kv_int("fastFailures", static_cast<int64_t>(fast_failures_.load()));
+    j.kv_int("failures", static_cast<int64_t>(failures_.load()));
+    j.kv_int("hedgeAfterMs", p95);
+    j.end_object();
+    return j.str();
+}
+
+}
@@ -0,0 +1,91 @@
+#pragma once
+#include "http_client.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rpg {
+
+// Deadlines, retries, hedging and a circuit breaker around one upstream API.
+// Every call goes through submit(); the caller still gets exactly one
+// HttpResponse, the first success or the last failure.
+//
+// Retried: transport errors, timeouts, 429, 529 and 5xx. Streaming calls are
+// not retried once any bytes have been handed to on_data, and never hedged.
+class UpstreamPolicy : public std::enable_shared_from_this<UpstreamPolicy> {
+public:
+    struct Config {
+        long connect_timeout_ms = 5000;
+        long deadline_ms = 120000;      // whole call, retries included
+        long stall_timeout_ms = 30000;  // streaming calls: longest silence
+
+        int max_attempts = 3;
+        long backoff_base_ms = 500;  // doubled per retry, with jitter
+        long backoff_max_ms = 8000;
+
+        // Sends a second copy of a call still running after the p95 latency
+        // of recent calls; whichever answers first wins
+        bool hedge = false;
+        long hedge_min_delay_ms = 1000;
+        size_t hedge_min_samples = 20;
+
+        // Consecutive unhealthy responses that open the breaker, and how long
+        // it fails calls fast before letting one probe through
+        int breaker_threshold = 5;
+        long breaker_cooldown_ms = 30000;
+    };
+
+    UpstreamPolicy(std::string name, Config config);
+
+    // on_complete runs on the Transport callback thread, fast failures included
+    void submit(HttpRequest request, HttpClient::Callback on_complete);
+
+    // State and counters for the stats endpoint, as a JSON object
+    std::string stats_json() const;
+
+private:
+    struct Call;
+    using Clock = std::chrono::steady_clock;
+    enum class Breaker { Closed, Open, HalfOpen };
+
+    void begin(const std::shared_ptr<Call>& call);
+    void start_attempt(const std::shared_ptr<Call>& call, long delay_ms, bool hedge);
+    void attempt_done(const std::shared_ptr<Call>& call, HttpResponse response,
+                      Clock::time_point started, bool hedge);
+    void finish(const std::shared_ptr<Call>& call, HttpResponse response);
+
+    long backoff_ms(int attempt, const HttpResponse& response) const;
+    long hedge_delay_ms() const;  // -1 while there are too few samples
+    void record_latency(long ms);
+
+    // Sets probe when the caller becomes the half-open breaker's single probe
+    bool breaker_allows(bool& probe);
+    void breaker_record(bool healthy);
+
+    static bool retryable(const HttpResponse& response);
+    static bool unhealthy(const HttpResponse& response);
+
+    static constexpr size_t LATENCY_SAMPLES = 128;
+
+    std::string name_;
+    Config config_;
+
+    mutable std::mutex mutex_;
+    std::vector<long> latencies_ms_;  // ring of recent successful call latencies
+    size_t latency_next_ = 0;
+    Breaker breaker_ = Breaker::Closed;
+    int consecutive_failures_ = 0;
+    Clock::time_point open_until_;
+
+    std::atomic<size_t> calls_{0};
+    std::atomic<size_t> retries_{0};
+    std::atomic<size_t> hedges_{0};  // hedge timers armed
+    std::atomic<size_t> hedge_wins_{0};
+    std::atomic<size_t> fast_failures_{0};
+    std::atomic<size_t> failures_{0};
+};
+
+}
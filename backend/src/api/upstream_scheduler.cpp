@@ -0,0 +1,162 @@
+#include "upstream_scheduler.h"
+#include "../util/json.h"
+#include <algorithm>
+#include <cstdlib>
+
+namespace rpg {
+
+namespace {
+    constexpr const char* CLASS_NAMES[] = {"interactive", "editor", "background"};
+
+    size_t env_size(const char* name, size_t fallback) {
+        const char* value = std::getenv(name);
+        if (!value || !*value) return fallback;
+        long parsed = std::strtol(value, nullptr, 10);
+        return parsed >= 0 ? static_cast<size_t>(parsed) : fallback;
+    }
+
+    long percentile(std::vector<long> samples, int pct) {
+        if (samples.empty()) return 0;
+        size_t index = (samples.size() - 1) * static_cast<size_t>(pct) / 100;
+        std::nth_element(samples.begin(), samples.begin() + static_cast<long>(index), samples.end());
+        return samples[index];
+    }
+}
+
+UpstreamScheduler& UpstreamScheduler::instance() {
+    static UpstreamScheduler scheduler([] {
+        Config config;
+        config.slots = std::max<size_t>(1, env_size("RPG_UPSTREAM_SLOTS", config.slots));
+        config.interactive_reserve = std::min(config.slots - 1,
+                                              env_size("RPG_UPSTREAM_RESERVE", config.interactive_reserve));
+        return config;
+    }());
+    return scheduler;
+}
+
+UpstreamScheduler::UpstreamScheduler(Config config) : config_(config) {
+    for (auto& c : classes_) c.waits_ms.reserve(WAIT_SAMPLES);
+}
+
+void UpstreamScheduler::submit(const UpstreamTag& tag, std::function<bool()> is_cancelled, Grant grant) {
+    size_t cls = static_cast<size_t>(tag.priority);
+    Slot slot;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        Class& c = classes_[cls];
+        auto now = Clock::now();
+
+        // Waiters are dispatched whenever capacity allows, so only our own
+        // class can be queued for capacity we could use
+        if (c.waiting == 0 && has_capacity(cls)) {
+            slot = take(cls, now);
+        } else {
+            Flow& flow = c.flows[tag.flow];
+            double start = std::max(c.virtual_time, flow.last_finish);
+            flow.last_finish = start + 1.0 / std::max(0.01, tag.weight);
+            flow.waiters.push_back(Waiter{flow.last_finish, now, std::move(is_cancelled), std::move(grant)});
+            ++c.waiting;
+            return;
+        }
+    }
+    grant(std::move(slot));
+}
+
+bool UpstreamScheduler::has_capacity(size_t cls) const {
+    if (in_flight_ >= config_.slots) return false;
+    if (cls == static_cast<size_t>(Priority::Interactive)) return true;
+    size_t shared = in_flight_ - classes_[static_cast<size_t>(Priority::Interactive)].in_flight;
+    return shared < config_.slots - config_.interactive_reserve;
+}
+
+UpstreamScheduler::Slot UpstreamScheduler::take(size_t cls, Clock::time_point queued) {
+    Class& c = classes_[cls];
+    ++in_flight_;
+    ++c.in_flight;
+    ++c.dispatched;
+    record_wait(c, static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        Clock::now() - queued).count()));
+    return Slot(static_cast<void*>(this), [cls](void* self) {
+        static_cast<UpstreamScheduler*>(self)->release(cls);
+    });
+}
+
+bool UpstreamScheduler::next_waiter(size_t cls, Waiter& out) {
+    Class& c = classes_[cls];
+    auto best = c.flows.end();
+    for (auto it = c.flows.begin(); it != c.flows.end(); ++it) {
+        if (best == c.flows.end() || it->second.waiters.front().finish < best->second.waiters.front().finish)
+            best = it;
+    }
+    if (best == c.flows.end()) return false;
+
+    out = std::move(best->second.waiters.front());
+    best->second.waiters.pop_front();
+    if (best->second.waiters.empty()) c.flows.erase(best);
+    --c.waiting;
+    c.virtual_time = std::max(c.virtual_time, out.finish);
+    return true;
+}
+
+void UpstreamScheduler::record_wait(Class& c, long ms) {
+    if (c.waits_ms.size() < WAIT_SAMPLES) {
+        c.waits_ms.push_back(ms);
+    } else {
+        c.waits_ms[c.wait_next] = ms;
+        c.wait_next = (c.wait_next + 1) % WAIT_SAMPLES;
+    }
+}
+
+void UpstreamScheduler::release(size_t cls) {
+    std::vector<std::pair<Grant, Slot>> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        --in_flight_;
+        --classes_[cls].in_flight;
+
+        Waiter waiter;
+        for (size_t next = 0; next < CLASS_COUNT; ++next) {
+            while (has_capacity(next) && next_waiter(next, waiter)) {
+                if (waiter.is_cancelled && waiter.is_cancelled()) {
+                    ++classes_[next].cancelled;
+                    ready.emplace_back(std::move(waiter.grant), nullptr);
+                    continue;
+                }
+                ++classes_[next].queued;
+                ready.emplace_back(std::move(waiter.grant), take(next, waiter.queued));
+            }
+        }
+    }
+    for (auto& [grant, slot] : ready) grant(std::move(slot));
+}
+
+std::string UpstreamScheduler::stats_json() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    json::JsonBuilder j(768);
+    j.begin_object();
+    j.kv_int("slots", static_cast<int64_t>(config_.slots));
+    j.kv_int("interactiveReserve", static_cast<int64_t>(config_.interactive_reserve));
+    j.kv_int("inFlight", static_cast<int64_t>(in_flight_));
+    for (size_t i = 0; i < CLASS_COUNT; ++i) {
+        const Class& c = classes_[i];
+        json::JsonBuilder k(256);
+        k.begin_object();
+        k.kv_int("waiting", static_cast<int64_t>(c.waiting));
+        k.kv_int("flows", static_cast<int64_t>(c.flows.size()));
+        k.kv_int("inFlight", static_cast<int64_t>(c.in_flight));
+        k.kv_int("dispatched", static_cast<int64_t>(c.dispatched));
+        k.kv_int("queued", static_cast<int64_t>(c.queued));
+        k.kv_int("cancelled", static_cast<int64_t>(c.cancelled));
+        // Over the last WAIT_SAMPLES dispatches, immediate ones included
+        k.kv_int("waitP50Ms", percentile(c.waits_ms, 50));
+        k.kv_int("waitP99Ms", percentile(c.waits_ms, 99));
+        k.kv_int("waitMaxMs", c.waits_ms.empty() ? 0 : *std::max_element(c.waits_ms.begin(), c.waits_ms.end()));
+        k.end_object();
+        j.key(CLASS_NAMES[i]);
+        j.value_raw(k.str());
+    }
+    j.end_object();
+    return j.str();
+}
+
+}
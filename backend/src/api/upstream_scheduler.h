@@ -0,0 +1,101 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace rpg {
+
+// Most urgent first
+enum class Priority { Interactive = 0, Editor = 1, Background = 2 };
+
+// Who an upstream call is for. Calls with the same flow (campaign and
+// session) share that flow's part of their class's capacity.
+struct UpstreamTag {
+    Priority priority = Priority::Interactive;
+    std::string flow;
+    double weight = 1;  // relative share against other flows in the class
+};
+
+// Bounds concurrent upstream calls (Claude and Gemini together) and decides
+// who goes next when they are all taken: any waiting interactive call before
+// any editor call before any background call, and within a class, weighted
+// fair queuing across flows, so one session bulk-generating a world gets its
+// share and no more. Some slots are kept for interactive calls alone, so
+// a turn never waits behind a full set of slow generations.
+class UpstreamScheduler {
+public:
+    struct Config {
+        size_t slots = 8;
+        size_t interactive_reserve = 2;
+    };
+
+    // Holds one slot until the last copy is destroyed; empty when the call
+    // was cancelled while it waited
+    using Slot = std::shared_ptr<void>;
+    using Grant = std::function<void(Slot)>;
+
+    // Configured from RPG_UPSTREAM_SLOTS and RPG_UPSTREAM_RESERVE
+    static UpstreamScheduler& instance();
+
+    explicit UpstreamScheduler(Config config);
+
+    // Runs grant at once when a slot is free, otherwise when one frees up
+    // (on the thread releasing it). grant must not block.
+    void submit(const UpstreamTag& tag, std::function<bool()> is_cancelled, Grant grant);
+
+    // Per-class queue depth, in-flight calls and queue-wait percentiles, as a JSON object
+    std::string stats_json() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+    static constexpr size_t CLASS_COUNT = 3;
+    static constexpr size_t WAIT_SAMPLES = 512;
+
+    struct Waiter {
+        double finish;  // virtual finish time
+        Clock::time_point queued;
+        std::function<bool()> is_cancelled;
+        Grant grant;
+    };
+
+    struct Flow {
+        std::deque<Waiter> waiters;
+        double last_finish = 0;
+    };
+
+    struct Class {
+        std::map<std::string, Flow> flows;  // only flows with waiters
+        double virtual_time = 0;
+        size_t waiting = 0;
+        size_t in_flight = 0;
+
+        size_t dispatched = 0;
+        size_t queued = 0;     // dispatched after waiting
+        size_t cancelled = 0;  // gave up while waiting
+        std::vector<long> waits_ms;  // ring of recent queue waits
+        size_t wait_next = 0;
+    };
+
+    // All mutex_ held
+    bool has_capacity(size_t cls) const;
+    Slot take(size_t cls, Clock::time_point queued);
+    // Pops the waiter with the earliest finish time, or returns false
+    bool next_waiter(size_t cls, Waiter& out);
+    void record_wait(Class& c, long ms);
+
+    void release(size_t cls);
+
+    Config config_;
+
+    mutable std::mutex mutex_;
+    std::array<Class, CLASS_COUNT> classes_;
+    size_t in_flight_ = 0;
+};
+
+}
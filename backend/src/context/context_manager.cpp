@@ -1,60 +1,230 @@
 #include "context_manager.h"
 #include "../util/file_utils.h"
 #include "../util/json.h"
+#include "../util/tokens.h"
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/file.h>
 #include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
 #include <ctime>
 #include <fstream>
 
 namespace rpg {
 
-void ContextManager::create_dirs(const std::string& path) {
-    std::string tmp = path;
-    for (size_t i = 1; i < tmp.size(); ++i) {
-        if (tmp[i] == '/') {
-            tmp[i] = '\0';
-            mkdir(tmp.c_str(), 0755);
-            tmp[i] = '/';
-        }
-    }
-    mkdir(tmp.c_str(), 0755);
+std::string CampaignSnapshot::image_path(const std::string& category, const std::string& id) const {
+    auto it = images.find(category + "/" + id);
+    return it != images.end() ? it->second : "";
 }
 
 ContextManager::ContextManager(const std::string& campaign_dir)
     : campaign_dir_(campaign_dir) {
-    create_dirs(campaign_dir_);
+    file::make_dirs(campaign_dir_);
+    // Close-on-exec: a successor inheriting the descriptor would share its lock
+    lock_fd_ = open(lock_path().c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    disk_writes_ = read_disk_writes();
+    reload();
 }
 
-std::string ContextManager::build_full_context() const {
-    std::string ctx;
-    ctx.reserve(32768);
+ContextManager::~ContextManager() {
+    if (lock_fd_ >= 0) close(lock_fd_);
+}
 
-    ctx += "=== PLOT STATE (SECRET) ===\n";
-    ctx += file::read_file(plot_path());
+bool ContextManager::lock_files(int operation) {
+    if (lock_fd_ < 0) return false;
+    while (flock(lock_fd_, operation) != 0) {
+        if (errno != EINTR) return false;
+    }
+    return true;
+}
+
+uint64_t ContextManager::read_disk_writes() const {
+    char buf[32] = {};
+    ssize_t n = lock_fd_ >= 0 ? pread(lock_fd_, buf, sizeof(buf) - 1, 0) : -1;
+    return n > 0 ? std::strtoull(buf, nullptr, 10) : 0;
+}
+
+void ContextManager::begin_write() {
+    if (!lock_files(LOCK_EX)) return;
+    uint64_t writes = read_disk_writes();
+    if (writes != disk_writes_) {
+        reload();
+        disk_writes_ = writes;
+    }
+}
+
+void ContextManager::end_write() {
+    if (lock_fd_ < 0) return;
+    // The count only grows, so the new text always covers the old
+    std::string count = std::to_string(++disk_writes_);
+    if (pwrite(lock_fd_, count.data(), count.size(), 0) != static_cast<ssize_t>(count.size())) {
+        fprintf(stderr, "Failed to record a write in %s\n", lock_path().c_str());
+    }
+    flock(lock_fd_, LOCK_UN);
+}
 
-    ctx += "\n\n=== CHARACTERS ===\n";
-    ctx += file::read_file(characters_path());
+void ContextManager::refresh() {
+    if (read_disk_writes() == disk_writes_) return;
+    if (!lock_files(LOCK_SH)) return;
+    uint64_t writes = read_disk_writes();
+    if (writes != disk_writes_) {
+        reload();
+        disk_writes_ = writes;
+    }
+    flock(lock_fd_, LOCK_UN);
+}
+
+void ContextManager::publish(const std::function<void(CampaignSnapshot&)>& edit) {
+    auto current = snapshot_.load();
+    auto next = current ? std::make_shared<CampaignSnapshot>(*current)
+                        : std::make_shared<CampaignSnapshot>();
+    edit(*next);
+    next->version = current ? current->version + 1 : 1;
+    snapshot_.store(std::move(next));
+}
+
+void ContextManager::reload() {
+    publish([this](CampaignSnapshot& s) {
+        s.plot = file::read_file(plot_path());
+        s.context = file::read_file(context_path());
+        s.player = file::read_file(player_path());
+        s.characters_md = file::read_file(characters_path());
+        s.locations_md = file::read_file(locations_path());
+        s.characters = md_parser_.parse_characters(s.characters_md);
+        s.locations = md_parser_.parse_locations(s.locations_md);
+
+        // Parsed once here; append_history keeps it current afterwards
+        std::string history = file::read_file(history_path());
+        auto entries = json::split_array(history);
+        s.recent_turns.clear();
+        s.history_length = entries.size();
+        size_t first = entries.size() > MAX_RECENT_TURNS ? entries.size() - MAX_RECENT_TURNS : 0;
+        for (size_t i = first; i < entries.size(); ++i) {
+            s.recent_turns.push_back(make_turn(i,
+                json::unescape(json::extract_string(entries[i], "player")),
+                json::unescape(json::extract_string(entries[i], "gm"))));
+        }
+        window_start_ = 0;
+
+        // Index images/<category>/<id>.<ext>, resolving duplicates like get_image_path did
+        s.images.clear();
+        DIR* root = opendir(images_dir().c_str());
+        if (!root) return;
+        struct dirent* category;
+        while ((category = readdir(root)) != nullptr) {
+            std::string cat = category->d_name;
+            if (cat == "." || cat == "..") continue;
+            DIR* dir = opendir((images_dir() + "/" + cat).c_str());
+            if (!dir) continue;
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                std::string name = entry->d_name;
+                size_t dot = name.rfind('.');
+                if (dot == std::string::npos || dot == 0) continue;
+                std::string id = name.substr(0, dot);
+                std::string key = cat + "/" + id;
+                if (s.images.count(key)) continue;
+                std::string path = find_image_on_disk(cat, id);
+                if (!path.empty()) s.images.emplace(std::move(key), std::move(path));
+            }
+            closedir(dir);
+        }
+        closedir(root);
+    });
+}
 
-    ctx += "\n\n=== LOCATIONS ===\n";
-    ctx += file::read_file(locations_path());
+namespace {
+    constexpr std::string_view TRIM_MARKER = "[... older entries omitted to fit the context budget ...]\n";
+
+    // Shortens text to its last whole lines within max_tokens; returns their estimate
+    size_t keep_tail(std::string_view& text, size_t max_tokens) {
+        size_t kept = 0;
+        size_t cut = text.size();  // text[cut..] is kept; cut is 0 or just past a '\n'
+        while (cut > 0) {
+            size_t line_start = cut >= 2 ? text.rfind('\n', cut - 2) : std::string_view::npos;
+            line_start = line_start == std::string_view::npos ? 0 : line_start + 1;
+            size_t cost = tokens::estimate(text.substr(line_start, cut - line_start));
+            if (kept + cost > max_tokens) break;
+            kept += cost;
+            cut = line_start;
+        }
+        text.remove_prefix(cut);
+        return kept;
+    }
+}
+
+ContextManager::ContextLayers ContextManager::build_context_layers(size_t max_tokens) const {
+    auto snap = snapshot();
+    ContextLayers layers;
+
+    enum { CHARACTERS, LOCATIONS, PLOT, WORLD, PLAYER, SECTION_COUNT };
+    std::string_view texts[SECTION_COUNT] = {
+        snap->characters_md, snap->locations_md, snap->plot, snap->context, snap->player};
+    static constexpr const char* NAMES[SECTION_COUNT] = {
+        "characters", "locations", "plot", "world", "player"};
+    // World knowledge is the bulkiest and overlaps the replayed history; the
+    // plot is what the narrator can least do without
+    static constexpr int TRIM_ORDER[SECTION_COUNT] = {WORLD, LOCATIONS, CHARACTERS, PLAYER, PLOT};
+
+    size_t total = 0;
+    for (int i = 0; i < SECTION_COUNT; ++i) {
+        layers.sections.push_back({NAMES[i], tokens::estimate(texts[i]), 0});
+        total += layers.sections[i].tokens;
+    }
+
+    if (max_tokens > 0 && total > max_tokens) {
+        size_t over = total - max_tokens;
+        for (int i : TRIM_ORDER) {
+            if (over == 0) break;
+            auto& section = layers.sections[i];
+            size_t target = section.tokens - std::min(over, section.tokens);
+            size_t kept = keep_tail(texts[i], target);
+            section.trimmed = section.tokens > kept ? section.tokens - kept : 0;
+            over -= std::min(over, section.trimmed);
+        }
+    }
+
+    auto append = [&](std::string& out, int i) {
+        if (layers.sections[i].trimmed > 0) out += TRIM_MARKER;
+        out += texts[i];
+    };
+
+    // Entities only change when a character or location is edited or a turn adds one
+    layers.entities.reserve(texts[CHARACTERS].size() + texts[LOCATIONS].size() + 256);
+    layers.entities += "=== CHARACTERS ===\n";
+    append(layers.entities, CHARACTERS);
+    layers.entities += "\n\n=== LOCATIONS ===\n";
+    append(layers.entities, LOCATIONS);
+
+    std::string& ctx = layers.state;
+    ctx.reserve(texts[PLOT].size() + texts[WORLD].size() + texts[PLAYER].size() + 512);
+
+    ctx += "=== PLOT STATE (SECRET) ===\n";
+    append(ctx, PLOT);
 
     ctx += "\n\n=== WORLD & NPC KNOWLEDGE ===\n";
-    ctx += file::read_file(context_path());
+    append(ctx, WORLD);
 
     ctx += "\n\n=== PLAYER STATE (VISIBLE TO PLAYER) ===\n";
-    ctx += file::read_file(player_path());
+    append(ctx, PLAYER);
 
     // Note if player has an image
-    if (image_exists("player", "avatar")) {
+    if (!snap->image_path("player", "avatar").empty()) {
         ctx += "\n[Note: The player character has a visual appearance as described in their profile. ";
         ctx += "NPCs should react appropriately to their appearance.]\n";
     }
 
-    return ctx;
+    return layers;
 }
 
 std::string ContextManager::get_player_state() const {
-    return file::read_file(player_path());
+    return snapshot()->player;
 }
 
 std::string ContextManager::get_system_prompt() const {
@@ -62,20 +232,355 @@ std::string ContextManager::get_system_prompt() const {
 }
 
 void ContextManager::apply_updates(const std::vector<ContextUpdate>& updates) {
-    for (const auto& update : updates) {
-        std::string path;
-        if (update.filename == "plot.md") path = plot_path();
-        else if (update.filename == "context.md") path = context_path();
-        else if (update.filename == "player.md") path = player_path();
-        else if (update.filename == "characters.md") path = characters_path();
-        else if (update.filename == "locations.md") path = locations_path();
-        else continue;
+    if (updates.empty()) return;
+    publish([&](CampaignSnapshot& s) {
+        for (const auto& update : updates) {
+            std::string path;
+            std::string* current = nullptr;
+            if (update.filename == "plot.md") { path = plot_path(); current = &s.plot; }
+            else if (update.filename == "context.md") { path = context_path(); current = &s.context; }
+            else if (update.filename == "player.md") { path = player_path(); current = &s.player; }
+            else if (update.filename == "characters.md") { path = characters_path(); current = &s.characters_md; }
+            else if (update.filename == "locations.md") { path = locations_path(); current = &s.locations_md; }
+            else continue;
+
+            // For now, append the update content
+            *current += "\n" + update.content;
+            file::write_file(path, *current);
+
+            if (current == &s.characters_md) s.characters = md_parser_.parse_characters(s.characters_md);
+            if (current == &s.locations_md) s.locations = md_parser_.parse_locations(s.locations_md);
+        }
+    });
+}
 
-        // For now, append the update content
-        std::string current = file::read_file(path);
-        current += "\n" + update.content;
-        file::write_file(path, current);
+namespace {
+    // Body of a "# header" section, up to the next top-level heading
+    struct Span {
+        size_t begin;
+        size_t end;
+    };
+
+    // Appends an empty section when the file has none
+    Span section(std::string& md, std::string_view header) {
+        std::string heading = "# " + std::string(header) + "\n";
+        size_t at = md.find(heading);
+        while (at != std::string::npos && at > 0 && md[at - 1] != '\n') at = md.find(heading, at + 1);
+        if (at == std::string::npos) {
+            if (!md.empty() && md.back() != '\n') md += '\n';
+            md += "\n" + heading;
+            return {md.size(), md.size()};
+        }
+        size_t begin = at + heading.size();
+        size_t next = md.find("\n# ", begin - 1);
+        return {begin, next == std::string::npos ? md.size() : next + 1};
     }
+
+    // A list line's name, without the bullet and any "[x] " checkbox
+    std::string_view entry_name(std::string_view line) {
+        if (line.substr(0, 2) != "- ") return {};
+        line.remove_prefix(2);
+        if (!line.empty() && line.front() == '[') {
+            size_t close = line.find("] ");
+            if (close != std::string_view::npos) line.remove_prefix(close + 2);
+        }
+        while (!line.empty() && (line.back() == ' ' || line.back() == '\r')) line.remove_suffix(1);
+        return line;
+    }
+
+    // Case-insensitive; with prefix, "rope" also names "Rope (50 ft)"
+    bool names_match(std::string_view entry, std::string_view name, bool prefix) {
+        if (name.empty() || entry.size() < name.size()) return false;
+        if (!prefix && entry.size() != name.size()) return false;
+        for (size_t i = 0; i < name.size(); ++i) {
+            if (std::tolower(static_cast<unsigned char>(entry[i])) !=
+                std::tolower(static_cast<unsigned char>(name[i]))) return false;
+        }
+        return entry.size() == name.size() || !std::isalnum(static_cast<unsigned char>(entry[name.size()]));
+    }
+
+    // The line naming name, newline included; begin is npos when there is none
+    Span find_entry(const std::string& md, Span s, std::string_view name, bool prefix) {
+        for (size_t pos = s.begin; pos < s.end;) {
+            size_t eol = std::min(md.find('\n', pos), s.end);
+            size_t next = eol < s.end ? eol + 1 : s.end;
+            if (names_match(entry_name(std::string_view(md).substr(pos, eol - pos)), name, prefix))
+                return {pos, next};
+            pos = next;
+        }
+        return {std::string::npos, std::string::npos};
+    }
+
+    // Adds line after the section's last entry, dropping a "(None yet)"
+    // style placeholder first
+    void insert_entry(std::string& md, Span s, const std::string& line) {
+        for (size_t pos = s.begin; pos < s.end;) {
+            size_t eol = std::min(md.find('\n', pos), s.end);
+            size_t next = eol < s.end ? eol + 1 : s.end;
+            std::string_view text = std::string_view(md).substr(pos, eol - pos);
+            if (text.size() > 1 && text.front() == '(' && text.back() == ')') {
+                md.erase(pos, next - pos);
+                s.end -= next - pos;
+                continue;
+            }
+            pos = next;
+        }
+        size_t at = s.end;
+        while (at > s.begin && md[at - 1] == '\n') --at;
+        if (at > s.begin) md.insert(at, "\n" + line);
+        else md.insert(s.begin, line + "\n");
+    }
+
+    // List entries are one line each
+    std::string single_line(std::string text) {
+        std::replace(text.begin(), text.end(), '\n', ' ');
+        std::replace(text.begin(), text.end(), '\r', ' ');
+        return text;
+    }
+
+    bool add_entry(std::string& md, std::string_view header, const std::string& name) {
+        Span s = section(md, header);
+        if (find_entry(md, s, name, false).begin != std::string::npos) return false;
+        insert_entry(md, s, "- " + name);
+        return true;
+    }
+
+    bool remove_entry(std::string& md, std::string_view header, const std::string& name) {
+        Span s = section(md, header);
+        Span line = find_entry(md, s, name, false);
+        if (line.begin == std::string::npos) line = find_entry(md, s, name, true);
+        if (line.begin == std::string::npos) return false;
+        md.erase(line.begin, line.end - line.begin);
+        return true;
+    }
+
+    bool set_quest(std::string& md, const std::string& quest, const std::string& status) {
+        const char* box = "[ ]";
+        if (status == "completed") box = "[x]";
+        else if (status == "failed") box = "[failed]";
+        std::string line = "- " + std::string(box) + " " + quest;
+
+        Span s = section(md, "Quest Log");
+        Span found = find_entry(md, s, quest, false);
+        if (found.begin == std::string::npos) {
+            insert_entry(md, s, line);
+            return true;
+        }
+        size_t length = found.end - found.begin;
+        if (md[found.end - 1] == '\n') --length;
+        if (md.compare(found.begin, length, line) == 0) return false;
+        md.replace(found.begin, length, line);
+        return true;
+    }
+
+    // "first_encountered", "First Encountered" and "first-encountered" alike;
+    // to_id drops underscores, so they become spaces first
+    std::string field_id(std::string field) {
+        std::replace(field.begin(), field.end(), '_', ' ');
+        return MarkdownParser::to_id(field);
+    }
+
+    // Nullptr for a field the character format does not have
+    std::string* character_field(Character& c, const std::string& field) {
+        std::string id = field_id(field);
+        if (id == "role") return &c.role;
+        if (id == "first_encountered") return &c.first_encountered;
+        if (id == "appearance") return &c.appearance;
+        if (id == "background") return &c.background;
+        if (id == "motivations") return &c.motivations;
+        if (id == "personality") return &c.personality;
+        if (id == "knows") return &c.knows;
+        if (id == "doesnt_know") return &c.doesnt_know;
+        return nullptr;
+    }
+
+    bool set_character_field(std::vector<Character>& characters, const StateOp& op) {
+        std::string id = MarkdownParser::to_id(op.target);
+        if (id.empty()) return false;
+        auto it = std::find_if(characters.begin(), characters.end(),
+                               [&](const Character& c) { return c.id == id; });
+        Character added;
+        Character& c = it != characters.end() ? *it : added;
+        std::string* field = character_field(c, op.field);
+        if (!field) return false;
+
+        // Basic info and knowledge are written as "- **Field**: value" lines
+        bool one_line = field == &c.role || field == &c.first_encountered ||
+                        field == &c.knows || field == &c.doesnt_know;
+        std::string value = one_line ? single_line(op.value) : op.value;
+        if (*field == value) return false;
+        *field = std::move(value);
+        if (it == characters.end()) {
+            added.name = op.target;
+            added.id = id;
+            characters.push_back(std::move(added));
+        }
+        return true;
+    }
+
+    // Where a character field lives in characters.md: a "### section" and,
+    // for one-line fields, the "- **label**:" line within it
+    struct FieldPlace {
+        const char* section;
+        const char* label;  // nullptr: the field is the section's whole body
+    };
+
+    FieldPlace character_field_place(const std::string& field) {
+        std::string id = field_id(field);
+        if (id == "role") return {"Basic Info", "Role"};
+        if (id == "first_encountered") return {"Basic Info", "First Encountered"};
+        if (id == "knows") return {"Knowledge", "Knows"};
+        if (id == "doesnt_know") return {"Knowledge", "Doesn't know"};
+        if (id == "appearance") return {"Appearance", nullptr};
+        if (id == "background") return {"Background", nullptr};
+        if (id == "motivations") return {"Motivations", nullptr};
+        return {"Personality", nullptr};
+    }
+
+    size_t line_end(const std::string& md, size_t pos, size_t end) {
+        size_t eol = md.find('\n', pos);
+        return eol < end ? eol + 1 : end;
+    }
+
+    // The "## Name" block of the character with this id, up to the next
+    // character or top-level heading; begin is npos when there is none
+    Span character_block(const std::string& md, const std::string& id) {
+        for (size_t pos = 0; pos < md.size(); pos = line_end(md, pos, md.size())) {
+            if (md.compare(pos, 3, "## ") != 0) continue;
+            size_t eol = std::min(md.find('\n', pos), md.size());
+            if (MarkdownParser::to_id(md.substr(pos + 3, eol - pos - 3)) != id) continue;
+            size_t end = line_end(md, pos, md.size());
+            while (end < md.size() && md.compare(end, 3, "## ") != 0 && md.compare(end, 2, "# ") != 0) {
+                end = line_end(md, end, md.size());
+            }
+            return {pos, end};
+        }
+        return {std::string::npos, std::string::npos};
+    }
+
+    // Body of the block's "### header" subsection, up to the next heading or
+    // "---" separator; begin is npos when there is none
+    Span subsection(const std::string& md, Span block, std::string_view header) {
+        std::string heading = "### " + std::string(header);
+        for (size_t pos = block.begin; pos < block.end; pos = line_end(md, pos, block.end)) {
+            size_t eol = std::min(md.find('\n', pos), block.end);
+            std::string_view line = std::string_view(md).substr(pos, eol - pos);
+            while (!line.empty() && (line.back() == ' ' || line.back() == '\r')) line.remove_suffix(1);
+            if (line != heading) continue;
+
+            size_t begin = line_end(md, pos, block.end);
+            size_t end = begin;
+            while (end < block.end && md[end] != '#' && md.compare(end, 3, "---") != 0) {
+                end = line_end(md, end, block.end);
+            }
+            return {begin, end};
+        }
+        return {std::string::npos, std::string::npos};
+    }
+
+    // Rewrites one field of a character in characters.md, leaving every other
+    // line (and anything the serializer would not reproduce) as it is
+    void patch_character_field(std::string& md, const std::string& name, const std::string& field,
+                               const std::string& value) {
+        Span block = character_block(md, MarkdownParser::to_id(name));
+        if (block.begin == std::string::npos) {
+            if (!md.empty() && md.back() != '\n') md += '\n';
+            block.begin = md.size();
+            md += "## " + name + "\n### Basic Info\n\n---\n\n";
+            block.end = md.size();
+        }
+
+        FieldPlace place = character_field_place(field);
+        std::string line = place.label ? "- **" + std::string(place.label) + "**: " + value + "\n"
+                                       : value + "\n\n";
+        Span body = subsection(md, block, place.section);
+        if (body.begin == std::string::npos) {
+            // Basic Info goes first, under the name; the rest before the separator
+            size_t at = line_end(md, block.begin, block.end);
+            if (std::string_view(place.section) != "Basic Info") {
+                at = block.end;
+                for (size_t pos = block.begin; pos < block.end; pos = line_end(md, pos, block.end)) {
+                    if (md.compare(pos, 3, "---") == 0) {
+                        at = pos;
+                        break;
+                    }
+                }
+            }
+            std::string text = "### " + std::string(place.section) + "\n" + line;
+            if (place.label) text += "\n";
+            md.insert(at, text);
+            return;
+        }
+
+        if (!place.label) {
+            md.replace(body.begin, body.end - body.begin, line);
+            return;
+        }
+
+        std::string prefix = "- **" + std::string(place.label) + "**:";
+        size_t last = body.begin;  // end of the last non-blank line
+        for (size_t pos = body.begin; pos < body.end; pos = line_end(md, pos, body.end)) {
+            size_t next = line_end(md, pos, body.end);
+            if (md.compare(pos, prefix.size(), prefix) == 0) {
+                md.replace(pos, next - pos, line);
+                return;
+            }
+            if (md[pos] != '\n') last = next;
+        }
+        md.insert(last, line);
+    }
+}
+
+size_t ContextManager::apply_state_ops(const std::vector<StateOp>& ops) {
+    if (ops.empty()) return 0;
+    size_t applied = 0;
+    publish([&](CampaignSnapshot& s) {
+        bool player = false, plot = false, characters = false;
+        for (const auto& op : ops) {
+            bool changed = false;
+            switch (op.kind) {
+                case StateOp::Kind::AddItem:
+                    changed = add_entry(s.player, "Inventory", single_line(op.target));
+                    player |= changed;
+                    break;
+                case StateOp::Kind::RemoveItem:
+                    changed = remove_entry(s.player, "Inventory", single_line(op.target));
+                    player |= changed;
+                    break;
+                case StateOp::Kind::SetQuest:
+                    changed = set_quest(s.player, single_line(op.target), op.value);
+                    player |= changed;
+                    break;
+                case StateOp::Kind::AddNote:
+                    changed = add_entry(s.player, "Notes", single_line(op.value));
+                    player |= changed;
+                    break;
+                case StateOp::Kind::AddPlotSeed:
+                    changed = add_entry(s.plot, "Planted Seeds", single_line(op.value));
+                    plot |= changed;
+                    break;
+                case StateOp::Kind::SetCharacterField:
+                    changed = set_character_field(s.characters, op);
+                    if (changed) {
+                        std::string value = character_field_place(op.field).label ? single_line(op.value)
+                                                                                  : op.value;
+                        patch_character_field(s.characters_md, op.target, op.field, value);
+                    }
+                    characters |= changed;
+                    break;
+            }
+            if (changed) ++applied;
+        }
+
+        if (player) file::write_file(player_path(), s.player);
+        if (plot) file::write_file(plot_path(), s.plot);
+        if (characters) {
+            // Patched in place; the parsed list follows the file
+            s.characters = md_parser_.parse_characters(s.characters_md);
+            file::write_file(characters_path(), s.characters_md);
+        }
+    });
+    return applied;
 }
 
 std::string ContextManager::get_metadata() const {
@@ -113,9 +618,9 @@ void ContextManager::init_new_campaign(const std::string& roleplay_name,
                                         const std::string& player_name,
                                         const std::string& player_role) {
     // Create images directories
-    create_dirs(images_dir() + "/characters");
-    create_dirs(images_dir() + "/locations");
-    create_dirs(images_dir() + "/player");
+    file::make_dirs(images_dir() + "/characters");
+    file::make_dirs(images_dir() + "/locations");
+    file::make_dirs(images_dir() + "/player");
 
     // Initialize plot.md
     std::string plot = R"(# Current Arc
@@ -207,6 +712,8 @@ The story begins...
     meta.kv_string("lastPlayed", timestamp);
     meta.end_object();
     file::write_file(metadata_path(), meta.str());
+
+    reload();
 }
 
 void ContextManager::append_history(const std::string& player_input,
@@ -229,30 +736,90 @@ void ContextManager::append_history(const std::string& player_input,
     }
 
     file::write_file(history_path(), history);
+
+    publish([&](CampaignSnapshot& s) {
+        remember_turn(s, make_turn(s.history_length, player_input, gm_response));
+    });
 }
 
 std::string ContextManager::get_history() const {
     return file::read_file(history_path());
 }
 
+HistoryTurn ContextManager::make_turn(uint64_t index, std::string player, std::string narrator) {
+    HistoryTurn turn;
+    turn.index = index;
+    // Plus the "Player says:" prefix, narrative tags and per-message framing
+    turn.tokens = tokens::estimate(player) + tokens::estimate(narrator) + 16;
+    turn.player = std::move(player);
+    turn.narrator = std::move(narrator);
+    return turn;
+}
+
+void ContextManager::remember_turn(CampaignSnapshot& s, HistoryTurn turn) {
+    s.recent_turns.push_back(std::move(turn));
+    if (s.recent_turns.size() > MAX_RECENT_TURNS) s.recent_turns.erase(s.recent_turns.begin());
+    ++s.history_length;
+}
+
+std::vector<HistoryTurn> ContextManager::history_window(size_t token_budget) const {
+    auto snap = snapshot();
+    const auto& turns = snap->recent_turns;
+    if (turns.empty() || token_budget == 0) return {};
+
+    uint64_t start = std::max<uint64_t>(window_start_.load(), turns.front().index);
+    size_t total = 0;
+    for (const auto& turn : turns) {
+        if (turn.index >= start) total += turn.tokens;
+    }
+
+    // Over budget: drop the oldest turns down to three quarters of it, so the
+    // next few turns append to the same prefix instead of shifting it again
+    if (total > token_budget) {
+        size_t target = token_budget - token_budget / 4;
+        for (const auto& turn : turns) {
+            if (turn.index < start) continue;
+            if (total <= target) break;
+            total -= turn.tokens;
+            start = turn.index + 1;
+        }
+        window_start_ = start;
+    }
+
+    std::vector<HistoryTurn> window;
+    for (const auto& turn : turns) {
+        if (turn.index >= start) window.push_back(turn);
+    }
+    return window;
+}
+
 std::string ContextManager::get_characters() const {
-    return file::read_file(characters_path());
+    return snapshot()->characters_md;
 }
 
 void ContextManager::save_characters(const std::string& content) {
     file::write_file(characters_path(), content);
+    publish([&](CampaignSnapshot& s) {
+        s.characters_md = content;
+        s.characters = md_parser_.parse_characters(content);
+    });
 }
 
 std::string ContextManager::get_locations() const {
-    return file::read_file(locations_path());
+    return snapshot()->locations_md;
 }
 
 void ContextManager::save_locations(const std::string& content) {
     file::write_file(locations_path(), content);
+    publish([&](CampaignSnapshot& s) {
+        s.locations_md = content;
+        s.locations = md_parser_.parse_locations(content);
+    });
 }
 
 void ContextManager::save_player_state(const std::string& content) {
     file::write_file(player_path(), content);
+    publish([&](CampaignSnapshot& s) { s.player = content; });
 }
 
 bool ContextManager::save_image(const std::string& category, const std::string& id,
@@ -267,7 +834,7 @@ bool ContextManager::save_image(const std::string& category, const std::string&
     }
 
     std::string dir = images_dir() + "/" + category;
-    create_dirs(dir);
+    file::make_dirs(dir);
     std::string path = dir + "/" + id + ext;
 
     // Decode base64 and write binary file
@@ -291,13 +858,27 @@ bool ContextManager::save_image(const std::string& category, const std::string&
         }
     }
 
-    std::ofstream out(path, std::ios::binary);
-    if (!out) return false;
-    out.write(decoded.data(), static_cast<std::streamsize>(decoded.size()));
-    return out.good();
+    // Written aside and renamed so readers never serve a truncated image
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream out(tmp, std::ios::binary);
+        if (!out) return false;
+        out.write(decoded.data(), static_cast<std::streamsize>(decoded.size()));
+        if (!out.good()) return false;
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) return false;
+
+    publish([&](CampaignSnapshot& s) {
+        s.images[category + "/" + id] = find_image_on_disk(category, id);
+    });
+    return true;
 }
 
 std::string ContextManager::get_image_path(const std::string& category, const std::string& id) const {
+    return snapshot()->image_path(category, id);
+}
+
+std::string ContextManager::find_image_on_disk(const std::string& category, const std::string& id) const {
     // Check for different extensions
     std::vector<std::string> exts = {".png", ".jpg", ".webp"};
     for (const auto& ext : exts) {
@@ -1,6 +1,12 @@
 #pragma once
+#include "../parser/markdown_parser.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <string>
 #include <string_view>
+#include <unordered_map>
 #include <vector>
 
 namespace rpg {
@@ -10,15 +16,77 @@ struct ContextUpdate {
     std::string content;
 };
 
+// One fine-grained change from the narrator's update_state tool. Applied in
+// place, so the files hold the current state instead of every turn's notes.
+struct StateOp {
+    enum class Kind { AddItem, RemoveItem, SetQuest, SetCharacterField, AddPlotSeed, AddNote };
+    Kind kind = Kind::AddNote;
+    std::string target;  // item, quest or character name
+    std::string field;   // character field: role, appearance, knows, ...
+    std::string value;   // quest status, field value, seed or note
+};
+
+// One exchange from history.json, with its estimated prompt cost
+struct HistoryTurn {
+    uint64_t index = 0;  // position in the full history
+    std::string player;
+    std::string narrator;
+    size_t tokens = 0;
+};
+
+// Campaign state as of one committed write. Snapshots are immutable once
+// published, so a reader holding one never sees a half-applied change.
+struct CampaignSnapshot {
+    uint64_t version = 0;
+    std::string plot;
+    std::string context;
+    std::string player;
+    std::string characters_md;
+    std::string locations_md;
+    std::vector<Character> characters;
+    std::vector<Location> locations;
+    std::unordered_map<std::string, std::string> images;  // "category/id" -> file path
+    std::vector<HistoryTurn> recent_turns;  // newest last, at most MAX_RECENT_TURNS
+    uint64_t history_length = 0;            // turns in history.json
+
+    std::string image_path(const std::string& category, const std::string& id) const;
+};
+
 class ContextManager {
 public:
     ContextManager(const std::string& campaign_dir = "campaigns/active");
+    ~ContextManager();
+
+    // Current state; lock-free and safe to hold across later writes
+    std::shared_ptr<const CampaignSnapshot> snapshot() const { return snapshot_.load(); }
+
+    // Estimated size of one campaign file in the prompt
+    struct SectionSize {
+        const char* name;  // characters, locations, plot, world, player
+        size_t tokens = 0;
+        size_t trimmed = 0;  // tokens left out to meet the budget
+    };
+
+    // Campaign context split by how often it changes, so the stable part can
+    // sit in a cached prompt prefix
+    struct ContextLayers {
+        std::string entities;  // characters and locations
+        std::string state;     // plot, world knowledge and player state
+        std::vector<SectionSize> sections;
+    };
 
-    std::string build_full_context() const;
+    // With max_tokens set, sections are cut from the top (updates append,
+    // so the oldest text goes first) in order world, locations, characters,
+    // player, plot until the estimate fits. 0 sends everything.
+    ContextLayers build_context_layers(size_t max_tokens = 0) const;
     std::string get_player_state() const;
     std::string get_system_prompt() const;
 
     void apply_updates(const std::vector<ContextUpdate>& updates);
+    // Applies ops in order, writing each touched file once. Returns how many
+    // changed anything; adding an item already listed or removing one that
+    // is not does nothing.
+    size_t apply_state_ops(const std::vector<StateOp>& ops);
     void init_new_campaign(const std::string& roleplay_name,
                            const std::string& player_name, const std::string& player_role);
 
@@ -30,6 +98,11 @@ public:
     void append_history(const std::string& player_input, const std::string& gm_response);
     std::string get_history() const;
 
+    // Most recent turns that fit in token_budget, oldest first. The window's
+    // start only moves forward, and then in steps of a quarter of the budget,
+    // so consecutive turns share a prompt prefix the API can cache.
+    std::vector<HistoryTurn> history_window(size_t token_budget) const;
+
     // Characters management
     std::string get_characters() const;
     void save_characters(const std::string& content);
@@ -47,12 +120,48 @@ public:
     std::string get_image_path(const std::string& category, const std::string& id) const;
     bool image_exists(const std::string& category, const std::string& id) const;
 
+    // Bumped by every write
+    uint64_t version() const { return snapshot()->version; }
+
+    // A hot restart runs two servers on one campaigns directory until the
+    // old one has drained. Writes take the directory's lock file and count
+    // themselves in it; a server that finds the count moved reloads the
+    // files before building on them. Call with the campaign lock held
+    // exclusively; end_write releases what begin_write took.
+    void begin_write();
+    void end_write();
+    // The same check for a reader about to build on the state
+    void refresh();
+
     // Path accessors (for serving images)
     std::string images_dir() const { return campaign_dir_ + "/images"; }
     const std::string& campaign_dir() const { return campaign_dir_; }
 
+    // Turns kept in memory for history_window; older ones are only on disk
+    static constexpr size_t MAX_RECENT_TURNS = 64;
+
 private:
     std::string campaign_dir_;
+
+    // Writers are serialized by the campaign lock; readers only load the pointer
+    std::atomic<std::shared_ptr<const CampaignSnapshot>> snapshot_;
+    MarkdownParser md_parser_;
+
+    // First turn of the last history window; turns are serialized per campaign
+    mutable std::atomic<uint64_t> window_start_{0};
+
+    // The lock file, and its write count as of this process's last load or write
+    int lock_fd_ = -1;
+    uint64_t disk_writes_ = 0;
+    bool lock_files(int operation);
+    uint64_t read_disk_writes() const;
+
+    // Copies the current snapshot, applies edit and swaps the result in
+    void publish(const std::function<void(CampaignSnapshot&)>& edit);
+    void reload();
+    static HistoryTurn make_turn(uint64_t index, std::string player, std::string narrator);
+    static void remember_turn(CampaignSnapshot& s, HistoryTurn turn);
+    std::string find_image_on_disk(const std::string& category, const std::string& id) const;
     std::string plot_path() const { return campaign_dir_ + "/plot.md"; }
     std::string context_path() const { return campaign_dir_ + "/context.md"; }
     std::string player_path() const { return campaign_dir_ + "/player.md"; }
@@ -60,8 +169,7 @@ private:
     std::string locations_path() const { return campaign_dir_ + "/locations.md"; }
     std::string history_path() const { return campaign_dir_ + "/history.json"; }
     std::string metadata_path() const { return campaign_dir_ + "/metadata.json"; }
-
-    void create_dirs(const std::string& path);
+    std::string lock_path() const { return campaign_dir_ + "/.lock"; }
 };
 
 }
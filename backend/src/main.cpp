@@ -1,138 +1,351 @@
 #include "httplib.h"
+#include "server/admission.h"
+#include "server/event_server.h"
+#include "server/hot_restart.h"
 #include "server/routes.h"
+#include "api/http_client.h"
+#include "api/transport.h"
+#include "api/upstream_scheduler.h"
+#include "util/json.h"
+#include <algorithm>
+#include <csignal>
 #include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+using rpg::AdmissionControl;
+using rpg::RouteClass;
+
+namespace {
+    size_t env_size(const char* name, size_t fallback) {
+        const char* val = std::getenv(name);
+        if (!val || !*val) return fallback;
+        char* end = nullptr;
+        unsigned long parsed = std::strtoul(val, &end, 10);
+        return (end && *end == '\0' && parsed > 0) ? parsed : fallback;
+    }
+}
+
+int main(int, char* argv[]) {
+    // Signals are taken by a dedicated thread; block them before any other
+    // thread starts so it is the only one that sees them
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGUSR2);
+    pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+
+    auto inherited = rpg::hot_restart::take_inherited();
 
-int main() {
-    httplib::Server svr;
     rpg::Routes routes;
+    routes.set_history_budget(env_size("RPG_HISTORY_TOKENS", 4000));
+    routes.set_context_budget(env_size("RPG_CONTEXT_TOKENS", 24000));
+    routes.set_generation_cache_ttl(static_cast<long>(env_size("RPG_GENERATION_CACHE_TTL_SECONDS", 0)));
+    routes.set_batch_concurrency(env_size("RPG_BATCH_CONCURRENCY", 4));
+    routes.set_max_sessions(env_size("RPG_MAX_SESSIONS", 100000));
+    routes.set_campaign_idle_seconds(static_cast<long>(env_size("RPG_CAMPAIGN_IDLE_SECONDS", 600)));
+    routes.set_idempotency_ttl(static_cast<long>(env_size("RPG_IDEMPOTENCY_TTL_SECONDS", 3600)));
+    const char* bookkeeping_model = std::getenv("RPG_BOOKKEEPING_MODEL");
+    routes.set_two_phase_turns(env_size("RPG_TWO_PHASE_TURNS", 0) > 0,
+                               bookkeeping_model ? bookkeeping_model : "");
+
+    // Worker threads and accept queue are bounded; LLM-bound routes get a
+    // smaller in-flight budget so they always leave workers for cheap reads
+    size_t workers = env_size("RPG_WORKER_THREADS",
+                              std::max<size_t>(8, std::thread::hardware_concurrency()));
+    size_t max_queued = env_size("RPG_MAX_QUEUED", workers * 4);
+
+    AdmissionControl::Limits limits;
+    limits.llm = env_size("RPG_LLM_CONCURRENCY", std::max<size_t>(1, workers / 2));
+    limits.cheap = env_size("RPG_CHEAP_CONCURRENCY", workers);
+    limits.retry_after_seconds = static_cast<int>(env_size("RPG_RETRY_AFTER_SECONDS", 2));
+    AdmissionControl admission(limits);
+
+    rpg::WorkerPool pool(workers, max_queued);
+    routes.set_workers(pool);
+
+    // Connections live on a few epoll threads; workers only see whole requests,
+    // so idle keep-alive and streaming clients don't hold a worker
+    rpg::EventServer::Config config;
+    config.io_threads = env_size("RPG_IO_THREADS", 2);
+    config.idle_timeout_seconds = static_cast<int>(env_size("RPG_IDLE_TIMEOUT_SECONDS", 120));
+    config.request_timeout_seconds = static_cast<int>(env_size("RPG_REQUEST_TIMEOUT_SECONDS", 30));
+    config.drain_timeout_seconds = static_cast<int>(env_size("RPG_DRAIN_TIMEOUT_SECONDS", 120));
+    rpg::EventServer svr(pool, config);
+    // Bookkeeping calls of two-phase turns outlive their requests
+    svr.set_pending_work([&routes] { return routes.pending_work(); });
+
+    auto admitted = [&admission](RouteClass cls, rpg::EventServer::Handler handler) {
+        return [&admission, cls, handler = std::move(handler)](const httplib::Request& req,
+                                                               httplib::Response& res) {
+            auto permit = admission.try_acquire(cls);
+            if (!permit) {
+                admission.reject(res);
+                return;
+            }
+            handler(req, res);
+        };
+    };
+
+    // The permit is held until the response is sent, not just the handler;
+    // nothing waits on a worker meanwhile
+    using AsyncRoute = std::function<void(const httplib::Request&, std::shared_ptr<rpg::DeferredResponse>,
+                                          AdmissionControl::Permit)>;
+    auto admitted_async = [&admission](RouteClass cls, AsyncRoute handler) {
+        return [&admission, cls, handler = std::move(handler)](const httplib::Request& req,
+                                                               std::shared_ptr<rpg::DeferredResponse> reply) {
+            auto permit = admission.try_acquire(cls);
+            if (!permit) {
+                httplib::Response res;
+                admission.reject(res);
+                reply->send(std::move(res));
+                return;
+            }
+            handler(req, std::move(reply), std::move(permit));
+        };
+    };
+
+    // Outside admission, so a replayed or joined response never waits for a permit
+    auto idempotent = [&routes](rpg::Routes::AsyncHandler handler) {
+        return [&routes, handler = std::move(handler)](const httplib::Request& req,
+                                                       std::shared_ptr<rpg::DeferredResponse> reply) {
+            routes.idempotent(req, std::move(reply), handler);
+        };
+    };
 
     // CORS preflight handler
-    svr.Options(".*", [](const httplib::Request&, httplib::Response& res) {
+    svr.Options("/*", [](const httplib::Request&, httplib::Response& res) {
         res.set_header("Access-Control-Allow-Origin", "*");
         res.set_header("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS");
-        res.set_header("Access-Control-Allow-Headers", "Content-Type");
+        res.set_header("Access-Control-Allow-Headers", "Content-Type, X-Session-Id, Idempotency-Key");
         res.status = 204;
     });
 
     // Game messaging
-    svr.Post("/api/message", [&routes](const httplib::Request& req, httplib::Response& res) {
-        routes.handle_message(req, res);
+    svr.PostAsync("/api/message", idempotent(admitted_async(RouteClass::Llm, [&routes](const httplib::Request& req,
+            std::shared_ptr<rpg::DeferredResponse> reply, AdmissionControl::Permit permit) {
+        routes.handle_message(req, std::move(reply), std::move(permit));
+    })));
+
+    // The permit is held until the event stream ends, not just the handler
+    svr.PostStream("/api/message/stream", [&routes, &admission](const httplib::Request& req, httplib::Response& res,
+                                                                std::shared_ptr<rpg::ResponseStream> stream) {
+        auto permit = admission.try_acquire(RouteClass::Llm);
+        if (!permit) {
+            admission.reject(res);
+            return;
+        }
+        routes.handle_message_stream(req, res, std::move(stream), std::move(permit));
     });
 
-    svr.Get("/api/history", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/history", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_history(req, res);
-    });
+    }));
 
     // Player
-    svr.Get("/api/player", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/player", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_player(req, res);
-    });
+    }));
 
-    svr.Put("/api/player", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Put("/api/player", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_update_player(req, res);
-    });
+    }));
 
-    svr.Post("/api/player/note", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/player/note", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_add_note(req, res);
-    });
+    }));
 
-    svr.Post("/api/player/image", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/player/image", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_player_image(req, res);
-    });
+    }));
 
     // Campaign (legacy)
-    svr.Post("/api/campaign/new", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/campaign/new", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_new_campaign(req, res);
-    });
+    }));
 
     // Roleplays
-    svr.Get("/api/roleplays", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/roleplays", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_roleplays(req, res);
-    });
+    }));
 
-    svr.Post("/api/roleplays", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/roleplays", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_create_roleplay(req, res);
-    });
+    }));
 
-    svr.Put(R"(/api/roleplays/([^/]+)/load)", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Put("/api/roleplays/:id/load", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_load_roleplay(req, res);
-    });
+    }));
 
-    svr.Delete(R"(/api/roleplays/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Delete("/api/roleplays/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_delete_roleplay(req, res);
-    });
+    }));
 
-    svr.Get("/api/roleplay/current", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/roleplay/current", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_current_roleplay(req, res);
-    });
+    }));
 
     // Characters CRUD
-    svr.Get("/api/characters", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/characters", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_characters(req, res);
-    });
+    }));
 
-    svr.Get(R"(/api/characters/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/characters/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_character(req, res);
-    });
+    }));
 
-    svr.Post("/api/characters", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/characters", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_create_character(req, res);
-    });
+    }));
 
-    svr.Put(R"(/api/characters/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Put("/api/characters/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_update_character(req, res);
-    });
+    }));
 
-    svr.Delete(R"(/api/characters/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Delete("/api/characters/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_delete_character(req, res);
-    });
+    }));
 
     // Locations CRUD
-    svr.Get("/api/locations", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/locations", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_locations(req, res);
-    });
+    }));
 
-    svr.Get(R"(/api/locations/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/locations/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_location(req, res);
-    });
+    }));
 
-    svr.Post("/api/locations", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Post("/api/locations", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_create_location(req, res);
-    });
+    }));
 
-    svr.Put(R"(/api/locations/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Put("/api/locations/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_update_location(req, res);
-    });
+    }));
 
-    svr.Delete(R"(/api/locations/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Delete("/api/locations/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_delete_location(req, res);
-    });
+    }));
 
     // AI Generation
-    svr.Post("/api/generate/character", [&routes](const httplib::Request& req, httplib::Response& res) {
-        routes.handle_generate_character(req, res);
+    svr.PostAsync("/api/generate/character", idempotent(admitted_async(RouteClass::Llm, [&routes](const httplib::Request& req,
+            std::shared_ptr<rpg::DeferredResponse> reply, AdmissionControl::Permit permit) {
+        routes.handle_generate_character(req, std::move(reply), std::move(permit));
+    })));
+
+    svr.PostAsync("/api/generate/location", idempotent(admitted_async(RouteClass::Llm, [&routes](const httplib::Request& req,
+            std::shared_ptr<rpg::DeferredResponse> reply, AdmissionControl::Permit permit) {
+        routes.handle_generate_location(req, std::move(reply), std::move(permit));
+    })));
+
+    // One permit covers the whole batch; its own fan-out limit bounds the calls
+    svr.PostStream("/api/generate/batch", [&routes, &admission](const httplib::Request& req, httplib::Response& res,
+                                                                std::shared_ptr<rpg::ResponseStream> stream) {
+        auto permit = admission.try_acquire(RouteClass::Llm);
+        if (!permit) {
+            admission.reject(res);
+            return;
+        }
+        routes.handle_generate_batch(req, res, std::move(stream), std::move(permit));
     });
 
-    svr.Post("/api/generate/location", [&routes](const httplib::Request& req, httplib::Response& res) {
-        routes.handle_generate_location(req, res);
-    });
-
-    svr.Post("/api/generate/image", [&routes](const httplib::Request& req, httplib::Response& res) {
-        routes.handle_generate_image(req, res);
-    });
+    svr.PostAsync("/api/generate/image", idempotent(admitted_async(RouteClass::Llm, [&routes](const httplib::Request& req,
+            std::shared_ptr<rpg::DeferredResponse> reply, AdmissionControl::Permit permit) {
+        routes.handle_generate_image(req, std::move(reply), std::move(permit));
+    })));
 
     // Image serving
-    svr.Get(R"(/api/images/([^/]+)/([^/]+))", [&routes](const httplib::Request& req, httplib::Response& res) {
+    svr.Get("/api/images/:category/:id", admitted(RouteClass::Cheap, [&routes](const httplib::Request& req, httplib::Response& res) {
         routes.handle_get_image(req, res);
+    }));
+
+    // Server stats; not admission-controlled so it stays reachable under load
+    svr.Get("/api/stats", [&routes, &admission, &pool, &svr](const httplib::Request&, httplib::Response& res) {
+        rpg::json::JsonBuilder result(1024);
+        result.begin_object();
+        result.key("connections");
+        result.value_raw(svr.stats_json());
+        result.key("workers");
+        result.value_raw(pool.stats_json());
+        result.key("admission");
+        result.value_raw(admission.stats_json());
+        result.kv_string("transport", rpg::Transport::instance().mode());
+        result.key("upstream");
+        result.value_raw(rpg::HttpClient::instance().stats_json());
+        result.key("scheduler");
+        result.value_raw(rpg::UpstreamScheduler::instance().stats_json());
+        result.key("routes");
+        result.value_raw(routes.stats_json());
+        result.end_object();
+
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_content(result.str(), "application/json");
     });
 
     // Serve React build files
     svr.set_mount_point("/", "./frontend/dist");
 
-    printf("Claude RPG Server running at http://localhost:8080\n");
-    printf("Make sure ANTHROPIC_API_KEY and GEMINI_API_KEY are set!\n");
+    // SIGTERM/SIGINT drain and exit; a second one exits without waiting.
+    // SIGUSR2 hot-restarts: a new copy of the binary inherits the listening
+    // socket, and this process drains once the new one is serving.
+    std::thread([&svr, &routes, signals, argv] {
+        bool draining = false;
+        for (;;) {
+            int sig = 0;
+            if (sigwait(&signals, &sig) != 0) continue;
+
+            if (draining) {
+                svr.stop();
+                continue;
+            }
+            if (sig == SIGUSR2) {
+                routes.flush();
+                int ready_fd = -1;
+                pid_t pid = rpg::hot_restart::spawn_successor(svr.listen_fd(), argv, ready_fd);
+                if (pid < 0 || !rpg::hot_restart::wait_ready(ready_fd, 30000)) {
+                    fprintf(stderr, "Hot restart failed, still serving\n");
+                    continue;
+                }
+                printf("Process %d took over the listening socket, draining\n", static_cast<int>(pid));
+            }
+            draining = true;
+            svr.drain();
+        }
+    }).detach();
+
+    // Optionally pay DNS, TCP and TLS setup before the first player does
+    std::string transport = rpg::Transport::instance().mode();
+    if (transport != "replay" && env_size("RPG_WARM_UPSTREAM", 0) > 0) {
+        rpg::HttpClient::instance().warm_up("https://api.anthropic.com/");
+        rpg::HttpClient::instance().warm_up("https://generativelanguage.googleapis.com/");
+    }
 
-    svr.listen("0.0.0.0", 8080);
+    printf("Claude RPG Server running at http://localhost:8080\n");
+    printf("I/O threads: %zu, workers: %zu, queue: %zu, LLM budget: %zu, cheap budget: %zu\n",
+           config.io_threads, workers, max_queued, limits.llm, limits.cheap);
+    if (transport == "replay") printf("Upstream transport: replay, no API calls will be made\n");
+    else printf("Upstream transport: %s. Make sure ANTHROPIC_API_KEY and GEMINI_API_KEY are set!\n", transport.c_str());
+
+    bool served;
+    if (inherited.listen_fd >= 0) {
+        // Connections queue in the shared backlog until the reactors start
+        rpg::hot_restart::signal_ready(inherited.ready_fd);
+        served = svr.listen_on(inherited.listen_fd);
+    } else {
+        served = svr.listen("0.0.0.0", 8080);
+    }
+    if (!served) {
+        fprintf(stderr, "Failed to listen on port 8080\n");
+        return 1;
+    }
+
+    // Whatever outlasted the drain is cancelled; its callbacks still run
+    // before routes goes away. Then anything they or the drained requests
+    // changed is written, also when a successor has taken over.
+    routes.shutdown();
+    routes.flush();
 
     return 0;
 }
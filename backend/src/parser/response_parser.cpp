@@ -1,4 +1,6 @@
 #include "response_parser.h"
+#include "../util/json.h"
+#include <algorithm>
 #include <cstring>
 
 namespace rpg {
@@ -45,4 +47,92 @@ std::vector<ContextUpdate> ResponseParser::extract_updates(std::string_view resp
     return updates;
 }
 
+std::vector<StateOp> ResponseParser::extract_state_ops(std::string_view tool_input) const {
+    std::vector<StateOp> ops;
+    for (auto item : json::split_array(json::extract_object(tool_input, "operations"))) {
+        auto field = [item](std::string_view key) { return json::unescape(json::extract_string(item, key)); };
+        std::string op = field("op");
+
+        StateOp out;
+        if (op == "add_item" || op == "remove_item") {
+            out.kind = op == "add_item" ? StateOp::Kind::AddItem : StateOp::Kind::RemoveItem;
+            out.target = field("item");
+            if (out.target.empty()) continue;
+        } else if (op == "set_quest") {
+            out.kind = StateOp::Kind::SetQuest;
+            out.target = field("quest");
+            out.value = field("status");
+            if (out.target.empty()) continue;
+        } else if (op == "set_character_field") {
+            out.kind = StateOp::Kind::SetCharacterField;
+            out.target = field("character");
+            out.field = field("field");
+            out.value = field("value");
+            if (out.target.empty() || out.field.empty() || out.value.empty()) continue;
+        } else if (op == "add_plot_seed" || op == "add_note") {
+            out.kind = op == "add_plot_seed" ? StateOp::Kind::AddPlotSeed : StateOp::Kind::AddNote;
+            out.value = field("text");
+            if (out.value.empty()) continue;
+        } else {
+            continue;
+        }
+        ops.push_back(std::move(out));
+    }
+    return ops;
+}
+
+namespace {
+    constexpr std::string_view NARRATIVE_START = "[NARRATIVE]";
+    constexpr std::string_view NARRATIVE_END = "[/NARRATIVE]";
+
+    // Length of the longest suffix of text that is a proper prefix of tag
+    size_t partial_tag_length(std::string_view text, std::string_view tag) {
+        size_t max = std::min(text.size(), tag.size() - 1);
+        for (size_t len = max; len > 0; --len) {
+            if (text.substr(text.size() - len) == tag.substr(0, len)) return len;
+        }
+        return 0;
+    }
+}
+
+std::string NarrativeStream::feed(std::string_view chunk) {
+    std::string out;
+    if (state_ == State::Done) return out;
+    buffer_.append(chunk.data(), chunk.size());
+
+    if (state_ == State::BeforeStart) {
+        size_t start = buffer_.find(NARRATIVE_START);
+        if (start == std::string::npos) {
+            buffer_.erase(0, buffer_.size() - partial_tag_length(buffer_, NARRATIVE_START));
+            return out;
+        }
+        buffer_.erase(0, start + NARRATIVE_START.size());
+        state_ = State::InNarrative;
+    }
+
+    size_t end = buffer_.find(NARRATIVE_END);
+    size_t ready = end;
+    if (end == std::string::npos) {
+        ready = buffer_.size() - partial_tag_length(buffer_, NARRATIVE_END);
+    }
+
+    // Trailing newlines are held back in case the end tag follows them
+    while (ready > 0 && (buffer_[ready-1] == '\n' || buffer_[ready-1] == '\r')) --ready;
+
+    size_t begin = 0;
+    if (at_start_) {
+        while (begin < ready && (buffer_[begin] == '\n' || buffer_[begin] == '\r')) ++begin;
+        if (begin < ready) at_start_ = false;
+    }
+    out.assign(buffer_, begin, ready - begin);
+
+    if (end != std::string::npos) {
+        state_ = State::Done;
+        buffer_.clear();
+    } else {
+        buffer_.erase(0, ready);
+    }
+    return out;
+}
+
 }
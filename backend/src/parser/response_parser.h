@@ -10,6 +10,9 @@ class ResponseParser {
 public:
     std::string extract_narrative(std::string_view response) const;
     std::vector<ContextUpdate> extract_updates(std::string_view response) const;
+    // Operations from the input of an update_state tool call; malformed or
+    // unknown ones are dropped
+    std::vector<StateOp> extract_state_ops(std::string_view tool_input) const;
 
 private:
     std::string_view find_section(std::string_view response,
@@ -17,4 +20,20 @@ private:
                                    std::string_view end_tag) const;
 };
 
+// Incrementally extracts the [NARRATIVE] section from a streamed response.
+// Text is released as soon as it can't be part of a tag, with the same
+// newline trimming as ResponseParser::extract_narrative.
+class NarrativeStream {
+public:
+    std::string feed(std::string_view chunk);
+    bool finished() const { return state_ == State::Done; }
+
+private:
+    enum class State { BeforeStart, InNarrative, Done };
+
+    State state_ = State::BeforeStart;
+    std::string buffer_;
+    bool at_start_ = true;
+};
+
 }
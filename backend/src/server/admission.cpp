@@ -0,0 +1,143 @@
+#include "admission.h"
+#include "../util/json.h"
+
+namespace rpg {
+
+WorkerPool::WorkerPool(size_t threads, size_t max_queued) : max_queued_(max_queued) {
+    threads_.reserve(threads);
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this] { work(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    shutdown();
+}
+
+bool WorkerPool::enqueue(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (shutdown_ || jobs_.size() >= max_queued_) {
+            ++rejected_;
+            return false;
+        }
+        jobs_.push_back(std::move(fn));
+    }
+    ++accepted_;
+    cv_.notify_one();
+    return true;
+}
+
+void WorkerPool::post(std::function<void()> fn) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!shutdown_) {
+            jobs_.push_back(std::move(fn));
+            fn = nullptr;
+        }
+    }
+    if (fn) {
+        fn();
+        return;
+    }
+    cv_.notify_one();
+}
+
+void WorkerPool::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (shutdown_) return;
+        shutdown_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : threads_) t.join();
+}
+
+void WorkerPool::work() {
+    for (;;) {
+        std::function<void()> fn;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this] { return !jobs_.empty() || shutdown_; });
+            if (jobs_.empty()) return;
+            fn = std::move(jobs_.front());
+            jobs_.pop_front();
+        }
+
+        ++active_;
+        fn();
+        --active_;
+    }
+}
+
+std::string WorkerPool::stats_json() const {
+    size_t queued;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queued = jobs_.size();
+    }
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_int("threads", static_cast<int64_t>(threads_.size()));
+    j.kv_int("active", static_cast<int64_t>(active_.load()));
+    j.kv_int("queued", static_cast<int64_t>(queued));
+    j.kv_int("maxQueued", static_cast<int64_t>(max_queued_));
+    j.kv_int("accepted", static_cast<int64_t>(accepted_.load()));
+    j.kv_int("rejected", static_cast<int64_t>(rejected_.load()));
+    j.end_object();
+    return j.str();
+}
+
+AdmissionControl::AdmissionControl(Limits limits)
+    : retry_after_seconds_(limits.retry_after_seconds) {
+    llm_.limit = limits.llm;
+    cheap_.limit = limits.cheap;
+}
+
+AdmissionControl::Permit AdmissionControl::try_acquire(RouteClass cls) {
+    Budget& b = budget(cls);
+    size_t current = b.in_flight.load();
+    do {
+        if (current >= b.limit) {
+            ++b.rejected;
+            return Permit();
+        }
+    } while (!b.in_flight.compare_exchange_weak(current, current + 1));
+
+    ++b.admitted;
+    // The slot is returned when the last copy of the permit goes away
+    return Permit(std::shared_ptr<void>(&b, [](void* p) {
+        --static_cast<Budget*>(p)->in_flight;
+    }));
+}
+
+void AdmissionControl::reject(httplib::Response& res) const {
+    res.status = 503;
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Retry-After", std::to_string(retry_after_seconds_));
+    res.set_content(R"({"error":"Server busy, try again shortly"})", "application/json");
+}
+
+std::string AdmissionControl::budget_json(const Budget& b) {
+    json::JsonBuilder j(128);
+    j.begin_object();
+    j.kv_int("limit", static_cast<int64_t>(b.limit));
+    j.kv_int("inFlight", static_cast<int64_t>(b.in_flight.load()));
+    j.kv_int("admitted", static_cast<int64_t>(b.admitted.load()));
+    j.kv_int("rejected", static_cast<int64_t>(b.rejected.load()));
+    j.end_object();
+    return j.str();
+}
+
+std::string AdmissionControl::stats_json() const {
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.key("llm");
+    j.value_raw(budget_json(llm_));
+    j.key("cheap");
+    j.value_raw(budget_json(cheap_));
+    j.end_object();
+    return j.str();
+}
+
+}
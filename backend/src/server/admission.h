@@ -0,0 +1,100 @@
+#pragma once
+#include "httplib.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace rpg {
+
+// Fixed-size worker pool with a bounded request queue. Requests beyond the
+// queue limit get a 503 from the event server instead of piling up behind slow ones.
+class WorkerPool final : public httplib::TaskQueue {
+public:
+    WorkerPool(size_t threads, size_t max_queued);
+    ~WorkerPool() override;
+
+    bool enqueue(std::function<void()> fn) override;
+    void shutdown() override;
+
+    // Queues the rest of a request that was already admitted, e.g. work handed
+    // back from the upstream event loop. Never refused for queue length; once
+    // the pool has shut down fn runs on the calling thread instead.
+    void post(std::function<void()> fn);
+
+    std::string stats_json() const;
+
+private:
+    void work();
+
+    const size_t max_queued_;
+    std::vector<std::thread> threads_;
+
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<std::function<void()>> jobs_;
+    bool shutdown_ = false;
+
+    std::atomic<size_t> active_{0};
+    std::atomic<size_t> accepted_{0};
+    std::atomic<size_t> rejected_{0};
+};
+
+enum class RouteClass { Llm, Cheap };
+
+// Per-class in-flight budgets. LLM-bound routes get their own budget so a burst
+// of turns can't starve cheap reads; an exhausted budget is answered with 503
+// immediately rather than queued.
+class AdmissionControl {
+public:
+    struct Limits {
+        size_t llm = 4;
+        size_t cheap = 64;
+        int retry_after_seconds = 2;
+    };
+
+    // Holds one slot of a budget until destroyed
+    class Permit {
+    public:
+        Permit() = default;
+        explicit operator bool() const { return slot_ != nullptr; }
+
+    private:
+        friend class AdmissionControl;
+        explicit Permit(std::shared_ptr<void> slot) : slot_(std::move(slot)) {}
+        std::shared_ptr<void> slot_;
+    };
+
+    explicit AdmissionControl(Limits limits);
+
+    // Empty permit if the class is at its limit
+    Permit try_acquire(RouteClass cls);
+
+    // Fills in the 503 response for a request that didn't get a permit
+    void reject(httplib::Response& res) const;
+
+    std::string stats_json() const;
+
+private:
+    struct Budget {
+        size_t limit = 0;
+        std::atomic<size_t> in_flight{0};
+        std::atomic<size_t> admitted{0};
+        std::atomic<size_t> rejected{0};
+    };
+
+    Budget& budget(RouteClass cls) { return cls == RouteClass::Llm ? llm_ : cheap_; }
+    static std::string budget_json(const Budget& b);
+
+    int retry_after_seconds_;
+    Budget llm_;
+    Budget cheap_;
+};
+
+}
@@ -0,0 +1,56 @@
+#include "campaign_registry.h"
+#include <functional>
+
+namespace rpg {
+
+CampaignRegistry::CampaignRegistry(std::string campaigns_dir)
+    : campaigns_dir_(std::move(campaigns_dir)) {}
+
+CampaignRegistry::Shard& CampaignRegistry::shard_for(const std::string& id) {
+    return shards_[std::hash<std::string>{}(id) % SHARD_COUNT];
+}
+
+std::shared_ptr<Campaign> CampaignRegistry::get(const std::string& id) {
+    Shard& shard = shard_for(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto now = Clock::now();
+    close_idle(shard, now);
+
+    auto it = shard.campaigns.find(id);
+    if (it != shard.campaigns.end()) {
+        it->second.last_used = now;
+        return it->second.campaign;
+    }
+
+    auto campaign = std::make_shared<Campaign>(id, campaign_dir(id));
+    shard.campaigns.emplace(id, Entry{campaign, now});
+    return campaign;
+}
+
+void CampaignRegistry::close_idle(Shard& shard, Clock::time_point now) {
+    if (idle_seconds_ <= 0 || now - shard.last_sweep < SWEEP_INTERVAL) return;
+    shard.last_sweep = now;
+
+    // Only the registry's reference left: no request, queued turn or
+    // bookkeeping call can still be using it
+    for (auto it = shard.campaigns.begin(); it != shard.campaigns.end();) {
+        bool idle = now - it->second.last_used >= std::chrono::seconds(idle_seconds_);
+        if (idle && it->second.campaign.use_count() == 1) it = shard.campaigns.erase(it);
+        else ++it;
+    }
+}
+
+void CampaignRegistry::evict(const std::string& id) {
+    Shard& shard = shard_for(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.campaigns.erase(id);
+}
+
+bool CampaignRegistry::in_use(const std::string& id) {
+    Shard& shard = shard_for(id);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.campaigns.find(id);
+    return it != shard.campaigns.end() && it->second.campaign.use_count() > 1;
+}
+
+}
@@ -0,0 +1,102 @@
+#pragma once
+#include "../context/context_manager.h"
+#include "turn_sequencer.h"
+#include <array>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rpg {
+
+// A loaded roleplay. Handlers hold a shared_ptr for the duration of a request,
+// so switching or deleting campaigns never pulls the ContextManager out from
+// under an in-flight request.
+struct Campaign {
+    Campaign(const std::string& campaign_id, const std::string& dir)
+        : id(campaign_id), context(dir) {}
+
+    const std::string id;
+    ContextManager context;
+
+    // Shared for reads of the campaign files, exclusive for writes
+    mutable std::shared_mutex mutex;
+
+    // Orders narrator turns; taken before the mutex, never while holding it
+    TurnSequencer turns;
+
+    // The mutex held exclusively for writing the campaign files, which also
+    // keeps out the other server while a hot restart overlaps the two
+    class WriteLock {
+    public:
+        explicit WriteLock(Campaign& campaign) : lock_(campaign.mutex), context_(campaign.context) {
+            context_.begin_write();
+        }
+        ~WriteLock() { context_.end_write(); }
+        WriteLock(const WriteLock&) = delete;
+        WriteLock& operator=(const WriteLock&) = delete;
+
+    private:
+        std::unique_lock<std::shared_mutex> lock_;
+        ContextManager& context_;
+    };
+
+    // Picks up what the other server wrote since, before building on the state
+    void refresh() {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        context.refresh();
+    }
+};
+
+class CampaignRegistry {
+public:
+    explicit CampaignRegistry(std::string campaigns_dir);
+
+    // Returns the campaign for id, opening it on first use
+    std::shared_ptr<Campaign> get(const std::string& id);
+
+    // Campaigns nobody has asked for in this long are closed once nothing
+    // else holds them, so only roleplays in play stay resident; 0 keeps
+    // them all. Set before serving.
+    void set_idle_seconds(long seconds) { idle_seconds_ = seconds; }
+
+    // Drops the registry's reference; requests still holding the campaign keep it alive
+    void evict(const std::string& id);
+
+    // True while anything besides the registry holds the campaign: a request,
+    // a queued turn or the follow-up work of one
+    bool in_use(const std::string& id);
+
+    std::string campaign_dir(const std::string& id) const { return campaigns_dir_ + "/" + id; }
+
+private:
+    static constexpr size_t SHARD_COUNT = 16;
+
+    static constexpr std::chrono::seconds SWEEP_INTERVAL{60};
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::shared_ptr<Campaign> campaign;
+        Clock::time_point last_used;
+    };
+
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<std::string, Entry> campaigns;
+        Clock::time_point last_sweep;
+    };
+
+    Shard& shard_for(const std::string& id);
+
+    // shard.mutex held
+    void close_idle(Shard& shard, Clock::time_point now);
+
+    std::string campaigns_dir_;
+    std::array<Shard, SHARD_COUNT> shards_;
+    long idle_seconds_ = 0;
+};
+
+}
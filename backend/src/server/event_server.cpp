@@ -0,0 +1,895 @@
+#include "event_server.h"
+#include "../util/file_utils.h"
+#include "../util/json.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <optional>
+#include <cstdio>
+
+namespace rpg {
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    constexpr size_t MAX_HEADER_BYTES = 64 * 1024;
+    constexpr int MAX_EVENTS = 256;
+
+    std::string lowercase(std::string_view s) {
+        std::string out(s);
+        std::transform(out.begin(), out.end(), out.begin(),
+                       [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+        return out;
+    }
+
+    std::string_view trim(std::string_view s) {
+        while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+        while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+        return s;
+    }
+}
+
+struct EventServer::Reactor {
+    int epoll_fd = -1;
+    int wake_fd = -1;
+    std::thread thread;
+    std::unordered_map<int, std::shared_ptr<Connection>> connections;  // reactor thread only
+
+    std::mutex notify_mutex;
+    bool stopped = false;
+    std::vector<std::shared_ptr<Connection>> incoming;  // accepted, not yet registered
+    std::vector<std::shared_ptr<Connection>> notified;  // have output or a finished request
+
+    void wake() {
+        uint64_t one = 1;
+        ssize_t n = ::write(wake_fd, &one, sizeof(one));
+        (void)n;
+    }
+
+    void post(std::vector<std::shared_ptr<Connection>>& queue, std::shared_ptr<Connection> conn) {
+        {
+            std::lock_guard<std::mutex> lock(notify_mutex);
+            if (stopped) return;
+            queue.push_back(std::move(conn));
+        }
+        wake();
+    }
+};
+
+struct EventServer::Connection {
+    int fd = -1;
+    std::shared_ptr<Reactor> reactor;
+    std::string remote_addr;
+    int remote_port = 0;
+
+    // Reactor thread only
+    std::string in;
+    bool busy = false;  // a request is with a worker or streaming its body
+    bool writing = false;  // EPOLLOUT registered
+    bool continue_sent = false;
+    Clock::time_point last_active;
+    Clock::time_point request_started;
+
+    // Shared with workers and streams
+    std::mutex mutex;
+    std::string out;
+    size_t out_pos = 0;
+    bool closed = false;
+    bool request_done = false;  // response fully queued; the next request may be read
+    bool close_after_write = false;
+
+    // Queues bytes for the reactor to send; false once the connection is gone
+    bool send(std::string_view data, bool end_of_response, bool close_after) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (closed) return false;
+            out.append(data.data(), data.size());
+            if (end_of_response) request_done = true;
+            if (close_after) close_after_write = true;
+        }
+        reactor->post(reactor->notified, self.lock());
+        return true;
+    }
+
+    bool is_closed() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return closed;
+    }
+
+    std::weak_ptr<Connection> self;
+};
+
+// Chunked response body fed from any thread. Chunks written before the handler
+// returns are held until the worker has queued the status line and headers.
+class EventServer::ChunkedStream final : public ResponseStream {
+public:
+    ChunkedStream(std::shared_ptr<Connection> conn, bool keep_alive, std::atomic<size_t>& streaming)
+        : conn_(std::move(conn)), keep_alive_(keep_alive), streaming_(streaming) {}
+
+    ~ChunkedStream() override { close(); }
+
+    void open(const std::string& content_type) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        opened_ = true;
+        content_type_ = content_type;
+    }
+
+    bool write(std::string_view chunk) override {
+        if (chunk.empty()) return !disconnected();
+        char size[24];
+        int len = std::snprintf(size, sizeof(size), "%zx\r\n", chunk.size());
+        std::string framed;
+        framed.reserve(chunk.size() + static_cast<size_t>(len) + 2);
+        framed.append(size, static_cast<size_t>(len));
+        framed.append(chunk.data(), chunk.size());
+        framed += "\r\n";
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) return false;
+        if (!started_) {
+            pending_ += framed;
+            return !conn_->is_closed();
+        }
+        return conn_->send(framed, false, false);
+    }
+
+    void close() override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (closed_) return;
+        closed_ = true;
+        if (started_) {
+            conn_->send("0\r\n\r\n", true, !keep_alive_);
+            --streaming_;
+        }
+    }
+
+    bool disconnected() const override { return conn_->is_closed(); }
+
+    bool opened() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return opened_;
+    }
+
+    std::string content_type() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return content_type_;
+    }
+
+    // Called by the worker once the handler has returned
+    void start(std::string head) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        started_ = true;
+        head += pending_;
+        pending_.clear();
+        if (closed_) {
+            head += "0\r\n\r\n";
+            conn_->send(head, true, !keep_alive_);
+        } else {
+            ++streaming_;
+            conn_->send(head, false, false);
+        }
+    }
+
+private:
+    std::shared_ptr<Connection> conn_;
+    const bool keep_alive_;
+    std::atomic<size_t>& streaming_;
+
+    std::mutex mutex_;
+    bool opened_ = false;
+    bool started_ = false;
+    bool closed_ = false;
+    std::string content_type_;
+    std::string pending_;
+};
+
+// Answer of an async route, sent by whichever thread finishes it
+class EventServer::PendingResponse final : public DeferredResponse {
+public:
+    PendingResponse(EventServer& server, std::shared_ptr<Connection> conn, bool keep_alive)
+        : server_(server), conn_(std::move(conn)), keep_alive_(keep_alive) {
+        ++server_.deferred_;
+    }
+
+    ~PendingResponse() override {
+        httplib::Response res;
+        res.status = 500;
+        res.set_header("Access-Control-Allow-Origin", "*");
+        res.set_content(R"({"error":"Request ended without a response"})", "application/json");
+        send(std::move(res));
+    }
+
+    void send(httplib::Response res) override {
+        if (sent_.exchange(true)) return;
+        if (res.status == -1) res.status = 200;
+        server_.send_response(conn_, res, keep_alive_, false);
+        --server_.deferred_;
+    }
+
+    bool disconnected() const override { return conn_->is_closed(); }
+
+private:
+    EventServer& server_;
+    std::shared_ptr<Connection> conn_;
+    const bool keep_alive_;
+    std::atomic<bool> sent_{false};
+};
+
+EventServer::EventServer(httplib::TaskQueue& workers, Config config)
+    : workers_(workers), config_(config) {
+    if (config_.io_threads == 0) config_.io_threads = 1;
+
+    // Created up front so stop() and drain() can wake them from any thread
+    for (size_t i = 0; i < config_.io_threads; ++i) {
+        auto reactor = std::make_shared<Reactor>();
+        reactor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+        reactor->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        epoll_event ev{};
+        ev.events = EPOLLIN;
+        ev.data.fd = reactor->wake_fd;
+        epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev);
+        reactors_.push_back(std::move(reactor));
+    }
+}
+
+EventServer::~EventServer() {
+    stop();
+    for (auto& reactor : reactors_) {
+        ::close(reactor->wake_fd);
+        ::close(reactor->epoll_fd);
+    }
+}
+
+void EventServer::add_route(const std::string& method, const std::string& pattern, Route route) {
+    router_.add(method, pattern, routes_.size());
+    routes_.push_back(std::move(route));
+}
+
+void EventServer::Get(const std::string& pattern, Handler handler) {
+    add_route("GET", pattern, Route{std::move(handler), nullptr, nullptr});
+}
+
+void EventServer::Post(const std::string& pattern, Handler handler) {
+    add_route("POST", pattern, Route{std::move(handler), nullptr, nullptr});
+}
+
+void EventServer::Put(const std::string& pattern, Handler handler) {
+    add_route("PUT", pattern, Route{std::move(handler), nullptr, nullptr});
+}
+
+void EventServer::Delete(const std::string& pattern, Handler handler) {
+    add_route("DELETE", pattern, Route{std::move(handler), nullptr, nullptr});
+}
+
+void EventServer::Options(const std::string& pattern, Handler handler) {
+    add_route("OPTIONS", pattern, Route{std::move(handler), nullptr, nullptr});
+}
+
+void EventServer::PostStream(const std::string& pattern, StreamHandler handler) {
+    add_route("POST", pattern, Route{nullptr, std::move(handler), nullptr});
+}
+
+void EventServer::PostAsync(const std::string& pattern, AsyncHandler handler) {
+    add_route("POST", pattern, Route{nullptr, nullptr, std::move(handler)});
+}
+
+void EventServer::set_mount_point(const std::string& mount, const std::string& dir) {
+    mounts_.emplace_back(mount, dir);
+}
+
+bool EventServer::listen(const std::string& host, int port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* result = nullptr;
+    std::string service = std::to_string(port);
+    if (getaddrinfo(host.c_str(), service.c_str(), &hints, &result) != 0) return false;
+
+    int listen_fd = -1;
+    for (addrinfo* ai = result; ai; ai = ai->ai_next) {
+        int fd = ::socket(ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd < 0) continue;
+        int yes = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (::bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && ::listen(fd, SOMAXCONN) == 0) {
+            listen_fd = fd;
+            break;
+        }
+        ::close(fd);
+    }
+    freeaddrinfo(result);
+    if (listen_fd < 0) return false;
+    return serve(listen_fd);
+}
+
+bool EventServer::listen_on(int fd) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) return false;
+    return serve(fd);
+}
+
+bool EventServer::serve(int listen_fd) {
+    listen_fd_ = listen_fd;
+
+    // The first reactor also accepts
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = listen_fd;
+    epoll_ctl(reactors_[0]->epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+
+    for (size_t i = 1; i < reactors_.size(); ++i) {
+        Reactor& reactor = *reactors_[i];
+        reactor.thread = std::thread([this, &reactor] { run_reactor(reactor); });
+    }
+    run_reactor(*reactors_[0]);
+    for (size_t i = 1; i < reactors_.size(); ++i) {
+        reactors_[i]->thread.join();
+    }
+
+    // Let in-flight handlers finish before their connections go away
+    workers_.shutdown();
+
+    for (auto& reactor : reactors_) {
+        {
+            std::lock_guard<std::mutex> lock(reactor->notify_mutex);
+            reactor->stopped = true;
+            reactor->incoming.clear();
+            reactor->notified.clear();
+        }
+        std::vector<std::shared_ptr<Connection>> open;
+        for (auto& [fd, conn] : reactor->connections) open.push_back(conn);
+        for (auto& conn : open) close_connection(*reactor, conn);
+    }
+    ::close(listen_fd);
+    listen_fd_ = -1;
+    return true;
+}
+
+void EventServer::stop() {
+    if (stopping_.exchange(true)) return;
+    for (auto& reactor : reactors_) reactor->wake();
+}
+
+void EventServer::drain() {
+    if (draining_.exchange(true)) return;
+    for (auto& reactor : reactors_) reactor->wake();
+}
+
+void EventServer::drain_step(Reactor& reactor, Clock::time_point deadline) {
+    // Stop accepting; with a successor sharing the socket, new connections go to it
+    if (&reactor == reactors_[0].get() && !accept_paused_) {
+        epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, listen_fd_, nullptr);
+        accept_paused_ = true;
+    }
+
+    // Idle keep-alive connections go now; busy ones once their response is out
+    std::vector<std::shared_ptr<Connection>> idle;
+    for (auto& [fd, conn] : reactor.connections) {
+        if (!conn->busy && !conn->writing && conn->in.empty()) idle.push_back(conn);
+    }
+    for (auto& conn : idle) close_connection(reactor, conn);
+
+    bool idle_work = !pending_work_ || pending_work_() == 0;
+    if ((open_connections_ == 0 && idle_work) || Clock::now() >= deadline) stop();
+}
+
+void EventServer::run_reactor(Reactor& reactor) {
+    epoll_event events[MAX_EVENTS];
+    auto last_sweep = Clock::now();
+    std::optional<Clock::time_point> drain_deadline;
+
+    while (!stopping_) {
+        int n = epoll_wait(reactor.epoll_fd, events, MAX_EVENTS, 1000);
+        if (n < 0 && errno != EINTR) break;
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            if (fd == reactor.wake_fd) {
+                uint64_t count;
+                while (::read(reactor.wake_fd, &count, sizeof(count)) > 0) {}
+                continue;
+            }
+            if (fd == listen_fd_) {
+                accept_connections();
+                continue;
+            }
+
+            auto it = reactor.connections.find(fd);
+            if (it == reactor.connections.end()) continue;
+            auto conn = it->second;
+
+            uint32_t flags = events[i].events;
+            if (flags & EPOLLERR) {
+                close_connection(reactor, conn);
+                continue;
+            }
+            if ((flags & EPOLLOUT) && !flush(reactor, conn)) continue;
+            if (flags & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) on_readable(reactor, conn);
+        }
+
+        process_notified(reactor);
+
+        if (draining_) {
+            if (!drain_deadline) {
+                drain_deadline = Clock::now() + std::chrono::seconds(config_.drain_timeout_seconds);
+            }
+            drain_step(reactor, *drain_deadline);
+        }
+
+        auto now = Clock::now();
+        if (now - last_sweep >= std::chrono::seconds(1)) {
+            sweep_idle(reactor);
+            last_sweep = now;
+        }
+    }
+}
+
+
+void EventServer::accept_connections() {
+    for (;;) {
+        sockaddr_storage addr{};
+        socklen_t len = sizeof(addr);
+        int fd = accept4(listen_fd_, reinterpret_cast<sockaddr*>(&addr), &len,
+                         SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;  // EAGAIN, or out of descriptors: retried on the next wakeup
+        }
+
+        int yes = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        auto conn = std::make_shared<Connection>();
+        conn->self = conn;
+        conn->fd = fd;
+        char host[INET6_ADDRSTRLEN] = "";
+        if (addr.ss_family == AF_INET) {
+            auto* in = reinterpret_cast<sockaddr_in*>(&addr);
+            inet_ntop(AF_INET, &in->sin_addr, host, sizeof(host));
+            conn->remote_port = ntohs(in->sin_port);
+        } else if (addr.ss_family == AF_INET6) {
+            auto* in6 = reinterpret_cast<sockaddr_in6*>(&addr);
+            inet_ntop(AF_INET6, &in6->sin6_addr, host, sizeof(host));
+            conn->remote_port = ntohs(in6->sin6_port);
+        }
+        conn->remote_addr = host;
+
+        ++accepted_;
+        ++open_connections_;
+        auto& reactor = reactors_[next_reactor_++ % reactors_.size()];
+        conn->reactor = reactor;
+        reactor->post(reactor->incoming, std::move(conn));
+    }
+}
+
+void EventServer::on_readable(Reactor& reactor, const std::shared_ptr<Connection>& conn) {
+    char buf[16 * 1024];
+    for (;;) {
+        ssize_t n = ::recv(conn->fd, buf, sizeof(buf), 0);
+        if (n > 0) {
+            if (conn->in.empty()) conn->request_started = Clock::now();
+            conn->in.append(buf, static_cast<size_t>(n));
+            conn->last_active = Clock::now();
+            if (conn->in.size() > config_.max_request_bytes + MAX_HEADER_BYTES) {
+                close_connection(reactor, conn);
+                return;
+            }
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        // Peer closed or reset; any stream on this connection sees disconnected()
+        close_connection(reactor, conn);
+        return;
+    }
+    if (!conn->busy) try_dispatch(reactor, conn);
+}
+
+void EventServer::try_dispatch(Reactor& reactor, const std::shared_ptr<Connection>& conn) {
+    size_t header_end = conn->in.find("\r\n\r\n");
+    if (header_end == std::string::npos) {
+        if (conn->in.size() > MAX_HEADER_BYTES) respond_now(reactor, conn, 431, "Headers too large");
+        return;
+    }
+
+    auto parsed = std::make_shared<ParsedRequest>();
+    httplib::Request& req = parsed->req;
+    std::string_view head(conn->in.data(), header_end);
+
+    size_t line_end = head.find("\r\n");
+    std::string_view request_line = head.substr(0, line_end);
+    size_t sp1 = request_line.find(' ');
+    size_t sp2 = request_line.rfind(' ');
+    if (sp1 == std::string_view::npos || sp2 == sp1) {
+        respond_now(reactor, conn, 400, "Malformed request line");
+        return;
+    }
+    req.method = std::string(request_line.substr(0, sp1));
+    req.target = std::string(request_line.substr(sp1 + 1, sp2 - sp1 - 1));
+    req.version = std::string(request_line.substr(sp2 + 1));
+    if (req.version != "HTTP/1.1" && req.version != "HTTP/1.0") {
+        respond_now(reactor, conn, 505, "Unsupported HTTP version");
+        return;
+    }
+
+    size_t query = req.target.find('?');
+    req.path = httplib::decode_path_component(req.target.substr(0, query));
+    if (query != std::string::npos) {
+        httplib::detail::parse_query_text(req.target.substr(query + 1), req.params);
+    }
+
+    size_t pos = line_end == std::string_view::npos ? head.size() : line_end + 2;
+    while (pos < head.size()) {
+        size_t next = head.find("\r\n", pos);
+        if (next == std::string_view::npos) next = head.size();
+        std::string_view line = head.substr(pos, next - pos);
+        pos = next + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            respond_now(reactor, conn, 400, "Malformed header");
+            return;
+        }
+        req.headers.emplace(std::string(trim(line.substr(0, colon))),
+                            std::string(trim(line.substr(colon + 1))));
+    }
+
+    if (req.has_header("Transfer-Encoding")) {
+        respond_now(reactor, conn, 501, "Chunked request bodies are not supported");
+        return;
+    }
+
+    size_t content_length = 0;
+    if (req.has_header("Content-Length")) {
+        std::string value = req.get_header_value("Content-Length");
+        auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), content_length);
+        if (ec != std::errc() || end != value.data() + value.size()) {
+            respond_now(reactor, conn, 400, "Invalid Content-Length");
+            return;
+        }
+    }
+    if (content_length > config_.max_request_bytes) {
+        respond_now(reactor, conn, 413, "Request body too large");
+        return;
+    }
+
+    size_t total = header_end + 4 + content_length;
+    if (conn->in.size() < total) {
+        if (!conn->continue_sent && lowercase(req.get_header_value("Expect")) == "100-continue") {
+            conn->continue_sent = true;
+            {
+                std::lock_guard<std::mutex> lock(conn->mutex);
+                conn->out += "HTTP/1.1 100 Continue\r\n\r\n";
+            }
+            flush(reactor, conn);
+        }
+        return;
+    }
+
+    req.body = conn->in.substr(header_end + 4, content_length);
+    conn->in.erase(0, total);
+    if (!conn->in.empty()) conn->request_started = Clock::now();
+    conn->continue_sent = false;
+
+    std::string connection = lowercase(req.get_header_value("Connection"));
+    parsed->keep_alive = req.version == "HTTP/1.1" ? connection != "close" : connection == "keep-alive";
+    req.remote_addr = conn->remote_addr;
+    req.remote_port = conn->remote_port;
+    req.is_connection_closed = [conn] { return conn->is_closed(); };
+
+    conn->busy = true;
+    ++requests_;
+    bool queued = workers_.enqueue([this, conn, parsed]() mutable {
+        handle_request(conn, std::move(*parsed));
+    });
+    if (!queued) {
+        ++rejected_;
+        conn->busy = false;
+        respond_now(reactor, conn, 503, "Server busy, retry shortly");
+    }
+}
+
+void EventServer::respond_now(Reactor& reactor, const std::shared_ptr<Connection>& conn,
+                              int status, const std::string& message) {
+    json::JsonBuilder body(128);
+    body.begin_object();
+    body.kv_string("error", message);
+    body.end_object();
+
+    httplib::Response res;
+    res.status = status;
+    res.set_header("Access-Control-Allow-Origin", "*");
+    if (status == 503) res.set_header("Retry-After", "1");
+    res.set_header("Content-Type", "application/json");
+
+    // Anything but a rejected, fully-read request leaves the stream unparseable
+    bool keep_alive = status == 503;
+    std::string text = serialize_head(res, keep_alive, false, body.str().size()) + body.str();
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        conn->out += text;
+        if (!keep_alive) conn->close_after_write = true;
+    }
+    flush(reactor, conn);
+}
+
+void EventServer::process_notified(Reactor& reactor) {
+    std::vector<std::shared_ptr<Connection>> incoming;
+    std::vector<std::shared_ptr<Connection>> notified;
+    {
+        std::lock_guard<std::mutex> lock(reactor.notify_mutex);
+        incoming.swap(reactor.incoming);
+        notified.swap(reactor.notified);
+    }
+
+    for (auto& conn : incoming) {
+        epoll_event ev{};
+        ev.events = EPOLLIN | EPOLLRDHUP;
+        ev.data.fd = conn->fd;
+        if (epoll_ctl(reactor.epoll_fd, EPOLL_CTL_ADD, conn->fd, &ev) != 0) {
+            ::close(conn->fd);
+            --open_connections_;
+            continue;
+        }
+        conn->last_active = Clock::now();
+        reactor.connections[conn->fd] = conn;
+    }
+
+    for (auto& conn : notified) {
+        auto it = reactor.connections.find(conn->fd);
+        if (it == reactor.connections.end() || it->second != conn) continue;  // already closed
+
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(conn->mutex);
+            done = conn->request_done;
+            conn->request_done = false;
+        }
+        if (done) {
+            conn->busy = false;
+            conn->last_active = Clock::now();
+        }
+        if (!flush(reactor, conn)) continue;
+        // Pipelined requests wait in the input buffer until the previous response is queued
+        if (done && !conn->in.empty()) try_dispatch(reactor, conn);
+    }
+}
+
+bool EventServer::flush(Reactor& reactor, const std::shared_ptr<Connection>& conn) {
+    std::unique_lock<std::mutex> lock(conn->mutex);
+    while (conn->out_pos < conn->out.size()) {
+        ssize_t n = ::send(conn->fd, conn->out.data() + conn->out_pos,
+                           conn->out.size() - conn->out_pos, MSG_NOSIGNAL);
+        if (n > 0) {
+            conn->out_pos += static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            lock.unlock();
+            update_interest(reactor, *conn, true);
+            return true;
+        }
+        lock.unlock();
+        close_connection(reactor, conn);
+        return false;
+    }
+    conn->out.clear();
+    conn->out_pos = 0;
+    bool close_now = conn->close_after_write;
+    lock.unlock();
+
+    if (close_now) {
+        close_connection(reactor, conn);
+        return false;
+    }
+    update_interest(reactor, *conn, false);
+    return true;
+}
+
+void EventServer::update_interest(Reactor& reactor, Connection& conn, bool want_write) {
+    if (conn.writing == want_write) return;
+    conn.writing = want_write;
+    epoll_event ev{};
+    ev.events = EPOLLIN | EPOLLRDHUP | (want_write ? EPOLLOUT : 0u);
+    ev.data.fd = conn.fd;
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_MOD, conn.fd, &ev);
+}
+
+void EventServer::close_connection(Reactor& reactor, const std::shared_ptr<Connection>& conn) {
+    {
+        std::lock_guard<std::mutex> lock(conn->mutex);
+        if (conn->closed) return;
+        conn->closed = true;
+        conn->out.clear();
+        conn->out_pos = 0;
+    }
+    epoll_ctl(reactor.epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+    ::close(conn->fd);
+    reactor.connections.erase(conn->fd);
+    --open_connections_;
+}
+
+void EventServer::sweep_idle(Reactor& reactor) {
+    auto now = Clock::now();
+    auto idle_limit = std::chrono::seconds(config_.idle_timeout_seconds);
+    auto request_limit = std::chrono::seconds(config_.request_timeout_seconds);
+
+    std::vector<std::shared_ptr<Connection>> expired;
+    for (auto& [fd, conn] : reactor.connections) {
+        if (conn->busy || conn->writing) continue;
+        if (conn->in.empty() ? now - conn->last_active > idle_limit
+                             : now - conn->request_started > request_limit) {
+            expired.push_back(conn);
+        }
+    }
+    for (auto& conn : expired) close_connection(reactor, conn);
+}
+
+void EventServer::handle_request(const std::shared_ptr<Connection>& conn, ParsedRequest parsed) {
+    // Clients reconnect to the successor rather than reuse a draining server
+    if (draining_) parsed.keep_alive = false;
+
+    httplib::Request& req = parsed.req;
+    httplib::Response res;
+    std::shared_ptr<ChunkedStream> stream;
+    std::shared_ptr<PendingResponse> pending;
+
+    try {
+        if (auto target = router_.match(req.method, req.path, req.path_params)) {
+            const Route& route = routes_[*target];
+            if (route.async_handler) {
+                pending = std::make_shared<PendingResponse>(*this, conn, parsed.keep_alive);
+                route.async_handler(req, pending);
+                return;
+            } else if (route.stream_handler) {
+                stream = std::make_shared<ChunkedStream>(conn, parsed.keep_alive, streaming_);
+                route.stream_handler(req, res, stream);
+            } else {
+                route.handler(req, res);
+            }
+        } else if (!serve_static(req, res)) {
+            res.status = 404;
+        }
+    } catch (const std::exception& e) {
+        if (pending) {
+            // Unless the handler already answered
+            httplib::Response error;
+            error.status = 500;
+            json::JsonBuilder body(128);
+            body.begin_object();
+            body.kv_string("error", e.what());
+            body.end_object();
+            error.set_content(body.str(), "application/json");
+            pending->send(std::move(error));
+            return;
+        }
+        if (stream && stream->opened()) {
+            stream->close();
+            return;
+        }
+        stream.reset();
+        res = httplib::Response();
+        res.status = 500;
+        json::JsonBuilder body(128);
+        body.begin_object();
+        body.kv_string("error", e.what());
+        body.end_object();
+        res.set_content(body.str(), "application/json");
+    }
+    if (res.status == -1) res.status = 200;
+
+    if (stream && stream->opened()) {
+        res.set_header("Content-Type", stream->content_type());
+        stream->start(serialize_head(res, parsed.keep_alive, true, 0));
+        return;
+    }
+
+    send_response(conn, res, parsed.keep_alive, req.method == "HEAD");
+}
+
+void EventServer::send_response(const std::shared_ptr<Connection>& conn, httplib::Response& res,
+                                bool keep_alive, bool head_only) {
+    // Length-based providers (shared read bodies) are drained here. Chunked
+    // providers are drained too, so long-lived bodies belong on a ResponseStream.
+    std::string body;
+    if (res.content_provider_) {
+        bool done = false;
+        httplib::DataSink sink;
+        sink.write = [&body](const char* data, size_t len) {
+            body.append(data, len);
+            return true;
+        };
+        sink.is_writable = [] { return true; };
+        sink.done = [&done] { done = true; };
+        sink.done_with_trailer = [&done](const httplib::Headers&) { done = true; };
+        if (res.is_chunked_content_provider_ || res.content_length_ == 0) {
+            while (!done && res.content_provider_(body.size(), 0, sink)) {}
+        } else {
+            while (body.size() < res.content_length_ &&
+                   res.content_provider_(body.size(), res.content_length_ - body.size(), sink)) {}
+        }
+        if (res.content_provider_resource_releaser_) res.content_provider_resource_releaser_(true);
+    } else {
+        body = std::move(res.body);
+    }
+    if (head_only) {
+        conn->send(serialize_head(res, keep_alive, false, body.size()), true, !keep_alive);
+        return;
+    }
+
+    std::string text = serialize_head(res, keep_alive, false, body.size());
+    text += body;
+    conn->send(text, true, !keep_alive);
+}
+
+bool EventServer::serve_static(const httplib::Request& req, httplib::Response& res) const {
+    if (req.method != "GET" && req.method != "HEAD") return false;
+
+    for (const auto& [mount, dir] : mounts_) {
+        if (req.path.compare(0, mount.size(), mount) != 0) continue;
+        std::string sub = req.path.substr(mount.size());
+        if (!httplib::detail::is_valid_path(sub)) continue;
+
+        std::string path = dir + "/" + sub;
+        struct stat st;
+        if (::stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+            if (path.back() != '/') path += '/';
+            path += "index.html";
+        }
+        if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+        std::string content = file::read_file(path);
+        res.set_content(std::move(content),
+                        httplib::detail::find_content_type(path, {}, "application/octet-stream"));
+        return true;
+    }
+    return false;
+}
+
+std::string EventServer::serialize_head(const httplib::Response& res, bool keep_alive,
+                                        bool chunked, size_t content_length) {
+    std::string head = "HTTP/1.1 " + std::to_string(res.status) + " " +
+                       httplib::status_message(res.status) + "\r\n";
+    for (const auto& [name, value] : res.headers) {
+        std::string lower = lowercase(name);
+        if (lower == "content-length" || lower == "transfer-encoding" || lower == "connection") continue;
+        head += name + ": " + value + "\r\n";
+    }
+    if (chunked) {
+        head += "Transfer-Encoding: chunked\r\n";
+    } else {
+        head += "Content-Length: " + std::to_string(content_length) + "\r\n";
+    }
+    head += keep_alive ? "Connection: keep-alive\r\n" : "Connection: close\r\n";
+    head += "\r\n";
+    return head;
+}
+
+std::string EventServer::stats_json() const {
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_int("ioThreads", static_cast<int64_t>(config_.io_threads));
+    j.kv_int("open", static_cast<int64_t>(open_connections_.load()));
+    j.kv_int("streaming", static_cast<int64_t>(streaming_.load()));
+    j.kv_int("deferred", static_cast<int64_t>(deferred_.load()));
+    j.kv_int("accepted", static_cast<int64_t>(accepted_.load()));
+    j.kv_int("requests", static_cast<int64_t>(requests_.load()));
+    j.kv_int("rejected", static_cast<int64_t>(rejected_.load()));
+    j.end_object();
+    return j.str();
+}
+
+}
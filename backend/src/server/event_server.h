@@ -0,0 +1,143 @@
+#pragma once
+#include "httplib.h"
+#include "response_stream.h"
+#include "router.h"
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace rpg {
+
+// HTTP/1.1 front end that multiplexes every connection over a few epoll
+// threads. Idle keep-alive and streaming connections cost a file descriptor
+// and a buffer, not a thread; handlers run on the worker pool and use
+// httplib's Request/Response types, so they are unaware of the transport.
+class EventServer {
+public:
+    using Handler = std::function<void(const httplib::Request&, httplib::Response&)>;
+    using StreamHandler = std::function<void(const httplib::Request&, httplib::Response&,
+                                             std::shared_ptr<ResponseStream>)>;
+    using AsyncHandler = std::function<void(const httplib::Request&, std::shared_ptr<DeferredResponse>)>;
+
+    struct Config {
+        size_t io_threads = 2;
+        int idle_timeout_seconds = 120;    // keep-alive connections with no request
+        int request_timeout_seconds = 30;  // a request that is still arriving
+        size_t max_request_bytes = 64 * 1024 * 1024;
+        int drain_timeout_seconds = 120;    // in-flight turns get this long to finish
+    };
+
+    EventServer(httplib::TaskQueue& workers, Config config);
+    ~EventServer();
+
+    EventServer(const EventServer&) = delete;
+    EventServer& operator=(const EventServer&) = delete;
+
+    // Patterns use Router syntax; parameters land in req.path_params
+    void Get(const std::string& pattern, Handler handler);
+    void Post(const std::string& pattern, Handler handler);
+    void Put(const std::string& pattern, Handler handler);
+    void Delete(const std::string& pattern, Handler handler);
+    void Options(const std::string& pattern, Handler handler);
+    void PostStream(const std::string& pattern, StreamHandler handler);
+    // The handler answers through the DeferredResponse whenever it is ready,
+    // so no worker waits while the response is produced elsewhere
+    void PostAsync(const std::string& pattern, AsyncHandler handler);
+
+    // Serves files under dir for GET requests no route matched
+    void set_mount_point(const std::string& mount, const std::string& dir);
+
+    // Blocks until stop() is called; false if the socket can't be set up
+    bool listen(const std::string& host, int port);
+    // Same, on an already listening socket (e.g. inherited on hot restart)
+    bool listen_on(int fd);
+    void stop();
+
+    // Stops accepting, closes idle connections and stops once in-flight
+    // requests and streams have finished. Only writes to an eventfd, so it
+    // is safe from a signal handler.
+    void drain();
+
+    // Work that no connection waits for but drain should, e.g. upstream
+    // calls that finish a turn after its response went out. Set before
+    // serving; drain waits for it to reach 0 within the same timeout.
+    void set_pending_work(std::function<size_t()> pending) { pending_work_ = std::move(pending); }
+
+    // The listening socket while serving, else -1
+    int listen_fd() const { return listen_fd_; }
+
+    std::string stats_json() const;
+
+private:
+    struct Connection;
+    struct Reactor;
+    class ChunkedStream;
+    class PendingResponse;
+
+    struct Route {
+        Handler handler;
+        StreamHandler stream_handler;
+        AsyncHandler async_handler;
+    };
+
+    struct ParsedRequest {
+        httplib::Request req;
+        bool keep_alive = true;
+    };
+
+    void add_route(const std::string& method, const std::string& pattern, Route route);
+
+    bool serve(int listen_fd);
+    void run_reactor(Reactor& reactor);
+    void drain_step(Reactor& reactor, std::chrono::steady_clock::time_point deadline);
+    void accept_connections();
+    void on_readable(Reactor& reactor, const std::shared_ptr<Connection>& conn);
+    void process_notified(Reactor& reactor);
+    void try_dispatch(Reactor& reactor, const std::shared_ptr<Connection>& conn);
+    void respond_now(Reactor& reactor, const std::shared_ptr<Connection>& conn,
+                     int status, const std::string& message);
+    bool flush(Reactor& reactor, const std::shared_ptr<Connection>& conn);  // false if it closed
+    void update_interest(Reactor& reactor, Connection& conn, bool want_write);
+    void close_connection(Reactor& reactor, const std::shared_ptr<Connection>& conn);
+    void sweep_idle(Reactor& reactor);
+
+    // Runs on a worker thread
+    void handle_request(const std::shared_ptr<Connection>& conn, ParsedRequest parsed);
+    void send_response(const std::shared_ptr<Connection>& conn, httplib::Response& res,
+                       bool keep_alive, bool head_only);
+    bool serve_static(const httplib::Request& req, httplib::Response& res) const;
+    static std::string serialize_head(const httplib::Response& res, bool keep_alive,
+                                      bool chunked, size_t content_length);
+
+    httplib::TaskQueue& workers_;
+    Config config_;
+    Router router_;
+    std::vector<Route> routes_;  // indexed by the router's targets
+    std::vector<std::pair<std::string, std::string>> mounts_;
+    std::function<size_t()> pending_work_;
+
+    std::atomic<int> listen_fd_{-1};
+    std::atomic<bool> stopping_{false};
+    std::atomic<bool> draining_{false};
+    bool accept_paused_ = false;  // first reactor only
+    std::vector<std::shared_ptr<Reactor>> reactors_;
+    std::atomic<size_t> next_reactor_{0};
+
+    std::atomic<size_t> open_connections_{0};
+    std::atomic<size_t> streaming_{0};
+    std::atomic<size_t> deferred_{0};  // async responses not sent yet
+    std::atomic<size_t> accepted_{0};
+    std::atomic<size_t> requests_{0};
+    std::atomic<size_t> rejected_{0};
+};
+
+}
@@ -0,0 +1,92 @@
+#include "hot_restart.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace rpg { namespace hot_restart {
+
+namespace {
+    constexpr const char* LISTEN_FD_ENV = "RPG_LISTEN_FD";
+    constexpr const char* READY_FD_ENV = "RPG_READY_FD";
+
+    int take_fd(const char* name) {
+        const char* val = std::getenv(name);
+        if (!val || !*val) return -1;
+        char* end = nullptr;
+        long fd = std::strtol(val, &end, 10);
+        unsetenv(name);
+        if (!end || *end != '\0' || fd < 0) return -1;
+        // Not passed on to anything this process execs
+        fcntl(static_cast<int>(fd), F_SETFD, FD_CLOEXEC);
+        return static_cast<int>(fd);
+    }
+}
+
+Inherited take_inherited() {
+    Inherited inherited;
+    inherited.listen_fd = take_fd(LISTEN_FD_ENV);
+    inherited.ready_fd = take_fd(READY_FD_ENV);
+    return inherited;
+}
+
+pid_t spawn_successor(int listen_fd, char* const argv[], int& ready_fd) {
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0) return -1;
+
+    // The environment is built before fork: the child of a threaded process
+    // may only make async-signal-safe calls
+    std::vector<std::string> env;
+    for (char** e = environ; *e; ++e) env.emplace_back(*e);
+    env.push_back(std::string(LISTEN_FD_ENV) + "=" + std::to_string(listen_fd));
+    env.push_back(std::string(READY_FD_ENV) + "=" + std::to_string(pipe_fds[1]));
+    std::vector<char*> envp;
+    for (auto& var : env) envp.push_back(var.data());
+    envp.push_back(nullptr);
+
+    // argv[0] rather than /proc/self/exe, which still names the replaced binary
+    const char* path = std::strchr(argv[0], '/') ? argv[0] : "/proc/self/exe";
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        fcntl(listen_fd, F_SETFD, 0);
+        fcntl(pipe_fds[1], F_SETFD, 0);
+        execve(path, argv, envp.data());
+        _exit(127);
+    }
+
+    close(pipe_fds[1]);
+    if (pid < 0) {
+        close(pipe_fds[0]);
+        return -1;
+    }
+    ready_fd = pipe_fds[0];
+    return pid;
+}
+
+void signal_ready(int ready_fd) {
+    if (ready_fd < 0) return;
+    char byte = 1;
+    ssize_t n = write(ready_fd, &byte, 1);
+    (void)n;
+    close(ready_fd);
+}
+
+bool wait_ready(int ready_fd, int timeout_ms) {
+    pollfd pfd{ready_fd, POLLIN, 0};
+    int rc;
+    do {
+        rc = poll(&pfd, 1, timeout_ms);
+    } while (rc < 0 && errno == EINTR);
+
+    char byte = 0;
+    bool ready = rc > 0 && read(ready_fd, &byte, 1) == 1;
+    close(ready_fd);
+    return ready;
+}
+
+} }
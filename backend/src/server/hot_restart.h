@@ -0,0 +1,34 @@
+#pragma once
+#include <sys/types.h>
+
+namespace rpg {
+
+// Hands the listening socket to a freshly exec'd copy of this binary. The
+// socket is never closed, so connections arriving mid-deploy wait in its
+// backlog instead of being refused; the old process drains and exits once
+// the new one reports it is serving.
+namespace hot_restart {
+
+    // Sockets passed down by the previous process; -1 when started normally
+    struct Inherited {
+        int listen_fd = -1;
+        int ready_fd = -1;
+    };
+
+    // Reads and clears the handoff environment so it isn't passed on again
+    Inherited take_inherited();
+
+    // Starts the successor with listen_fd inherited. Returns its pid, or -1,
+    // and the read end of a pipe that becomes readable once it is serving.
+    pid_t spawn_successor(int listen_fd, char* const argv[], int& ready_fd);
+
+    // Successor side: tells the previous process to start draining
+    void signal_ready(int ready_fd);
+
+    // Old process side: true if the successor signalled within timeout_ms.
+    // False if it exited or timed out, in which case keep serving.
+    bool wait_ready(int ready_fd, int timeout_ms);
+
+}
+
+}
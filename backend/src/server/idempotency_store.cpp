@@ -0,0 +1,148 @@
+#include "idempotency_store.h"
+#include "../util/json.h"
+
+namespace rpg {
+
+bool IdempotencyStore::Entry::abandoned() {
+    std::lock_guard<std::mutex> lock(watchers_mutex);
+    if (watchers.empty()) return false;
+    for (const auto& is_closed : watchers) {
+        if (!is_closed || !is_closed()) return false;
+    }
+    return true;
+}
+
+void IdempotencyStore::Entry::watch(std::function<bool()> is_closed) {
+    std::lock_guard<std::mutex> lock(watchers_mutex);
+    watchers.push_back(std::move(is_closed));
+}
+
+IdempotencyStore::Run::~Run() {
+    Response failed;
+    failed.status = 500;
+    failed.content_type = "application/json";
+    failed.body = R"({"error":"Request ended without a response"})";
+    complete(std::move(failed));
+}
+
+void IdempotencyStore::Run::complete(Response response) {
+    if (completed_.exchange(true)) return;
+    store_.finish(key_, entry_, std::move(response));
+}
+
+bool IdempotencyStore::Run::abandoned() const {
+    return entry_->abandoned();
+}
+
+std::pair<IdempotencyStore::Outcome, std::shared_ptr<IdempotencyStore::Run>>
+IdempotencyStore::start(const std::string& key, const std::string& fingerprint,
+                        std::function<bool()> is_closed, Deliver deliver) {
+    std::shared_ptr<Entry> entry;
+    Result stored;
+    bool ran = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        evict(Clock::now());
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            entry = it->second;
+            if (entry->fingerprint != fingerprint) {
+                ++mismatched_;
+                return {Outcome::Mismatch, nullptr};
+            }
+            if (entry->done) stored = entry->result;
+            else entry->waiting.push_back(std::move(deliver));
+        } else {
+            entry = std::make_shared<Entry>();
+            entry->fingerprint = fingerprint;
+            entries_.emplace(key, entry);
+            ran = true;
+        }
+
+        // A retry keeps the original call alive even after the first
+        // connection drops. Only while it runs: under mutex_, so finish()
+        // can't have cleared the watchers already.
+        if (!stored) entry->watch(std::move(is_closed));
+    }
+
+    if (stored) {
+        ++replayed_;
+        deliver(std::move(stored));
+        return {Outcome::Replayed, nullptr};
+    }
+    if (ran) {
+        ++ran_;
+        return {Outcome::Ran, std::make_shared<Run>(*this, key, entry)};
+    }
+    ++joined_;
+    return {Outcome::Joined, nullptr};
+}
+
+void IdempotencyStore::finish(const std::string& key, const std::shared_ptr<Entry>& entry,
+                              Response response) {
+    auto result = std::make_shared<const Response>(std::move(response));
+    std::vector<Deliver> waiting;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        waiting.swap(entry->waiting);
+        auto it = entries_.find(key);
+        if (it != entries_.end() && it->second == entry) {
+            if (result->status >= 500) {
+                entries_.erase(it);
+            } else {
+                entry->result = result;
+                entry->done = true;
+                entry->completed = Clock::now();
+                entry->bytes = key.size() + result->body.size() + result->content_type.size();
+                for (const auto& [name, value] : result->headers) entry->bytes += name.size() + value.size();
+                kept_.emplace_back(key, entry);
+                kept_bytes_ += entry->bytes;
+                evict(entry->completed);
+            }
+        }
+    }
+    // Nothing checks them once the run is over; a kept entry shouldn't pin
+    // the connections of everyone who waited on it
+    {
+        std::lock_guard<std::mutex> lock(entry->watchers_mutex);
+        entry->watchers.clear();
+    }
+    for (auto& deliver : waiting) deliver(result);
+}
+
+void IdempotencyStore::evict(Clock::time_point now) {
+    while (!kept_.empty()) {
+        auto& [key, entry] = kept_.front();
+        bool expired = config_.ttl_seconds > 0 &&
+                       now - entry->completed >= std::chrono::seconds(config_.ttl_seconds);
+        if (!expired && kept_.size() <= config_.max_entries && kept_bytes_ <= config_.max_bytes) break;
+
+        auto it = entries_.find(key);
+        if (it != entries_.end() && it->second == entry) entries_.erase(it);
+        kept_bytes_ -= entry->bytes;
+        kept_.pop_front();
+    }
+}
+
+std::string IdempotencyStore::stats_json() const {
+    size_t kept, bytes, in_flight;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        kept = kept_.size();
+        bytes = kept_bytes_;
+        in_flight = entries_.size() - kept;
+    }
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_int("ran", static_cast<int64_t>(ran_.load()));
+    j.kv_int("joined", static_cast<int64_t>(joined_.load()));
+    j.kv_int("replayed", static_cast<int64_t>(replayed_.load()));
+    j.kv_int("mismatched", static_cast<int64_t>(mismatched_.load()));
+    j.kv_int("inFlight", static_cast<int64_t>(in_flight));
+    j.kv_int("kept", static_cast<int64_t>(kept));
+    j.kv_int("keptBytes", static_cast<int64_t>(bytes));
+    j.end_object();
+    return j.str();
+}
+
+}
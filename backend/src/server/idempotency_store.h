@@ -0,0 +1,133 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rpg {
+
+// Responses to requests that carried an Idempotency-Key, so a client that
+// resends one (a flaky connection, a double tap) gets the original outcome
+// instead of a second upstream call and a second turn in history.json.
+//
+// The first request with a key runs; a duplicate that arrives while it runs
+// is answered with its response when it completes, and one that arrives
+// later gets the stored copy. Nobody waits on a thread. Failed responses
+// (5xx) are shared with the waiters but not kept, so a later retry runs again. Entries are held in memory until they
+// expire or the byte budget needs the room, oldest first.
+class IdempotencyStore {
+public:
+    struct Config {
+        size_t max_entries = 4096;
+        size_t max_bytes = 64 << 20;  // bodies and headers of kept responses
+        long ttl_seconds = 3600;
+    };
+
+    struct Response {
+        int status = 200;
+        std::string content_type;
+        std::string body;
+        std::vector<std::pair<std::string, std::string>> headers;
+    };
+    using Result = std::shared_ptr<const Response>;
+
+    enum class Outcome {
+        Ran,       // first with the key
+        Joined,    // waited for the first one's response
+        Replayed,  // got a stored response
+        Mismatch   // the key was used for a different request; nothing ran
+    };
+
+    // Gets the response for a Joined or Replayed request
+    using Deliver = std::function<void(Result)>;
+
+private:
+    struct Entry;
+
+public:
+    // Held by the request that runs. complete() passes its response to every
+    // request that joined meanwhile and keeps it for later ones; dropping the
+    // run without completing it answers them with a 500.
+    class Run {
+    public:
+        Run(IdempotencyStore& store, std::string key, std::shared_ptr<Entry> entry)
+            : store_(store), key_(std::move(key)), entry_(std::move(entry)) {}
+        ~Run();
+        Run(const Run&) = delete;
+        Run& operator=(const Run&) = delete;
+
+        // Only the first call has any effect
+        void complete(Response response);
+
+        // For the upstream call: true once every request waiting on the key
+        // has disconnected
+        bool abandoned() const;
+
+    private:
+        IdempotencyStore& store_;
+        std::string key_;
+        std::shared_ptr<Entry> entry_;
+        std::atomic<bool> completed_{false};
+    };
+
+    explicit IdempotencyStore(Config config) : config_(config) {}
+
+    // key must already be scoped to the client (session) and route;
+    // fingerprint identifies the request's content. is_closed is this
+    // request's connection check. Outcome::Ran comes with the Run to
+    // complete. Otherwise deliver gets the response: straight away when
+    // Replayed, on the thread that completes the run when Joined. A
+    // Mismatch gets nothing.
+    std::pair<Outcome, std::shared_ptr<Run>> start(const std::string& key, const std::string& fingerprint,
+                                                   std::function<bool()> is_closed, Deliver deliver);
+
+    // Set before serving
+    void set_ttl_seconds(long seconds) { config_.ttl_seconds = seconds; }
+
+    // Outcome counters and the size of what is kept, as a JSON object
+    std::string stats_json() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Entry {
+        // mutex_ held
+        std::string fingerprint;
+        Result result;
+        bool done = false;
+        std::vector<Deliver> waiting;  // joined while it ran
+        Clock::time_point completed;
+        size_t bytes = 0;
+
+        std::mutex watchers_mutex;
+        std::vector<std::function<bool()>> watchers;  // connection checks of everyone waiting, while it runs
+
+        bool abandoned();
+        void watch(std::function<bool()> is_closed);
+    };
+
+    void finish(const std::string& key, const std::shared_ptr<Entry>& entry, Response response);
+
+    // mutex_ held
+    void evict(Clock::time_point now);
+
+    Config config_;
+
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<Entry>> entries_;
+    std::deque<std::pair<std::string, std::shared_ptr<Entry>>> kept_;  // oldest first
+    size_t kept_bytes_ = 0;
+
+    std::atomic<size_t> ran_{0};
+    std::atomic<size_t> joined_{0};
+    std::atomic<size_t> replayed_{0};
+    std::atomic<size_t> mismatched_{0};
+};
+
+}
@@ -0,0 +1,114 @@
+#include "response_cache.h"
+#include "../util/file_utils.h"
+#include "../util/hash.h"
+#include "../util/json.h"
+#include <cstdio>
+#include <cstdlib>
+
+namespace rpg {
+
+ResponseCache::ResponseCache(Config config) : config_(std::move(config)) {
+    file::make_dirs(config_.dir);
+}
+
+std::string ResponseCache::key_for(std::string_view request_body) {
+    return hash::digest128(request_body);
+}
+
+std::optional<std::string> ResponseCache::get(const std::string& key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = entries_.find(key);
+        if (it != entries_.end()) {
+            if (!expired(it->second.stored)) {
+                lru_.splice(lru_.begin(), lru_, it->second.lru);
+                ++memory_hits_;
+                return it->second.value;
+            }
+            lru_.erase(it->second.lru);
+            entries_.erase(it);
+        }
+    }
+
+    // "<unix time stored>\n<value>"
+    std::string data = file::read_file(path_for(key));
+    size_t newline = data.find('\n');
+    if (newline == std::string::npos) {
+        ++misses_;
+        return std::nullopt;
+    }
+    std::time_t stored = static_cast<std::time_t>(std::strtoll(data.c_str(), nullptr, 10));
+    if (expired(stored)) {
+        std::remove(path_for(key).c_str());
+        ++expired_;
+        ++misses_;
+        return std::nullopt;
+    }
+
+    std::string value = data.substr(newline + 1);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remember(key, value, stored);
+    }
+    ++disk_hits_;
+    return value;
+}
+
+void ResponseCache::put(const std::string& key, const std::string& value) {
+    std::time_t now = std::time(nullptr);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        remember(key, value, now);
+    }
+    file::write_file(path_for(key), std::to_string(static_cast<long long>(now)) + "\n" + value);
+}
+
+void ResponseCache::remember(const std::string& key, std::string value, std::time_t stored) {
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        it->second.value = std::move(value);
+        it->second.stored = stored;
+        lru_.splice(lru_.begin(), lru_, it->second.lru);
+        return;
+    }
+
+    lru_.push_front(key);
+    entries_.emplace(key, Entry{std::move(value), stored, lru_.begin()});
+    while (entries_.size() > config_.max_entries) {
+        entries_.erase(lru_.back());
+        lru_.pop_back();
+    }
+}
+
+bool ResponseCache::expired(std::time_t stored) const {
+    return config_.ttl_seconds > 0 && std::time(nullptr) - stored > config_.ttl_seconds;
+}
+
+std::string ResponseCache::path_for(const std::string& key) const {
+    return config_.dir + "/" + key;
+}
+
+std::string ResponseCache::stats_json() const {
+    size_t memory = memory_hits_.load(), disk = disk_hits_.load(), misses = misses_.load();
+    size_t lookups = memory + disk + misses;
+    size_t entries;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries = entries_.size();
+    }
+
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.kv_int("memoryHits", static_cast<int64_t>(memory));
+    j.kv_int("diskHits", static_cast<int64_t>(disk));
+    j.kv_int("misses", static_cast<int64_t>(misses));
+    j.kv_int("expired", static_cast<int64_t>(expired_.load()));
+    j.kv_int("bypassed", static_cast<int64_t>(bypassed_.load()));
+    j.kv_int("entries", static_cast<int64_t>(entries));
+    // Percent of lookups answered without calling upstream
+    j.kv_int("hitPercent", lookups ? static_cast<int64_t>((memory + disk) * 100 / lookups) : 0);
+    j.end_object();
+    return j.str();
+}
+
+}
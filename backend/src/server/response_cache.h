@@ -0,0 +1,68 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace rpg {
+
+// Content-addressed cache for LLM responses. The key is a hash of the full
+// upstream request body (model, max_tokens and every prompt byte), so any
+// change to the inputs is a different entry and nothing needs invalidating.
+// A bounded LRU sits in front of one file per entry under dir, which lets
+// entries outlive restarts.
+class ResponseCache {
+public:
+    struct Config {
+        std::string dir;
+        size_t max_entries = 512;  // in memory; disk is not bounded
+        long ttl_seconds = 0;      // 0 keeps entries forever
+    };
+
+    explicit ResponseCache(Config config);
+
+    // 128-bit hex digest of an upstream request body
+    static std::string key_for(std::string_view request_body);
+
+    std::optional<std::string> get(const std::string& key);
+    void put(const std::string& key, const std::string& value);
+
+    // Set before serving
+    void set_ttl_seconds(long seconds) { config_.ttl_seconds = seconds; }
+
+    // Counts a request that skipped the cache on purpose
+    void bypass() { ++bypassed_; }
+
+    // Hit, miss and size counters for the stats endpoint, as a JSON object
+    std::string stats_json() const;
+
+private:
+    struct Entry {
+        std::string value;
+        std::time_t stored = 0;
+        std::list<std::string>::iterator lru;
+    };
+
+    bool expired(std::time_t stored) const;
+    std::string path_for(const std::string& key) const;
+    void remember(const std::string& key, std::string value, std::time_t stored);  // mutex_ held
+
+    Config config_;
+
+    mutable std::mutex mutex_;
+    std::list<std::string> lru_;  // most recently used first
+    std::unordered_map<std::string, Entry> entries_;
+
+    std::atomic<size_t> memory_hits_{0};
+    std::atomic<size_t> disk_hits_{0};
+    std::atomic<size_t> misses_{0};
+    std::atomic<size_t> expired_{0};
+    std::atomic<size_t> bypassed_{0};
+};
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include "httplib.h"
+#include <string>
+#include <string_view>
+
+namespace rpg {
+
+// Body of a response that outlives its handler, such as server-sent events.
+// The connection layer sends the handler's status and headers, then each chunk
+// as it is written. Safe to use from any thread; writes never block.
+class ResponseStream {
+public:
+    virtual ~ResponseStream() = default;
+
+    // Commits the response to streaming; must be called before the handler returns
+    virtual void open(const std::string& content_type) = 0;
+
+    // Returns false (and drops the chunk) once the client has disconnected
+    virtual bool write(std::string_view chunk) = 0;
+
+    // Ends the body. Also happens when the last reference is dropped.
+    virtual void close() = 0;
+
+    virtual bool disconnected() const = 0;
+};
+
+// A whole response produced after its handler returns, e.g. once an upstream
+// call completes. The request keeps its connection until send() is called;
+// dropping the last reference without sending answers 500. Safe to use from
+// any thread.
+class DeferredResponse {
+public:
+    virtual ~DeferredResponse() = default;
+
+    // Only the first call has any effect
+    virtual void send(httplib::Response res) = 0;
+
+    virtual bool disconnected() const = 0;
+};
+
+}
@@ -0,0 +1,126 @@
+#include "router.h"
+#include <algorithm>
+#include <stdexcept>
+
+namespace rpg {
+
+namespace {
+    // Splits off the segment before the next '/'; rest is empty at the end of the path
+    std::string_view next_segment(std::string_view& rest) {
+        size_t slash = rest.find('/');
+        std::string_view segment = rest.substr(0, slash);
+        rest = slash == std::string_view::npos ? std::string_view() : rest.substr(slash + 1);
+        return segment;
+    }
+
+    std::string_view strip_root(std::string_view path) {
+        if (!path.empty() && path.front() == '/') path.remove_prefix(1);
+        return path;
+    }
+}
+
+struct Router::Node {
+    // Sorted by segment for binary search
+    std::vector<std::pair<std::string, std::unique_ptr<Node>>> literals;
+    std::unique_ptr<Node> param;
+    std::string param_name;
+    std::unique_ptr<Node> wildcard;
+
+    // Few methods share a path, so a linear scan beats hashing
+    std::vector<std::pair<std::string, size_t>> targets;
+
+    const Node* find_literal(std::string_view segment) const {
+        auto it = std::lower_bound(literals.begin(), literals.end(), segment,
+            [](const auto& entry, std::string_view s) { return entry.first < s; });
+        return it != literals.end() && it->first == segment ? it->second.get() : nullptr;
+    }
+
+    Node& literal(std::string_view segment) {
+        auto it = std::lower_bound(literals.begin(), literals.end(), segment,
+            [](const auto& entry, std::string_view s) { return entry.first < s; });
+        if (it == literals.end() || it->first != segment) {
+            it = literals.emplace(it, std::string(segment), std::make_unique<Node>());
+        }
+        return *it->second;
+    }
+
+    const size_t* target(std::string_view method) const {
+        for (const auto& [m, t] : targets) {
+            if (m == method) return &t;
+        }
+        return nullptr;
+    }
+};
+
+Router::Router() : root_(std::make_unique<Node>()) {}
+
+Router::~Router() = default;
+
+void Router::add(const std::string& method, std::string_view pattern, size_t target) {
+    Node* node = root_.get();
+    std::string_view rest = strip_root(pattern);
+    bool more = true;
+    while (more) {
+        more = rest.find('/') != std::string_view::npos;
+        std::string_view segment = next_segment(rest);
+
+        if (segment == "*") {
+            if (more) throw std::invalid_argument("'*' must end the route: " + std::string(pattern));
+            if (!node->wildcard) node->wildcard = std::make_unique<Node>();
+            node = node->wildcard.get();
+        } else if (!segment.empty() && segment.front() == ':') {
+            std::string_view name = segment.substr(1);
+            if (!node->param) {
+                node->param = std::make_unique<Node>();
+                node->param_name = std::string(name);
+            } else if (node->param_name != name) {
+                throw std::invalid_argument("Conflicting parameter name in route: " + std::string(pattern));
+            }
+            node = node->param.get();
+        } else {
+            node = &node->literal(segment);
+        }
+    }
+
+    if (node->target(method)) {
+        throw std::invalid_argument("Duplicate route: " + method + " " + std::string(pattern));
+    }
+    node->targets.emplace_back(method, target);
+}
+
+std::optional<size_t> Router::match(std::string_view method, std::string_view path, Params& params) const {
+    std::vector<std::pair<const Node*, std::string_view>> bound;
+    const size_t* target = match_node(*root_, strip_root(path), method, bound);
+    if (!target) return std::nullopt;
+
+    for (const auto& [owner, value] : bound) {
+        params[owner->param_name] = std::string(value);
+    }
+    return *target;
+}
+
+const size_t* Router::match_node(const Node& node, std::string_view rest, std::string_view method,
+                                 std::vector<std::pair<const Node*, std::string_view>>& bound) const {
+    std::string_view remaining = rest;
+    bool last = remaining.find('/') == std::string_view::npos;
+    std::string_view segment = next_segment(remaining);
+
+    // Literal first, then parameter, then wildcard; a branch that serves
+    // another method only falls through to the next one
+    if (const Node* child = node.find_literal(segment)) {
+        const size_t* found = last ? child->target(method) : match_node(*child, remaining, method, bound);
+        if (found) return found;
+    }
+
+    if (node.param && !segment.empty()) {
+        bound.emplace_back(&node, segment);
+        const Node* child = node.param.get();
+        const size_t* found = last ? child->target(method) : match_node(*child, remaining, method, bound);
+        if (found) return found;
+        bound.pop_back();
+    }
+
+    return node.wildcard ? node.wildcard->target(method) : nullptr;
+}
+
+}
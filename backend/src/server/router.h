@@ -0,0 +1,41 @@
+#pragma once
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace rpg {
+
+// Route table compiled into a trie of path segments. Patterns are literal
+// segments, ":name" parameters (one non-empty segment) and a trailing "*"
+// that matches the rest of the path, e.g. "/api/images/:category/:id".
+// Literal segments win over parameters, so "/api/roleplays/current" and
+// "/api/roleplays/:id" can coexist. Lookup walks the path once; no regex.
+class Router {
+public:
+    using Params = std::unordered_map<std::string, std::string>;
+
+    Router();
+    ~Router();
+
+    // Maps method + pattern to target; throws std::invalid_argument on a
+    // duplicate route or a parameter renamed at the same position
+    void add(const std::string& method, std::string_view pattern, size_t target);
+
+    // Fills params only when a route matches
+    std::optional<size_t> match(std::string_view method, std::string_view path, Params& params) const;
+
+private:
+    struct Node;
+
+    const size_t* match_node(const Node& node, std::string_view rest, std::string_view method,
+                             std::vector<std::pair<const Node*, std::string_view>>& bound) const;
+
+    std::unique_ptr<Node> root_;
+};
+
+}
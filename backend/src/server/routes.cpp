@@ -1,15 +1,34 @@
 #include "routes.h"
+#include "state_tool.h"
 #include "../util/json.h"
 #include "../util/file_utils.h"
+#include "../util/hash.h"
+#include "../util/tokens.h"
 #include <fstream>
 #include <algorithm>
+#include <shared_mutex>
 #include <random>
+#include <cstdio>
+#include <chrono>
 #include <ctime>
 #include <dirent.h>
 #include <sys/stat.h>
 
 namespace rpg {
 
+namespace {
+    std::string sse_event(std::string_view event, std::string_view json_data) {
+        std::string out;
+        out.reserve(event.size() + json_data.size() + 16);
+        out += "event: ";
+        out += event;
+        out += "\ndata: ";
+        out += json_data;
+        out += "\n\n";
+        return out;
+    }
+}
+
 Routes::Routes() {
     // Ensure campaigns directory exists
     mkdir(CAMPAIGNS_DIR, 0755);
@@ -30,27 +49,110 @@ Routes::Routes() {
 
     if (active_id.empty()) {
         // No roleplays exist - create a default one
-        active_id = generate_roleplay_id();
-        std::string dir = roleplay_dir(active_id);
-        context_ = std::make_unique<ContextManager>(dir);
-        context_->init_new_campaign("New Roleplay", "Player", "Participant");
-
-        // Save to index
-        RoleplayInfo info = read_roleplay_metadata(active_id);
-        info.id = active_id;
-        roleplays.push_back(info);
-        save_roleplays_index(roleplays);
-    } else {
-        load_roleplay(active_id);
+        active_id = create_campaign("New Roleplay", "Player", "Participant")->id;
     }
+
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    default_roleplay_id_ = active_id;
+    save_roleplays_index(read_roleplays_index());
 }
 
 void Routes::set_cors_headers(httplib::Response& res) {
     res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Access-Control-Expose-Headers", std::string(SESSION_HEADER) + ", " + REPLAYED_HEADER);
     res.set_header("Content-Type", "application/json");
 }
 
-std::string Routes::build_character_json(const Character& c) const {
+// Reply of the request that runs under an Idempotency-Key: its response is
+// stored (and passed to retries waiting on it) on the way to the client
+class Routes::IdempotentReply final : public DeferredResponse {
+public:
+    // session_headers: Set-Cookie and the session header when the
+    // session was issued for this request, which the handler does not see
+    IdempotentReply(std::shared_ptr<IdempotencyStore::Run> run, std::shared_ptr<DeferredResponse> reply,
+                    httplib::Headers session_headers)
+        : run_(std::move(run)), reply_(std::move(reply)), session_headers_(std::move(session_headers)) {}
+
+    void send(httplib::Response res) override {
+        if (sent_.exchange(true)) return;
+        IdempotencyStore::Response stored;
+        stored.status = res.status < 0 ? 200 : res.status;
+        stored.body = res.body;
+        for (const auto& [name, value] : res.headers) {
+            if (name == "Content-Type") stored.content_type = value;
+            else if (name != "Set-Cookie" && name != SESSION_HEADER) stored.headers.emplace_back(name, value);
+        }
+        run_->complete(std::move(stored));
+        for (const auto& [name, value] : session_headers_) {
+            if (!res.has_header(name)) res.set_header(name, value);
+        }
+        reply_->send(std::move(res));
+    }
+
+    // The upstream call is only cancelled once the retries are gone too
+    bool disconnected() const override { return run_->abandoned(); }
+
+private:
+    std::shared_ptr<IdempotencyStore::Run> run_;
+    std::shared_ptr<DeferredResponse> reply_;
+    httplib::Headers session_headers_;
+    std::atomic<bool> sent_{false};
+};
+
+void Routes::idempotent(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                        const AsyncHandler& handler) {
+    std::string key = req.get_header_value(IDEMPOTENCY_HEADER);
+    if (key.empty()) {
+        handler(req, std::move(reply));
+        return;
+    }
+
+    auto res = std::make_shared<httplib::Response>();
+    set_cors_headers(*res);
+    if (key.size() > MAX_IDEMPOTENCY_KEY) {
+        res->status = 400;
+        res->set_content(R"({"error":"Idempotency-Key is too long"})", "application/json");
+        reply->send(std::move(*res));
+        return;
+    }
+
+    // Keys only need to be unique per client, so they are scoped to the session
+    std::string session = resolve_session(req, *res);
+    std::string scope = session + " " + req.method + " " + req.path + " " + key;
+    auto [outcome, run] = idempotency_.start(scope, hash::digest128(req.body), req.is_connection_closed,
+        [reply, res](IdempotencyStore::Result result) {
+            for (const auto& [name, value] : result->headers) {
+                if (!res->has_header(name)) res->set_header(name, value);
+            }
+            res->set_header(REPLAYED_HEADER, "true");
+            res->status = result->status;
+            res->set_content(result->body, result->content_type.empty() ? "application/json" : result->content_type);
+            reply->send(std::move(*res));
+        });
+
+    if (outcome == IdempotencyStore::Outcome::Mismatch) {
+        res->status = 422;
+        res->set_content(R"({"error":"Idempotency-Key was already used for a different request"})",
+                         "application/json");
+        reply->send(std::move(*res));
+        return;
+    }
+    if (outcome != IdempotencyStore::Outcome::Ran) return;
+
+    // The handler resolves the session again; hand it the one resolved (and
+    // maybe just issued) here rather than letting it issue a second
+    httplib::Request first = req;
+    first.is_connection_closed = [run = run] { return run->abandoned(); };
+    first.headers.erase(SESSION_HEADER);
+    first.set_header(SESSION_HEADER, session);
+    httplib::Headers issued;
+    for (const auto& [name, value] : res->headers) {
+        if (name == "Set-Cookie" || name == SESSION_HEADER) issued.emplace(name, value);
+    }
+    handler(first, std::make_shared<IdempotentReply>(run, std::move(reply), std::move(issued)));
+}
+
+std::string Routes::build_character_json(const CampaignSnapshot& snap, const Character& c) const {
     json::JsonBuilder j;
     j.begin_object();
     j.kv_string("id", c.id);
@@ -65,7 +167,7 @@ std::string Routes::build_character_json(const Character& c) const {
     j.kv_string("doesntKnow", c.doesnt_know);
     j.kv_string("imagePath", c.image_path);
     // Add image URL if exists
-    std::string img_path = context_->get_image_path("characters", c.id);
+    std::string img_path = snap.image_path("characters", c.id);
     if (!img_path.empty()) {
         j.kv_string("imageUrl", "/api/images/characters/" + c.id);
     }
@@ -73,7 +175,7 @@ std::string Routes::build_character_json(const Character& c) const {
     return j.str();
 }
 
-std::string Routes::build_location_json(const Location& loc) const {
+std::string Routes::build_location_json(const CampaignSnapshot& snap, const Location& loc) const {
     json::JsonBuilder j;
     j.begin_object();
     j.kv_string("id", loc.id);
@@ -85,7 +187,7 @@ std::string Routes::build_location_json(const Location& loc) const {
     j.kv_string("notableFeatures", loc.notable_features);
     j.kv_string("npcsPresent", loc.npcs_present);
     j.kv_string("imagePath", loc.image_path);
-    std::string img_path = context_->get_image_path("locations", loc.id);
+    std::string img_path = snap.image_path("locations", loc.id);
     if (!img_path.empty()) {
         j.kv_string("imageUrl", "/api/images/locations/" + loc.id);
     }
@@ -123,62 +225,205 @@ Location Routes::parse_location_json(std::string_view json_str) const {
     return loc;
 }
 
-void Routes::handle_message(const httplib::Request& req, httplib::Response& res) {
-    set_cors_headers(res);
+void Routes::handle_message(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                            AdmissionControl::Permit permit) {
+    auto res = std::make_shared<httplib::Response>();
+    set_cors_headers(*res);
 
     auto message = json::extract_string(req.body, "message");
     if (message.empty()) {
-        res.status = 400;
-        res.set_content(R"({"error":"Missing message"})", "application/json");
+        res->status = 400;
+        res->set_content(R"({"error":"Missing message"})", "application/json");
+        reply->send(std::move(*res));
         return;
     }
 
-    std::string system_prompt = context_->get_system_prompt();
-    std::string context = context_->build_full_context();
-    std::string full_prompt = system_prompt + "\n\n" + context + "\n\nPlayer says: " + std::string(message);
-
-    auto response = claude_.send_message(system_prompt, full_prompt);
+    auto campaign = session_campaign(req, *res);
+
+    UpstreamTag tag = upstream_tag(req, *res, Priority::Interactive);
+
+    // Starts once earlier turns in this campaign are done, so the context
+    // includes their updates; until then the request only sits in the queue
+    campaign->turns.begin([this, reply, res, permit, campaign, tag, closed = req.is_connection_closed,
+                           message = std::string(message)](TurnSequencer::Turn started) {
+        auto turn = std::make_shared<TurnSequencer::Turn>(std::move(started));
+        campaign->refresh();
+        auto prompt = std::make_shared<Prompt>(build_turn_prompt(*campaign, message));
+        if (two_phase_turns_) prepare_narrative_phase(*prompt);
+
+        // A player who leaves mid-turn aborts the upstream call; the failed
+        // response below then skips the commit
+        claude_.send_message_async(*prompt,
+            [this, reply, res, permit, campaign, turn, prompt, tag, message,
+             pending = track_pending()](ClaudeResponse response) {
+                // The commit takes the campaign lock and writes files, and
+                // finishing the turn starts the next one on this thread
+                defer([this, reply, res, permit, campaign, turn, prompt, tag, message, pending,
+                       response = std::move(response)] {
+                    record_usage(response);
+
+                    if (!response.success) {
+                        turn->finish();
+                        res->status = 500;
+                        json::JsonBuilder err;
+                        err.begin_object();
+                        err.kv_string("error", response.error);
+                        err.end_object();
+                        res->set_content(err.str(), "application/json");
+                        reply->send(std::move(*res));
+                        return;
+                    }
+
+                    // A two-phase turn's updates come with the bookkeeping
+                    // call, after this reply
+                    std::string narrative;
+                    bool pending = two_phase_turns_ && needs_bookkeeping(response);
+                    if (two_phase_turns_) {
+                        narrative = finish_narrative_phase(campaign, message, response, *prompt, turn, tag);
+                    } else {
+                        narrative = commit_turn(*campaign, message, response);
+                        turn->finish();
+                    }
+
+                    json::JsonBuilder result;
+                    result.begin_object();
+                    result.kv_string("narrative", narrative);
+                    result.key("playerState");
+                    result.value_raw(pending ? R"({"updated":false,"pending":true})" : R"({"updated":true})");
+                    result.end_object();
+
+                    res->set_content(result.str(), "application/json");
+                    reply->send(std::move(*res));
+                });
+            },
+            closed, tag);
+    });
+}
 
-    if (!response.success) {
-        res.status = 500;
-        json::JsonBuilder err;
-        err.begin_object();
-        err.kv_string("error", response.error);
-        err.end_object();
-        res.set_content(err.str(), "application/json");
+void Routes::handle_message_stream(const httplib::Request& req, httplib::Response& res,
+                                   std::shared_ptr<ResponseStream> stream,
+                                   AdmissionControl::Permit permit) {
+    auto message = json::extract_string(req.body, "message");
+    if (message.empty()) {
+        set_cors_headers(res);
+        res.status = 400;
+        res.set_content(R"({"error":"Missing message"})", "application/json");
         return;
     }
 
-    std::string narrative = parser_.extract_narrative(response.content);
-    auto updates = parser_.extract_updates(response.content);
-    context_->apply_updates(updates);
-    context_->append_history(std::string(message), narrative);
+    auto campaign = session_campaign(req, res);
 
-    json::JsonBuilder result;
-    result.begin_object();
-    result.kv_string("narrative", narrative);
-    result.key("playerState");
-    result.value_raw(R"({"updated":true})");
-    result.end_object();
+    UpstreamTag tag = upstream_tag(req, res, Priority::Interactive);
 
-    res.set_content(result.str(), "application/json");
+    res.set_header("Access-Control-Allow-Origin", "*");
+    res.set_header("Access-Control-Expose-Headers", SESSION_HEADER);
+    res.set_header("Cache-Control", "no-cache");
+    stream->open("text/event-stream");
+
+    // Starts once earlier turns in this campaign are done; the turn is held
+    // until it is committed or abandoned by the client
+    campaign->turns.begin([this, stream, campaign, permit, tag,
+                           message = std::string(message)](TurnSequencer::Turn started) {
+        auto turn = std::make_shared<TurnSequencer::Turn>(std::move(started));
+        // Left while queued: nothing to build or send
+        if (stream->disconnected()) return;
+
+        campaign->refresh();
+        Prompt prompt = build_turn_prompt(*campaign, message);
+        if (two_phase_turns_) prepare_narrative_phase(prompt);
+
+        // Both callbacks run on the HTTP client's event loop, never concurrently
+        auto filter = std::make_shared<NarrativeStream>();
+        // The narrator prompt is kept for the bookkeeping call of a two-phase turn
+        auto narrator_prompt = std::make_shared<Prompt>(prompt);
+        claude_.stream_message(prompt,
+            [stream, filter](std::string_view text) {
+                std::string narrative = filter->feed(text);
+                if (!narrative.empty()) {
+                    json::JsonBuilder token(narrative.size() + 16);
+                    token.begin_object();
+                    token.kv_string("text", narrative);
+                    token.end_object();
+                    return stream->write(sse_event("token", token.str()));
+                }
+                return !stream->disconnected();
+            },
+            [this, stream, campaign, turn, permit, narrator_prompt, tag, message,
+             pending = track_pending()](ClaudeResponse response) {
+                // The commit takes the campaign lock and writes files, and
+                // finishing the turn starts the next one on this thread
+                defer([this, stream, campaign, turn, permit, narrator_prompt, tag, message, pending,
+                       response = std::move(response)] {
+                    record_usage(response);
+                    // Client went away: the turn is abandoned and not persisted
+                    if (stream->disconnected()) {
+                        turn->finish();
+                        return;
+                    }
+
+                    json::JsonBuilder payload;
+                    payload.begin_object();
+                    if (response.success) {
+                        // Updates are applied once the whole response is in.
+                        // A two-phase turn's come later: the stream stays open
+                        // for a "state" event once they are on disk.
+                        // The bookkeeping call may finish on another worker
+                        // before "done" is out; order keeps "state" after it.
+                        std::string narrative;
+                        bool pending = two_phase_turns_ && needs_bookkeeping(response);
+                        auto order = std::make_shared<std::mutex>();
+                        std::unique_lock<std::mutex> done_first(*order);
+                        if (two_phase_turns_) {
+                            narrative = finish_narrative_phase(campaign, message, response,
+                                                               std::move(*narrator_prompt), turn, tag,
+                                [stream, order](bool updated) {
+                                    std::lock_guard<std::mutex> after_done(*order);
+                                    stream->write(sse_event("state", updated ? R"({"updated":true})"
+                                                                             : R"({"updated":false})"));
+                                    stream->close();
+                                });
+                        } else {
+                            narrative = commit_turn(*campaign, message, response);
+                            turn->finish();
+                        }
+                        payload.kv_string("narrative", narrative);
+                        payload.key("playerState");
+                        payload.value_raw(pending ? R"({"updated":false,"pending":true})" : R"({"updated":true})");
+                        payload.end_object();
+                        stream->write(sse_event("done", payload.str()));
+                        if (pending) return;
+                    } else {
+                        turn->finish();
+                        payload.kv_string("error", response.error);
+                        payload.end_object();
+                        stream->write(sse_event("error", payload.str()));
+                    }
+                    stream->close();
+                });
+            },
+            [stream] { return stream->disconnected(); }, tag);
+    });
 }
 
-void Routes::handle_get_player(const httplib::Request&, httplib::Response& res) {
+void Routes::handle_get_player(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
-    std::string player_md = context_->get_player_state();
+    auto campaign = session_campaign(req, res);
+    auto snap = campaign->context.snapshot();
 
-    json::JsonBuilder result;
-    result.begin_object();
-    result.kv_string("content", player_md);
-    // Add image URL if exists
-    std::string img_path = context_->get_image_path("player", "avatar");
-    if (!img_path.empty()) {
-        result.kv_string("imageUrl", "/api/images/player/avatar");
-    }
-    result.end_object();
+    auto body = reads_.run(read_key(campaign->id, *snap, "player"), [&snap] {
+        json::JsonBuilder result;
+        result.begin_object();
+        result.kv_string("content", snap->player);
+        // Add image URL if exists
+        std::string img_path = snap->image_path("player", "avatar");
+        if (!img_path.empty()) {
+            result.kv_string("imageUrl", "/api/images/player/avatar");
+        }
+        result.end_object();
+        return std::move(result.str());
+    });
 
-    res.set_content(result.str(), "application/json");
+    set_shared_content(res, std::move(body));
 }
 
 void Routes::handle_update_player(const httplib::Request& req, httplib::Response& res) {
@@ -191,7 +436,9 @@ void Routes::handle_update_player(const httplib::Request& req, httplib::Response
         return;
     }
 
-    context_->save_player_state(std::string(content));
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    campaign->context.save_player_state(std::string(content));
     res.set_content(R"({"success":true})", "application/json");
 }
 
@@ -207,7 +454,9 @@ void Routes::handle_add_note(const httplib::Request& req, httplib::Response& res
 
     std::vector<ContextUpdate> updates;
     updates.push_back({"player.md", "\n- " + std::string(note)});
-    context_->apply_updates(updates);
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    campaign->context.apply_updates(updates);
 
     res.set_content(R"({"success":true})", "application/json");
 }
@@ -225,7 +474,12 @@ void Routes::handle_player_image(const httplib::Request& req, httplib::Response&
     }
 
     std::string mime = mime_type.empty() ? "image/png" : std::string(mime_type);
-    bool saved = context_->save_image("player", "avatar", std::string(image_data), mime);
+    auto campaign = session_campaign(req, res);
+    bool saved;
+    {
+        Campaign::WriteLock lock(*campaign);
+        saved = campaign->context.save_image("player", "avatar", std::string(image_data), mime);
+    }
 
     if (saved) {
         json::JsonBuilder result;
@@ -253,24 +507,21 @@ void Routes::handle_new_campaign(const httplib::Request& req, httplib::Response&
     }
 
     // Update lastPlayed on current roleplay before creating new
-    if (context_) {
-        context_->update_last_played();
-    }
+    touch_last_played(session_campaign(req, res));
 
     // Create new roleplay
-    std::string new_id = generate_roleplay_id();
-    std::string dir = roleplay_dir(new_id);
-    context_ = std::make_unique<ContextManager>(dir);
-    context_->init_new_campaign(
+    std::string new_id = create_campaign(
         campaign_name.empty() ? "New Roleplay" : std::string(campaign_name),
         player_name.empty() ? "Player" : std::string(player_name),
         player_role.empty() ? "Participant" : std::string(player_role)
-    );
-    current_roleplay_id_ = new_id;
+    )->id;
 
-    // Update index
-    auto roleplays = read_roleplays_index();
-    save_roleplays_index(roleplays);
+    // Switch this session only, then record the new roleplay in the index
+    sessions_.set_active_roleplay(resolve_session(req, res), new_id);
+    {
+        std::lock_guard<std::mutex> lock(index_mutex_);
+        save_roleplays_index(read_roleplays_index());
+    }
 
     // Return the new roleplay info
     RoleplayInfo info = read_roleplay_metadata(new_id);
@@ -283,46 +534,51 @@ void Routes::handle_new_campaign(const httplib::Request& req, httplib::Response&
     res.set_content(result.str(), "application/json");
 }
 
-void Routes::handle_get_history(const httplib::Request&, httplib::Response& res) {
+void Routes::handle_get_history(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
-    std::string history = context_->get_history();
+    auto campaign = session_campaign(req, res);
+    std::shared_lock<std::shared_mutex> lock(campaign->mutex);
+    std::string history = campaign->context.get_history();
     if (history.empty()) history = "[]";
     res.set_content(history, "application/json");
 }
 
 // Characters CRUD
 
-void Routes::handle_get_characters(const httplib::Request&, httplib::Response& res) {
+void Routes::handle_get_characters(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string md = context_->get_characters();
-    auto chars = md_parser_.parse_characters(md);
+    auto campaign = session_campaign(req, res);
+    auto snap = campaign->context.snapshot();
 
-    json::JsonBuilder result;
-    result.begin_array();
-    for (const auto& c : chars) {
-        result.value_raw(build_character_json(c));
-    }
-    result.end_array();
+    auto body = reads_.run(read_key(campaign->id, *snap, "characters"), [this, &snap] {
+        json::JsonBuilder result;
+        result.begin_array();
+        for (const auto& c : snap->characters) {
+            result.value_raw(build_character_json(*snap, c));
+        }
+        result.end_array();
+        return std::move(result.str());
+    });
 
-    res.set_content(result.str(), "application/json");
+    set_shared_content(res, std::move(body));
 }
 
 void Routes::handle_get_character(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_characters();
-    auto chars = md_parser_.parse_characters(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    auto snap = campaign->context.snapshot();
 
-    auto found = md_parser_.find_character(chars, id);
+    auto found = md_parser_.find_character(snap->characters, id);
     if (!found) {
         res.status = 404;
         res.set_content(R"({"error":"Character not found"})", "application/json");
         return;
     }
 
-    res.set_content(build_character_json(*found), "application/json");
+    res.set_content(build_character_json(*snap, *found), "application/json");
 }
 
 void Routes::handle_create_character(const httplib::Request& req, httplib::Response& res) {
@@ -335,8 +591,10 @@ void Routes::handle_create_character(const httplib::Request& req, httplib::Respo
         return;
     }
 
-    std::string md = context_->get_characters();
-    auto chars = md_parser_.parse_characters(md);
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto chars = ctx.snapshot()->characters;
 
     // Check for duplicate
     if (md_parser_.find_character(chars, c.id)) {
@@ -346,17 +604,19 @@ void Routes::handle_create_character(const httplib::Request& req, httplib::Respo
     }
 
     chars.push_back(c);
-    context_->save_characters(md_parser_.serialize_characters(chars));
+    ctx.save_characters(md_parser_.serialize_characters(chars));
 
-    res.set_content(build_character_json(c), "application/json");
+    res.set_content(build_character_json(*ctx.snapshot(), c), "application/json");
 }
 
 void Routes::handle_update_character(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_characters();
-    auto chars = md_parser_.parse_characters(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto chars = ctx.snapshot()->characters;
 
     auto it = std::find_if(chars.begin(), chars.end(),
                            [&id](const Character& c) { return c.id == id; });
@@ -372,16 +632,18 @@ void Routes::handle_update_character(const httplib::Request& req, httplib::Respo
     if (updated.name.empty()) updated.name = it->name;
     *it = updated;
 
-    context_->save_characters(md_parser_.serialize_characters(chars));
-    res.set_content(build_character_json(updated), "application/json");
+    ctx.save_characters(md_parser_.serialize_characters(chars));
+    res.set_content(build_character_json(*ctx.snapshot(), updated), "application/json");
 }
 
 void Routes::handle_delete_character(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_characters();
-    auto chars = md_parser_.parse_characters(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto chars = ctx.snapshot()->characters;
 
     auto it = std::find_if(chars.begin(), chars.end(),
                            [&id](const Character& c) { return c.id == id; });
@@ -393,44 +655,47 @@ void Routes::handle_delete_character(const httplib::Request& req, httplib::Respo
     }
 
     chars.erase(it);
-    context_->save_characters(md_parser_.serialize_characters(chars));
+    ctx.save_characters(md_parser_.serialize_characters(chars));
 
     res.set_content(R"({"success":true})", "application/json");
 }
 
 // Locations CRUD
 
-void Routes::handle_get_locations(const httplib::Request&, httplib::Response& res) {
+void Routes::handle_get_locations(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string md = context_->get_locations();
-    auto locs = md_parser_.parse_locations(md);
+    auto campaign = session_campaign(req, res);
+    auto snap = campaign->context.snapshot();
 
-    json::JsonBuilder result;
-    result.begin_array();
-    for (const auto& loc : locs) {
-        result.value_raw(build_location_json(loc));
-    }
-    result.end_array();
+    auto body = reads_.run(read_key(campaign->id, *snap, "locations"), [this, &snap] {
+        json::JsonBuilder result;
+        result.begin_array();
+        for (const auto& loc : snap->locations) {
+            result.value_raw(build_location_json(*snap, loc));
+        }
+        result.end_array();
+        return std::move(result.str());
+    });
 
-    res.set_content(result.str(), "application/json");
+    set_shared_content(res, std::move(body));
 }
 
 void Routes::handle_get_location(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_locations();
-    auto locs = md_parser_.parse_locations(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    auto snap = campaign->context.snapshot();
 
-    auto found = md_parser_.find_location(locs, id);
+    auto found = md_parser_.find_location(snap->locations, id);
     if (!found) {
         res.status = 404;
         res.set_content(R"({"error":"Location not found"})", "application/json");
         return;
     }
 
-    res.set_content(build_location_json(*found), "application/json");
+    res.set_content(build_location_json(*snap, *found), "application/json");
 }
 
 void Routes::handle_create_location(const httplib::Request& req, httplib::Response& res) {
@@ -443,8 +708,10 @@ void Routes::handle_create_location(const httplib::Request& req, httplib::Respon
         return;
     }
 
-    std::string md = context_->get_locations();
-    auto locs = md_parser_.parse_locations(md);
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto locs = ctx.snapshot()->locations;
 
     if (md_parser_.find_location(locs, loc.id)) {
         res.status = 409;
@@ -453,17 +720,19 @@ void Routes::handle_create_location(const httplib::Request& req, httplib::Respon
     }
 
     locs.push_back(loc);
-    context_->save_locations(md_parser_.serialize_locations(locs));
+    ctx.save_locations(md_parser_.serialize_locations(locs));
 
-    res.set_content(build_location_json(loc), "application/json");
+    res.set_content(build_location_json(*ctx.snapshot(), loc), "application/json");
 }
 
 void Routes::handle_update_location(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_locations();
-    auto locs = md_parser_.parse_locations(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto locs = ctx.snapshot()->locations;
 
     auto it = std::find_if(locs.begin(), locs.end(),
                            [&id](const Location& l) { return l.id == id; });
@@ -479,16 +748,18 @@ void Routes::handle_update_location(const httplib::Request& req, httplib::Respon
     if (updated.name.empty()) updated.name = it->name;
     *it = updated;
 
-    context_->save_locations(md_parser_.serialize_locations(locs));
-    res.set_content(build_location_json(updated), "application/json");
+    ctx.save_locations(md_parser_.serialize_locations(locs));
+    res.set_content(build_location_json(*ctx.snapshot(), updated), "application/json");
 }
 
 void Routes::handle_delete_location(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
-    std::string md = context_->get_locations();
-    auto locs = md_parser_.parse_locations(md);
+    std::string id = req.path_params.at("id");
+    auto campaign = session_campaign(req, res);
+    Campaign::WriteLock lock(*campaign);
+    ContextManager& ctx = campaign->context;
+    auto locs = ctx.snapshot()->locations;
 
     auto it = std::find_if(locs.begin(), locs.end(),
                            [&id](const Location& l) { return l.id == id; });
@@ -500,211 +771,460 @@ void Routes::handle_delete_location(const httplib::Request& req, httplib::Respon
     }
 
     locs.erase(it);
-    context_->save_locations(md_parser_.serialize_locations(locs));
+    ctx.save_locations(md_parser_.serialize_locations(locs));
 
     res.set_content(R"({"success":true})", "application/json");
 }
 
 // AI Generation
 
-void Routes::handle_generate_character(const httplib::Request& req, httplib::Response& res) {
-    set_cors_headers(res);
+namespace {
+    constexpr const char* GENERATOR_SYSTEM_PROMPT = "You are a creative writing assistant.";
 
-    auto name = json::extract_string(req.body, "name");
+    std::string character_prompt(std::string_view name, std::string_view existing,
+                                 const std::string& world_context) {
+        std::string prompt = "Generate detailed content for a character in an interactive fiction story.\n\n";
+        prompt += "Character name: " + std::string(name) + "\n\n";
 
-    if (name.empty()) {
-        res.status = 400;
-        res.set_content(R"({"error":"Missing character name"})", "application/json");
-        return;
-    }
+        // Include any existing data
+        if (!existing.empty()) {
+            prompt += "Existing character details:\n" + std::string(existing) + "\n\n";
+        }
 
-    // Build prompt for Claude to generate character details
-    std::string prompt = "Generate detailed content for a character in an interactive fiction story.\n\n";
-    prompt += "Character name: " + std::string(name) + "\n\n";
+        // Include world context
+        if (!world_context.empty()) {
+            prompt += "Current world context:\n" + world_context + "\n\n";
+        }
 
-    // Include any existing data
-    auto existing = json::extract_string(req.body, "existing");
-    if (!existing.empty()) {
-        prompt += "Existing character details:\n" + std::string(existing) + "\n\n";
+        prompt += "Generate the following sections in a creative, detailed way. ";
+        prompt += "Format each section exactly as shown:\n\n";
+        prompt += "[APPEARANCE]\nDescribe physical appearance in 2-3 sentences.\n[/APPEARANCE]\n\n";
+        prompt += "[BACKGROUND]\nWrite a brief backstory in 2-3 sentences.\n[/BACKGROUND]\n\n";
+        prompt += "[MOTIVATIONS]\nList 2-3 key motivations as bullet points.\n[/MOTIVATIONS]\n\n";
+        prompt += "[PERSONALITY]\nDescribe personality traits in 2-3 sentences.\n[/PERSONALITY]\n";
+        return prompt;
     }
 
-    // Include world context
-    std::string world_context = file::read_file(context_->campaign_dir() + "/context.md");
-    if (!world_context.empty()) {
-        prompt += "Current world context:\n" + world_context + "\n\n";
-    }
+    std::string location_prompt(std::string_view name, std::string_view existing,
+                                const std::string& world_context) {
+        std::string prompt = "Generate detailed content for a location in an interactive fiction story.\n\n";
+        prompt += "Location name: " + std::string(name) + "\n\n";
 
-    prompt += "Generate the following sections in a creative, detailed way. ";
-    prompt += "Format each section exactly as shown:\n\n";
-    prompt += "[APPEARANCE]\nDescribe physical appearance in 2-3 sentences.\n[/APPEARANCE]\n\n";
-    prompt += "[BACKGROUND]\nWrite a brief backstory in 2-3 sentences.\n[/BACKGROUND]\n\n";
-    prompt += "[MOTIVATIONS]\nList 2-3 key motivations as bullet points.\n[/MOTIVATIONS]\n\n";
-    prompt += "[PERSONALITY]\nDescribe personality traits in 2-3 sentences.\n[/PERSONALITY]\n";
+        if (!existing.empty()) {
+            prompt += "Existing location details:\n" + std::string(existing) + "\n\n";
+        }
 
-    auto response = claude_.send_message("You are a creative writing assistant.", prompt);
+        if (!world_context.empty()) {
+            prompt += "Current world context:\n" + world_context + "\n\n";
+        }
 
-    if (!response.success) {
-        res.status = 500;
-        json::JsonBuilder err;
-        err.begin_object();
-        err.kv_string("error", response.error);
-        err.end_object();
-        res.set_content(err.str(), "application/json");
-        return;
+        prompt += "Generate the following sections in a creative, detailed way. ";
+        prompt += "Format each section exactly as shown:\n\n";
+        prompt += "[DESCRIPTION]\nDescribe the location in 2-3 vivid sentences.\n[/DESCRIPTION]\n\n";
+        prompt += "[ATMOSPHERE]\nDescribe the sensory experience (sights, sounds, smells) in 2-3 sentences.\n[/ATMOSPHERE]\n\n";
+        prompt += "[NOTABLE_FEATURES]\nList 3-4 interesting features as bullet points.\n[/NOTABLE_FEATURES]\n";
+        return prompt;
     }
 
-    // Parse generated content
-    auto extract_section = [&](const std::string& tag) -> std::string {
+    std::string extract_section(const std::string& text, const std::string& tag) {
         std::string start_tag = "[" + tag + "]";
         std::string end_tag = "[/" + tag + "]";
-        size_t start = response.content.find(start_tag);
+        size_t start = text.find(start_tag);
         if (start == std::string::npos) return "";
         start += start_tag.size();
-        size_t end = response.content.find(end_tag, start);
+        size_t end = text.find(end_tag, start);
         if (end == std::string::npos) return "";
-        std::string content = response.content.substr(start, end - start);
+        std::string content = text.substr(start, end - start);
         // Trim whitespace
         while (!content.empty() && (content.front() == '\n' || content.front() == ' '))
             content.erase(0, 1);
         while (!content.empty() && (content.back() == '\n' || content.back() == ' '))
             content.pop_back();
         return content;
-    };
+    }
 
-    json::JsonBuilder result;
-    result.begin_object();
-    result.kv_string("appearance", extract_section("APPEARANCE"));
-    result.kv_string("background", extract_section("BACKGROUND"));
-    result.kv_string("motivations", extract_section("MOTIVATIONS"));
-    result.kv_string("personality", extract_section("PERSONALITY"));
-    result.end_object();
+    Character generated_character(std::string_view name, const std::string& text) {
+        Character c;
+        c.name = std::string(name);
+        c.id = MarkdownParser::to_id(name);
+        c.appearance = extract_section(text, "APPEARANCE");
+        c.background = extract_section(text, "BACKGROUND");
+        c.motivations = extract_section(text, "MOTIVATIONS");
+        c.personality = extract_section(text, "PERSONALITY");
+        return c;
+    }
 
-    res.set_content(result.str(), "application/json");
+    Location generated_location(std::string_view name, const std::string& text) {
+        Location loc;
+        loc.name = std::string(name);
+        loc.id = MarkdownParser::to_id(name);
+        loc.description = extract_section(text, "DESCRIPTION");
+        loc.atmosphere = extract_section(text, "ATMOSPHERE");
+        loc.notable_features = extract_section(text, "NOTABLE_FEATURES");
+        return loc;
+    }
+
+    void write_generated_fields(json::JsonBuilder& out, const Character& c) {
+        out.kv_string("appearance", c.appearance);
+        out.kv_string("background", c.background);
+        out.kv_string("motivations", c.motivations);
+        out.kv_string("personality", c.personality);
+    }
+
+    void write_generated_fields(json::JsonBuilder& out, const Location& loc) {
+        out.kv_string("description", loc.description);
+        out.kv_string("atmosphere", loc.atmosphere);
+        out.kv_string("notableFeatures", loc.notable_features);
+    }
+
+    void set_error(httplib::Response& res, const std::string& error) {
+        res.status = 500;
+        json::JsonBuilder err;
+        err.begin_object();
+        err.kv_string("error", error);
+        err.end_object();
+        res.set_content(err.str(), "application/json");
+    }
 }
 
-void Routes::handle_generate_location(const httplib::Request& req, httplib::Response& res) {
-    set_cors_headers(res);
+void Routes::handle_generate_character(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                                       AdmissionControl::Permit permit) {
+    auto res = std::make_shared<httplib::Response>();
+    set_cors_headers(*res);
 
-    auto name = json::extract_string(req.body, "name");
+    std::string name = json::unescape(json::extract_string(req.body, "name"));
 
     if (name.empty()) {
-        res.status = 400;
-        res.set_content(R"({"error":"Missing location name"})", "application/json");
+        res->status = 400;
+        res->set_content(R"({"error":"Missing character name"})", "application/json");
+        reply->send(std::move(*res));
         return;
     }
 
-    std::string prompt = "Generate detailed content for a location in an interactive fiction story.\n\n";
-    prompt += "Location name: " + std::string(name) + "\n\n";
+    std::string world_context = session_campaign(req, *res)->context.snapshot()->context;
+    std::string existing = json::unescape(json::extract_string(req.body, "existing"));
+    generate_cached(req, *res, character_prompt(name, existing, world_context),
+        [reply, res, permit, name](ClaudeResponse response) {
+            if (!response.success) {
+                set_error(*res, response.error);
+                reply->send(std::move(*res));
+                return;
+            }
 
-    auto existing = json::extract_string(req.body, "existing");
-    if (!existing.empty()) {
-        prompt += "Existing location details:\n" + std::string(existing) + "\n\n";
-    }
+            json::JsonBuilder result;
+            result.begin_object();
+            write_generated_fields(result, generated_character(name, response.content));
+            result.end_object();
 
-    std::string world_context = file::read_file(context_->campaign_dir() + "/context.md");
-    if (!world_context.empty()) {
-        prompt += "Current world context:\n" + world_context + "\n\n";
-    }
+            res->set_content(result.str(), "application/json");
+            reply->send(std::move(*res));
+        });
+}
 
-    prompt += "Generate the following sections in a creative, detailed way. ";
-    prompt += "Format each section exactly as shown:\n\n";
-    prompt += "[DESCRIPTION]\nDescribe the location in 2-3 vivid sentences.\n[/DESCRIPTION]\n\n";
-    prompt += "[ATMOSPHERE]\nDescribe the sensory experience (sights, sounds, smells) in 2-3 sentences.\n[/ATMOSPHERE]\n\n";
-    prompt += "[NOTABLE_FEATURES]\nList 3-4 interesting features as bullet points.\n[/NOTABLE_FEATURES]\n";
+void Routes::handle_generate_location(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                                      AdmissionControl::Permit permit) {
+    auto res = std::make_shared<httplib::Response>();
+    set_cors_headers(*res);
 
-    auto response = claude_.send_message("You are a creative writing assistant.", prompt);
+    std::string name = json::unescape(json::extract_string(req.body, "name"));
 
-    if (!response.success) {
-        res.status = 500;
-        json::JsonBuilder err;
-        err.begin_object();
-        err.kv_string("error", response.error);
-        err.end_object();
-        res.set_content(err.str(), "application/json");
+    if (name.empty()) {
+        res->status = 400;
+        res->set_content(R"({"error":"Missing location name"})", "application/json");
+        reply->send(std::move(*res));
         return;
     }
 
-    auto extract_section = [&](const std::string& tag) -> std::string {
-        std::string start_tag = "[" + tag + "]";
-        std::string end_tag = "[/" + tag + "]";
-        size_t start = response.content.find(start_tag);
-        if (start == std::string::npos) return "";
-        start += start_tag.size();
-        size_t end = response.content.find(end_tag, start);
-        if (end == std::string::npos) return "";
-        std::string content = response.content.substr(start, end - start);
-        while (!content.empty() && (content.front() == '\n' || content.front() == ' '))
-            content.erase(0, 1);
-        while (!content.empty() && (content.back() == '\n' || content.back() == ' '))
-            content.pop_back();
-        return content;
-    };
+    std::string world_context = session_campaign(req, *res)->context.snapshot()->context;
+    std::string existing = json::unescape(json::extract_string(req.body, "existing"));
+    generate_cached(req, *res, location_prompt(name, existing, world_context),
+        [reply, res, permit, name](ClaudeResponse response) {
+            if (!response.success) {
+                set_error(*res, response.error);
+                reply->send(std::move(*res));
+                return;
+            }
 
-    json::JsonBuilder result;
-    result.begin_object();
-    result.kv_string("description", extract_section("DESCRIPTION"));
-    result.kv_string("atmosphere", extract_section("ATMOSPHERE"));
-    result.kv_string("notableFeatures", extract_section("NOTABLE_FEATURES"));
-    result.end_object();
+            json::JsonBuilder result;
+            result.begin_object();
+            write_generated_fields(result, generated_location(name, response.content));
+            result.end_object();
 
-    res.set_content(result.str(), "application/json");
+            res->set_content(result.str(), "application/json");
+            reply->send(std::move(*res));
+        });
 }
 
-void Routes::handle_generate_image(const httplib::Request& req, httplib::Response& res) {
-    set_cors_headers(res);
+// Shared by the fan-out callbacks of one batch, which the HTTP client's event
+// loop hands to the WorkerPool; the handler thread only touches it before the
+// first launch
+struct Routes::GenerateBatch {
+    struct Item {
+        bool is_character = true;
+        std::string name;
+        std::string key;  // generations_ cache key
+        Prompt prompt;
+        bool cached = false;
+        bool ok = false;
+        std::string text;  // Claude's response
+    };
 
-    auto prompt = json::extract_string(req.body, "prompt");
-    auto category = json::extract_string(req.body, "category");
-    auto id = json::extract_string(req.body, "id");
+    std::vector<Item> items;
+    std::shared_ptr<Campaign> campaign;
+    std::shared_ptr<ResponseStream> stream;
+    AdmissionControl::Permit permit;
+    UpstreamTag tag;
+    bool persist = false;
+
+    std::mutex mutex;
+    size_t next = 0;
+    size_t finished = 0;
+};
+
+void Routes::handle_generate_batch(const httplib::Request& req, httplib::Response& res,
+                                   std::shared_ptr<ResponseStream> stream,
+                                   AdmissionControl::Permit permit) {
+    set_cors_headers(res);
 
-    if (prompt.empty()) {
+    auto entries = json::split_array(json::extract_object(req.body, "items"));
+    if (entries.empty() || entries.size() > MAX_BATCH_ITEMS) {
         res.status = 400;
-        res.set_content(R"({"error":"Missing prompt"})", "application/json");
+        res.set_content(R"({"error":"items must list 1 to 64 {kind, name} entries"})", "application/json");
         return;
     }
 
-    // Generate image via Gemini
-    auto response = gemini_.generate_image(prompt);
+    auto batch = std::make_shared<GenerateBatch>();
+    batch->campaign = session_campaign(req, res);
+    batch->tag = upstream_tag(req, res, Priority::Background);
+    batch->stream = std::move(stream);
+    batch->permit = std::move(permit);
+    batch->persist = json::extract_bool(req.body, "persist");
+    bool nocache = req.has_param("nocache") || json::extract_bool(req.body, "nocache");
+    std::string world_context = batch->campaign->context.snapshot()->context;
+
+    for (auto entry : entries) {
+        GenerateBatch::Item item;
+        auto kind = json::extract_string(entry, "kind");
+        item.name = json::unescape(json::extract_string(entry, "name"));
+        if ((kind != "character" && kind != "location") || item.name.empty()) {
+            res.status = 400;
+            res.set_content(R"({"error":"Each item needs kind (character or location) and name"})",
+                            "application/json");
+            return;
+        }
+        item.is_character = kind == "character";
+        std::string existing = json::unescape(json::extract_string(entry, "existing"));
+        item.prompt = Prompt::plain(GENERATOR_SYSTEM_PROMPT, item.is_character
+            ? character_prompt(item.name, existing, world_context)
+            : location_prompt(item.name, existing, world_context));
+        item.key = ResponseCache::key_for(claude_.request_body(item.prompt));
+
+        if (nocache) {
+            generations_.bypass();
+        } else if (auto hit = generations_.get(item.key)) {
+            item.cached = true;
+            item.ok = true;
+            item.text = std::move(*hit);
+        }
+        batch->items.push_back(std::move(item));
+    }
 
-    if (!response.success) {
-        res.status = 500;
-        json::JsonBuilder err;
-        err.begin_object();
-        err.kv_string("error", response.error);
-        err.end_object();
-        res.set_content(err.str(), "application/json");
-        return;
+    res.set_header("Cache-Control", "no-cache");
+    batch->stream->open("text/event-stream");
+
+    // Cached items are reported straight away; the rest share the fan-out slots
+    size_t pending = 0;
+    for (size_t i = 0; i < batch->items.size(); ++i) {
+        if (batch->items[i].cached) finish_batch_item(batch, i);
+        else ++pending;
+    }
+    if (pending == 0) return;
+    for (size_t slot = 0; slot < std::min(batch_concurrency_, pending); ++slot) {
+        launch_batch_item(batch);
+    }
+}
+
+void Routes::launch_batch_item(const std::shared_ptr<GenerateBatch>& batch) {
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        while (batch->next < batch->items.size() && batch->items[batch->next].cached) ++batch->next;
+        if (batch->next == batch->items.size()) return;
+        index = batch->next++;
+    }
+
+    auto stream = batch->stream;
+    claude_.send_message_async(batch->items[index].prompt,
+        [this, batch, index, pending = track_pending()](ClaudeResponse response) {
+            // The cache and the final persist write files; keep them off the loop
+            defer([this, batch, index, pending, response = std::move(response)]() mutable {
+                record_usage(response);
+                auto& item = batch->items[index];
+                item.ok = response.success;
+                item.text = response.success ? std::move(response.content) : std::move(response.error);
+                if (item.ok) generations_.put(item.key, item.text);
+                finish_batch_item(batch, index);
+                launch_batch_item(batch);
+            });
+        },
+        [stream] { return stream->disconnected(); }, batch->tag);
+}
+
+void Routes::finish_batch_item(const std::shared_ptr<GenerateBatch>& batch, size_t index) {
+    auto& item = batch->items[index];
+
+    json::JsonBuilder event;
+    event.begin_object();
+    event.kv_int("index", static_cast<int64_t>(index));
+    event.kv_string("kind", item.is_character ? "character" : "location");
+    event.kv_string("name", item.name);
+    if (item.ok) {
+        event.kv_string("id", MarkdownParser::to_id(item.name));
+        event.key("cached");
+        event.value_bool(item.cached);
+        if (item.is_character) write_generated_fields(event, generated_character(item.name, item.text));
+        else write_generated_fields(event, generated_location(item.name, item.text));
+    } else {
+        event.kv_string("error", item.text);
     }
+    event.end_object();
+    batch->stream->write(sse_event(item.ok ? "item" : "item_error", event.str()));
 
-    // If category and id provided, save the image
-    std::string image_url;
-    if (!category.empty() && !id.empty()) {
-        bool saved = context_->save_image(std::string(category), std::string(id),
-                                          response.image_data, response.mime_type);
-        if (saved) {
-            image_url = "/api/images/" + std::string(category) + "/" + std::string(id);
+    {
+        std::lock_guard<std::mutex> lock(batch->mutex);
+        if (++batch->finished < batch->items.size()) return;
+    }
+
+    // Last item in: one write per file for everything that succeeded
+    size_t succeeded = 0;
+    for (const auto& it : batch->items) succeeded += it.ok ? 1 : 0;
+    bool persisted = false;
+    if (batch->persist && succeeded > 0 && !batch->stream->disconnected()) {
+        persist_batch(*batch);
+        persisted = true;
+    }
+
+    json::JsonBuilder done;
+    done.begin_object();
+    done.kv_int("succeeded", static_cast<int64_t>(succeeded));
+    done.kv_int("failed", static_cast<int64_t>(batch->items.size() - succeeded));
+    done.key("persisted");
+    done.value_bool(persisted);
+    done.end_object();
+    batch->stream->write(sse_event("done", done.str()));
+    batch->stream->close();
+}
+
+void Routes::persist_batch(GenerateBatch& batch) {
+    Campaign::WriteLock lock(*batch.campaign);
+    ContextManager& ctx = batch.campaign->context;
+    auto snap = ctx.snapshot();
+    auto chars = snap->characters;
+    auto locs = snap->locations;
+    bool chars_changed = false, locs_changed = false;
+
+    // Existing entries keep their other fields; only generated sections change
+    for (const auto& item : batch.items) {
+        if (!item.ok) continue;
+        if (item.is_character) {
+            Character c = generated_character(item.name, item.text);
+            auto it = std::find_if(chars.begin(), chars.end(),
+                                   [&c](const Character& e) { return e.id == c.id; });
+            if (it == chars.end()) {
+                chars.push_back(std::move(c));
+            } else {
+                it->appearance = c.appearance;
+                it->background = c.background;
+                it->motivations = c.motivations;
+                it->personality = c.personality;
+            }
+            chars_changed = true;
+        } else {
+            Location loc = generated_location(item.name, item.text);
+            auto it = std::find_if(locs.begin(), locs.end(),
+                                   [&loc](const Location& e) { return e.id == loc.id; });
+            if (it == locs.end()) {
+                locs.push_back(std::move(loc));
+            } else {
+                it->description = loc.description;
+                it->atmosphere = loc.atmosphere;
+                it->notable_features = loc.notable_features;
+            }
+            locs_changed = true;
         }
     }
 
-    json::JsonBuilder result;
-    result.begin_object();
-    result.kv_string("imageData", response.image_data);
-    result.kv_string("mimeType", response.mime_type);
-    if (!image_url.empty()) {
-        result.kv_string("imageUrl", image_url);
+    if (chars_changed) ctx.save_characters(md_parser_.serialize_characters(chars));
+    if (locs_changed) ctx.save_locations(md_parser_.serialize_locations(locs));
+}
+
+void Routes::handle_generate_image(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                                   AdmissionControl::Permit permit) {
+    auto res = std::make_shared<httplib::Response>();
+    set_cors_headers(*res);
+
+    auto prompt = json::extract_string(req.body, "prompt");
+    std::string category(json::extract_string(req.body, "category"));
+    std::string id(json::extract_string(req.body, "id"));
+
+    if (prompt.empty()) {
+        res->status = 400;
+        res->set_content(R"({"error":"Missing prompt"})", "application/json");
+        reply->send(std::move(*res));
+        return;
     }
-    result.end_object();
 
-    res.set_content(result.str(), "application/json");
+    // Pin the campaign now so the image lands where the request was made
+    auto campaign = session_campaign(req, *res);
+    UpstreamTag tag = upstream_tag(req, *res, Priority::Editor);
+
+    // Generate image via Gemini
+    gemini_.generate_image_async(prompt,
+        [this, reply, res, permit, campaign, category, id,
+         pending = track_pending()](GeminiImageResponse response) {
+            // Saving the image writes a file under the campaign lock
+            defer([reply, res, permit, campaign, category, id, pending, response = std::move(response)] {
+                if (!response.success) {
+                    set_error(*res, response.error);
+                    reply->send(std::move(*res));
+                    return;
+                }
+
+                // If category and id provided, save the image
+                std::string image_url;
+                if (!category.empty() && !id.empty()) {
+                    Campaign::WriteLock lock(*campaign);
+                    bool saved = campaign->context.save_image(category, id,
+                                                              response.image_data, response.mime_type);
+                    if (saved) {
+                        image_url = "/api/images/" + category + "/" + id;
+                    }
+                }
+
+                json::JsonBuilder result;
+                result.begin_object();
+                result.kv_string("imageData", response.image_data);
+                result.kv_string("mimeType", response.mime_type);
+                if (!image_url.empty()) {
+                    result.kv_string("imageUrl", image_url);
+                }
+                result.end_object();
+
+                res->set_content(result.str(), "application/json");
+                reply->send(std::move(*res));
+            });
+        },
+        req.is_connection_closed, tag);
 }
 
 void Routes::handle_get_image(const httplib::Request& req, httplib::Response& res) {
     res.set_header("Access-Control-Allow-Origin", "*");
 
-    std::string category = req.matches[1];
-    std::string id = req.matches[2];
+    std::string category = req.path_params.at("category");
+    std::string id = req.path_params.at("id");
 
-    std::string path = context_->get_image_path(category, id);
+    auto campaign = session_campaign(req, res);
+    std::string path = campaign->context.get_image_path(category, id);
     if (path.empty()) {
         res.status = 404;
         res.set_content("Image not found", "text/plain");
@@ -733,12 +1253,285 @@ void Routes::handle_get_image(const httplib::Request& req, httplib::Response& re
     res.set_content(content, content_type);
 }
 
+std::string Routes::read_key(const std::string& campaign_id, const CampaignSnapshot& snap,
+                             const char* resource) {
+    return campaign_id + "/" + resource + "@" + std::to_string(snap.version);
+}
+
+void Routes::set_shared_content(httplib::Response& res, SingleFlight::Result body) {
+    // Streams straight from the shared buffer instead of copying it per response
+    size_t length = body->size();
+    res.set_content_provider(length, "application/json",
+        [body = std::move(body)](size_t offset, size_t len, httplib::DataSink& sink) {
+            return sink.write(body->data() + offset, len);
+        });
+}
+
+Prompt Routes::build_turn_prompt(const Campaign& campaign, std::string_view player_message) const {
+    auto layers = campaign.context.build_context_layers(context_budget_);
+    auto history = campaign.context.history_window(history_budget_);
+    std::string system_prompt = campaign.context.get_system_prompt();
+
+    // One line per turn so prompt growth shows up before the bill does
+    size_t system_tokens = tokens::estimate(system_prompt);
+    size_t history_tokens = 0;
+    for (const auto& turn : history) history_tokens += turn.tokens;
+    size_t total = system_tokens + history_tokens + tokens::estimate(player_message);
+    std::string sizes;
+    for (const auto& section : layers.sections) {
+        sizes += " " + std::string(section.name) + "=" + std::to_string(section.tokens - section.trimmed);
+        if (section.trimmed > 0) sizes += "(-" + std::to_string(section.trimmed) + ")";
+        total += section.tokens - section.trimmed;
+    }
+    fprintf(stderr, "Prompt tokens (est.): system=%zu%s history=%zu/%zu turns total=%zu\n",
+            system_tokens, sizes.c_str(), history_tokens, history.size(), total);
+
+    Prompt prompt;
+    prompt.tools.push_back(state_tool());
+    prompt.system.push_back({std::move(system_prompt), true});
+    prompt.system.push_back({std::move(layers.entities), true});
+
+    // Earlier turns as real messages, replayed in the narrator's own format
+    for (auto& turn : history) {
+        prompt.messages.push_back({"user", {{"Player says: " + turn.player, false}}});
+        prompt.messages.push_back({"assistant",
+            {{"[NARRATIVE]\n" + turn.narrator + "\n[/NARRATIVE]", false}}});
+    }
+    if (!prompt.messages.empty()) prompt.messages.back().content.back().cache = true;
+
+    prompt.messages.push_back({"user", {
+        {std::move(layers.state), false},
+        {"Player says: " + std::string(player_message), false}}});
+    return prompt;
+}
+
+void Routes::generate_cached(const httplib::Request& req, httplib::Response& res,
+                             const std::string& prompt, std::function<void(ClaudeResponse)> done) {
+    Prompt request = Prompt::plain(GENERATOR_SYSTEM_PROMPT, prompt);
+    std::string key = ResponseCache::key_for(claude_.request_body(request));
+
+    if (req.has_param("nocache") || json::extract_bool(req.body, "nocache")) {
+        generations_.bypass();
+        res.set_header("X-Cache", "BYPASS");
+    } else if (auto hit = generations_.get(key)) {
+        res.set_header("X-Cache", "HIT");
+        ClaudeResponse response;
+        response.content = std::move(*hit);
+        response.success = true;
+        done(std::move(response));
+        return;
+    } else {
+        res.set_header("X-Cache", "MISS");
+    }
+
+    claude_.send_message_async(request,
+        [this, key, done = std::move(done), pending = track_pending()](ClaudeResponse response) {
+            // The cache keeps its entries on disk
+            defer([this, key, done, pending, response = std::move(response)] {
+                record_usage(response);
+                if (response.success) generations_.put(key, response.content);
+                done(response);
+            });
+        },
+        req.is_connection_closed, upstream_tag(req, res, Priority::Editor));
+}
+
+void Routes::defer(std::function<void()> fn) {
+    if (workers_) workers_->post(std::move(fn));
+    else fn();
+}
+
+Routes::PendingWork Routes::track_pending() {
+    {
+        std::lock_guard<std::mutex> lock(pending_mutex_);
+        ++pending_;
+    }
+    return PendingWork(this, [](Routes* routes) {
+        std::lock_guard<std::mutex> lock(routes->pending_mutex_);
+        if (--routes->pending_ == 0) routes->pending_cv_.notify_all();
+    });
+}
+
+size_t Routes::pending_work() const {
+    std::lock_guard<std::mutex> lock(pending_mutex_);
+    return pending_;
+}
+
+void Routes::shutdown() {
+    shutting_down_ = true;
+    std::unique_lock<std::mutex> lock(pending_mutex_);
+    pending_cv_.wait(lock, [this] { return pending_ == 0; });
+}
+
+void Routes::record_usage(const ClaudeResponse& response) {
+    input_tokens_ += response.input_tokens;
+    cache_write_tokens_ += response.cache_creation_input_tokens;
+    cache_read_tokens_ += response.cache_read_input_tokens;
+    output_tokens_ += response.output_tokens;
+}
+
+std::string Routes::stats_json() const {
+    json::JsonBuilder reads(128);
+    reads.begin_object();
+    reads.kv_int("computed", static_cast<int64_t>(reads_.computed()));
+    reads.kv_int("shared", static_cast<int64_t>(reads_.shared()));
+    reads.end_object();
+
+    json::JsonBuilder tokens(128);
+    tokens.begin_object();
+    tokens.kv_int("input", input_tokens_.load());
+    tokens.kv_int("cacheWrite", cache_write_tokens_.load());
+    tokens.kv_int("cacheRead", cache_read_tokens_.load());
+    tokens.kv_int("output", output_tokens_.load());
+    tokens.end_object();
+
+    json::JsonBuilder j(256);
+    j.begin_object();
+    j.key("singleflight");
+    j.value_raw(reads.str());
+    j.key("tokens");
+    j.value_raw(tokens.str());
+    j.key("generationCache");
+    j.value_raw(generations_.stats_json());
+    j.key("idempotency");
+    j.value_raw(idempotency_.stats_json());
+    j.kv_int("pendingWork", static_cast<int64_t>(pending_work()));
+    int64_t bookkeeping = bookkeeping_calls_.load();
+    json::JsonBuilder phases(128);
+    phases.begin_object();
+    phases.kv_int("calls", bookkeeping);
+    phases.kv_int("failures", bookkeeping_failures_.load());
+    phases.kv_int("avgMs", bookkeeping ? bookkeeping_ms_.load() / bookkeeping : 0);
+    phases.end_object();
+    j.key("bookkeeping");
+    j.value_raw(phases.str());
+    json::JsonBuilder ops(64);
+    ops.begin_object();
+    ops.kv_int("applied", state_ops_applied_.load());
+    ops.kv_int("unchanged", state_ops_unchanged_.load());
+    ops.end_object();
+    j.key("stateOps");
+    j.value_raw(ops.str());
+    j.key("claude");
+    j.value_raw(claude_.policy_stats_json());
+    j.key("claudeKeys");
+    j.value_raw(claude_.key_stats_json());
+    j.key("gemini");
+    j.value_raw(gemini_.policy_stats_json());
+    j.end_object();
+    return j.str();
+}
+
+std::string Routes::commit_turn(Campaign& campaign, const std::string& player_message,
+                                const ClaudeResponse& response) {
+    // A tool_use turn ends at the tool call, and the model often leaves the
+    // closing tag off before it
+    std::string narrative;
+    if (!response.tool_calls.empty() && response.content.find("[/NARRATIVE]") == std::string::npos) {
+        narrative = parser_.extract_narrative(response.content + "\n[/NARRATIVE]");
+    } else {
+        narrative = parser_.extract_narrative(response.content);
+    }
+
+    Campaign::WriteLock lock(campaign);
+    apply_turn_updates(campaign, response);
+    campaign.context.append_history(player_message, narrative);
+    return narrative;
+}
+
+void Routes::apply_turn_updates(Campaign& campaign, const ClaudeResponse& response) {
+    // [UPDATE] blocks still carry world knowledge and locations, and any
+    // structured change the model wrote out by hand
+    campaign.context.apply_updates(parser_.extract_updates(response.content));
+
+    std::vector<StateOp> ops;
+    for (const auto& call : response.tool_calls) {
+        if (call.name != STATE_TOOL_NAME) continue;
+        auto parsed = parser_.extract_state_ops(call.input);
+        ops.insert(ops.end(), std::make_move_iterator(parsed.begin()), std::make_move_iterator(parsed.end()));
+    }
+    size_t applied = campaign.context.apply_state_ops(ops);
+    state_ops_applied_ += static_cast<int64_t>(applied);
+    state_ops_unchanged_ += static_cast<int64_t>(ops.size() - applied);
+}
+
+void Routes::prepare_narrative_phase(Prompt& prompt) const {
+    prompt.stop_sequences.push_back("[/NARRATIVE]");
+    // Fourth breakpoint: the bookkeeping call resends this whole prompt and
+    // only pays full price for the narrative it appends. The cache is per
+    // model, so a different bookkeeping model would only pay for the write.
+    const std::string& narrator = prompt.model.empty() ? claude_.model() : prompt.model;
+    if (bookkeeping_model_.empty() || bookkeeping_model_ == narrator) {
+        prompt.messages.back().content.back().cache = true;
+    }
+}
+
+bool Routes::needs_bookkeeping(const ClaudeResponse& response) {
+    // The model may have written the whole turn anyway (no stop sequence hit);
+    // then there is nothing left to ask for
+    return response.content.find("[/NARRATIVE]") == std::string::npos && response.tool_calls.empty();
+}
+
+std::string Routes::finish_narrative_phase(const std::shared_ptr<Campaign>& campaign,
+                                           const std::string& player_message,
+                                           const ClaudeResponse& response, Prompt prompt,
+                                           std::shared_ptr<TurnSequencer::Turn> turn,
+                                           const UpstreamTag& tag, std::function<void(bool)> settled) {
+    if (!needs_bookkeeping(response)) {
+        std::string narrative = commit_turn(*campaign, player_message, response);
+        turn->finish();
+        return narrative;
+    }
+
+    std::string narrative = parser_.extract_narrative(response.content + "\n[/NARRATIVE]");
+
+    // Same prompt with the narrative as a prefill; the model picks up at the
+    // update blocks
+    prompt.stop_sequences.clear();
+    prompt.messages.push_back({"assistant", {{"[NARRATIVE]\n" + narrative + "\n[/NARRATIVE]", false}}});
+    prompt.model = bookkeeping_model_;
+    prompt.max_tokens = BOOKKEEPING_MAX_TOKENS;
+
+    // Nobody waits on this call, so drain and shutdown count it instead.
+    // The narrative goes into history together with the updates it caused;
+    // the turn holds back the next one until both are on disk.
+    ++bookkeeping_calls_;
+    auto started = std::chrono::steady_clock::now();
+    claude_.send_message_async(prompt,
+        [this, campaign, turn, started, player_message, narrative, settled,
+         pending = track_pending()](ClaudeResponse bookkeeping) {
+            defer([this, campaign, turn, started, player_message, narrative, settled, pending,
+                   bookkeeping = std::move(bookkeeping)] {
+                record_usage(bookkeeping);
+                long ms = static_cast<long>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - started).count());
+                bookkeeping_ms_ += ms;
+
+                {
+                    Campaign::WriteLock lock(*campaign);
+                    if (bookkeeping.success) {
+                        apply_turn_updates(*campaign, bookkeeping);
+                    } else {
+                        // The narrative stands; this turn's state changes are lost
+                        ++bookkeeping_failures_;
+                        fprintf(stderr, "Bookkeeping for a turn in %s failed after %ldms: %s\n",
+                                campaign->id.c_str(), ms, bookkeeping.error.c_str());
+                    }
+                    campaign->context.append_history(player_message, narrative);
+                }
+                if (settled) settled(bookkeeping.success);
+                turn->finish();
+            });
+        },
+        [this] { return shutting_down_.load(); }, tag);
+    return narrative;
+}
+
 // Roleplay helper methods
 
 std::string Routes::generate_roleplay_id() {
-    static std::random_device rd;
-    static std::mt19937 gen(rd());
-    static std::uniform_int_distribution<> dis(0, 15);
+    static thread_local std::mt19937 gen(std::random_device{}());
+    std::uniform_int_distribution<> dis(0, 15);
     static const char* hex = "0123456789abcdef";
 
     std::string id = "rp_";
@@ -749,18 +1542,86 @@ std::string Routes::generate_roleplay_id() {
 }
 
 std::string Routes::roleplay_dir(const std::string& id) const {
-    return std::string(CAMPAIGNS_DIR) + "/" + id;
+    return campaigns_.campaign_dir(id);
+}
+
+std::string Routes::resolve_session(const httplib::Request& req, httplib::Response& res) {
+    // Only ids this server issued; anything else gets a fresh session rather
+    // than the chance to pick (or guess) someone else's
+    std::string session = req.get_header_value(SESSION_HEADER);
+    if (SessionStore::is_valid_id(session) && sessions_.exists(session)) return session;
+
+    // Fall back to the session cookie
+    std::string cookies = req.get_header_value("Cookie");
+    std::string prefix = std::string(SESSION_COOKIE) + "=";
+    size_t pos = 0;
+    while (pos < cookies.size()) {
+        while (pos < cookies.size() && (cookies[pos] == ' ' || cookies[pos] == ';')) ++pos;
+        size_t end = cookies.find(';', pos);
+        if (end == std::string::npos) end = cookies.size();
+        if (cookies.compare(pos, prefix.size(), prefix) == 0) {
+            session = cookies.substr(pos + prefix.size(), end - pos - prefix.size());
+            if (SessionStore::is_valid_id(session) && sessions_.exists(session)) return session;
+        }
+        pos = end;
+    }
+
+    // New client: issue a session. Setting the cookie is idempotent if
+    // several handlers in one request resolve it.
+    session = res.get_header_value(SESSION_HEADER);
+    if (!session.empty()) return session;
+    session = SessionStore::generate_id();
+    sessions_.add(session);
+    res.set_header("Set-Cookie", std::string(SESSION_COOKIE) + "=" + session +
+                                 "; Path=/; HttpOnly; SameSite=Lax; Max-Age=2592000");
+    res.set_header(SESSION_HEADER, session);
+    return session;
+}
+
+std::string Routes::session_roleplay_id(const std::string& session) {
+    std::string id = sessions_.active_roleplay(session);
+    if (!id.empty()) return id;
+
+    // First use: the session is pinned to the current default, so a later
+    // change of default (e.g. deleting it) never moves it elsewhere
+    std::lock_guard<std::mutex> lock(index_mutex_);
+    if (!default_roleplay_id_.empty()) sessions_.set_active_roleplay(session, default_roleplay_id_);
+    return default_roleplay_id_;
+}
+
+std::shared_ptr<Campaign> Routes::session_campaign(const httplib::Request& req,
+                                                   httplib::Response& res) {
+    return campaigns_.get(session_roleplay_id(resolve_session(req, res)));
+}
+
+UpstreamTag Routes::upstream_tag(const httplib::Request& req, httplib::Response& res,
+                                 Priority priority) {
+    std::string session = resolve_session(req, res);
+    UpstreamTag tag;
+    tag.priority = priority;
+    tag.flow = session_roleplay_id(session) + "/" + session;
+    return tag;
+}
+
+std::shared_ptr<Campaign> Routes::create_campaign(const std::string& name,
+                                                  const std::string& player_name,
+                                                  const std::string& player_role) {
+    auto campaign = campaigns_.get(generate_roleplay_id());
+    Campaign::WriteLock lock(*campaign);
+    campaign->context.init_new_campaign(name, player_name, player_role);
+    return campaign;
 }
 
-void Routes::load_roleplay(const std::string& id) {
-    current_roleplay_id_ = id;
-    context_ = std::make_unique<ContextManager>(roleplay_dir(id));
+void Routes::touch_last_played(const std::shared_ptr<Campaign>& campaign) {
+    Campaign::WriteLock lock(*campaign);
+    campaign->context.update_last_played();
 }
 
+// Caller must hold index_mutex_
 void Routes::save_roleplays_index(const std::vector<RoleplayInfo>& roleplays) {
     json::JsonBuilder j;
     j.begin_object();
-    j.kv_string("activeId", current_roleplay_id_);
+    j.kv_string("activeId", default_roleplay_id_);
     j.key("roleplays");
     j.begin_array();
     for (const auto& rp : roleplays) {
@@ -867,24 +1728,21 @@ void Routes::handle_create_roleplay(const httplib::Request& req, httplib::Respon
     }
 
     // Update lastPlayed on current roleplay before switching
-    if (context_) {
-        context_->update_last_played();
-    }
+    touch_last_played(session_campaign(req, res));
 
     // Generate new ID and create roleplay
-    std::string new_id = generate_roleplay_id();
-    std::string dir = roleplay_dir(new_id);
-    context_ = std::make_unique<ContextManager>(dir);
-    context_->init_new_campaign(
+    std::string new_id = create_campaign(
         std::string(name),
         playerName.empty() ? "Player" : std::string(playerName),
         playerRole.empty() ? "Participant" : std::string(playerRole)
-    );
-    current_roleplay_id_ = new_id;
+    )->id;
 
-    // Update index
-    auto roleplays = read_roleplays_index();
-    save_roleplays_index(roleplays);
+    // Switch this session only, then record the new roleplay in the index
+    sessions_.set_active_roleplay(resolve_session(req, res), new_id);
+    {
+        std::lock_guard<std::mutex> lock(index_mutex_);
+        save_roleplays_index(read_roleplays_index());
+    }
 
     // Return the new roleplay info
     RoleplayInfo info = read_roleplay_metadata(new_id);
@@ -894,7 +1752,12 @@ void Routes::handle_create_roleplay(const httplib::Request& req, httplib::Respon
 void Routes::handle_load_roleplay(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
+    std::string id = req.path_params.at("id");
+    std::string session = resolve_session(req, res);
+    auto previous = session_campaign(req, res);
+
+    // Held so the roleplay can't be deleted between the check and the switch
+    std::lock_guard<std::mutex> index_lock(index_mutex_);
 
     // Verify roleplay exists
     std::string meta_path = roleplay_dir(id) + "/metadata.json";
@@ -905,17 +1768,11 @@ void Routes::handle_load_roleplay(const httplib::Request& req, httplib::Response
     }
 
     // Update lastPlayed on current roleplay before switching
-    if (context_) {
-        context_->update_last_played();
-    }
-
-    // Load the new roleplay
-    load_roleplay(id);
-    context_->update_last_played();
+    touch_last_played(previous);
 
-    // Update index with new active ID
-    auto roleplays = read_roleplays_index();
-    save_roleplays_index(roleplays);
+    // Load the new roleplay for this session only; the shared index is untouched
+    touch_last_played(campaigns_.get(id));
+    sessions_.set_active_roleplay(session, id);
 
     RoleplayInfo info = read_roleplay_metadata(id);
     res.set_content(build_roleplay_json(info), "application/json");
@@ -924,10 +1781,13 @@ void Routes::handle_load_roleplay(const httplib::Request& req, httplib::Response
 void Routes::handle_delete_roleplay(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    std::string id = req.matches[1];
+    std::string id = req.path_params.at("id");
+    std::string session_id = session_roleplay_id(resolve_session(req, res));
+    std::lock_guard<std::mutex> index_lock(index_mutex_);
 
-    // Can't delete current roleplay
-    if (id == current_roleplay_id_) {
+    // Can't delete a roleplay that this session has open, that a session
+    // used recently has open, or that a request or turn is still working on
+    if (id == session_id || sessions_.is_live_anywhere(id) || campaigns_.in_use(id)) {
         res.status = 400;
         res.set_content(R"({"error":"Cannot delete active roleplay"})", "application/json");
         return;
@@ -942,22 +1802,35 @@ void Routes::handle_delete_roleplay(const httplib::Request& req, httplib::Respon
         return;
     }
 
+    // Wait for in-flight requests on this roleplay before removing its files
+    auto campaign = campaigns_.get(id);
+    Campaign::WriteLock lock(*campaign);
+    campaigns_.evict(id);
+
     // Delete the directory (recursively)
     // Simple recursive delete using system command
     std::string cmd = "rm -rf \"" + dir + "\"";
     system(cmd.c_str());
 
-    // Update index
+    // Sessions idle long enough to not count as open start over with the
+    // default; every other session is pinned and stays where it is
+    sessions_.release_roleplay(id);
+
+    // Update index, moving the default (for new sessions) if it was just deleted
     auto roleplays = read_roleplays_index();
+    if (id == default_roleplay_id_ && !roleplays.empty()) {
+        default_roleplay_id_ = roleplays[0].id;
+    }
     save_roleplays_index(roleplays);
 
     res.set_content(R"({"success":true})", "application/json");
 }
 
-void Routes::handle_get_current_roleplay(const httplib::Request&, httplib::Response& res) {
+void Routes::handle_get_current_roleplay(const httplib::Request& req, httplib::Response& res) {
     set_cors_headers(res);
 
-    RoleplayInfo info = read_roleplay_metadata(current_roleplay_id_);
+    std::string id = session_roleplay_id(resolve_session(req, res));
+    RoleplayInfo info = read_roleplay_metadata(id);
     res.set_content(build_roleplay_json(info), "application/json");
 }
 
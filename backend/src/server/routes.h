@@ -5,7 +5,19 @@
 #include "../context/context_manager.h"
 #include "../parser/response_parser.h"
 #include "../parser/markdown_parser.h"
+#include "admission.h"
+#include "response_stream.h"
+#include "campaign_registry.h"
+#include "idempotency_store.h"
+#include "response_cache.h"
+#include "session_store.h"
+#include "single_flight.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 
 namespace rpg {
 
@@ -22,6 +34,46 @@ class Routes {
 public:
     Routes();
 
+    // Set before serving; 0 sends no history
+    void set_history_budget(size_t tokens) { history_budget_ = tokens; }
+    // Ceiling for the campaign files in each prompt; 0 sends them whole
+    void set_context_budget(size_t tokens) { context_budget_ = tokens; }
+    // Age after which cached character/location generations are redone; 0 never
+    void set_generation_cache_ttl(long seconds) { generations_.set_ttl_seconds(seconds); }
+    // Claude calls in flight per batch request
+    void set_batch_concurrency(size_t calls) { batch_concurrency_ = std::max<size_t>(1, calls); }
+    // Two-phase turns: the player gets the narrative as soon as it is written
+    // and the update blocks come from a follow-up call, optionally on a
+    // cheaper model (empty: the narrator's, which also reuses its prompt cache)
+    void set_two_phase_turns(bool enabled, std::string bookkeeping_model = {}) {
+        two_phase_turns_ = enabled;
+        bookkeeping_model_ = std::move(bookkeeping_model);
+    }
+
+    // Sessions remembered at most; the least recently seen go first
+    void set_max_sessions(size_t sessions) { sessions_.set_max_sessions(sessions); }
+
+    // Time after which an unused campaign is closed; 0 keeps every campaign open
+    void set_campaign_idle_seconds(long seconds) { campaigns_.set_idle_seconds(seconds); }
+
+    // Age after which a stored response no longer answers a retried Idempotency-Key
+    void set_idempotency_ttl(long seconds) { idempotency_.set_ttl_seconds(seconds); }
+
+    // Upstream completions are handed to these workers for the file writes
+    // and lock waits that must stay off the HTTP client's event loop. Set
+    // before serving; without it they run on the event loop.
+    void set_workers(WorkerPool& workers) { workers_ = &workers; }
+
+    // Runs handler at most once per Idempotency-Key within a session and
+    // route: a retry that arrives while the first run is going gets its
+    // response when it is ready, a later one gets it replayed. Without the
+    // header the request goes straight through. Only for whole responses:
+    // the streamed routes (/api/message/stream, /api/generate/batch) ignore
+    // the header, since a stream can't be replayed to a second connection.
+    using AsyncHandler = std::function<void(const httplib::Request&, std::shared_ptr<DeferredResponse>)>;
+    void idempotent(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                    const AsyncHandler& handler);
+
     // Roleplay management
     void handle_get_roleplays(const httplib::Request& req, httplib::Response& res);
     void handle_create_roleplay(const httplib::Request& req, httplib::Response& res);
@@ -29,8 +81,14 @@ public:
     void handle_delete_roleplay(const httplib::Request& req, httplib::Response& res);
     void handle_get_current_roleplay(const httplib::Request& req, httplib::Response& res);
 
-    // Game messaging
-    void handle_message(const httplib::Request& req, httplib::Response& res);
+    // Game messaging. Handlers that wait on an upstream call answer through
+    // a DeferredResponse and hold their permit until it is sent.
+    void handle_message(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                        AdmissionControl::Permit permit);
+    // The permit is released once the event stream has been closed
+    void handle_message_stream(const httplib::Request& req, httplib::Response& res,
+                               std::shared_ptr<ResponseStream> stream,
+                               AdmissionControl::Permit permit);
     void handle_get_history(const httplib::Request& req, httplib::Response& res);
 
     // Player
@@ -57,34 +115,175 @@ public:
     void handle_delete_location(const httplib::Request& req, httplib::Response& res);
 
     // AI Generation
-    void handle_generate_character(const httplib::Request& req, httplib::Response& res);
-    void handle_generate_location(const httplib::Request& req, httplib::Response& res);
-    void handle_generate_image(const httplib::Request& req, httplib::Response& res);
+    void handle_generate_character(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                                   AdmissionControl::Permit permit);
+    void handle_generate_location(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                                  AdmissionControl::Permit permit);
+    void handle_generate_image(const httplib::Request& req, std::shared_ptr<DeferredResponse> reply,
+                               AdmissionControl::Permit permit);
+
+    // Generates up to MAX_BATCH_ITEMS characters and locations, at most
+    // batch_concurrency_ Claude calls at a time, streaming an SSE event per
+    // item as it completes. With "persist" the results are written into
+    // characters.md and locations.md once everything is in.
+    void handle_generate_batch(const httplib::Request& req, httplib::Response& res,
+                               std::shared_ptr<ResponseStream> stream,
+                               AdmissionControl::Permit permit);
 
     // Image serving
     void handle_get_image(const httplib::Request& req, httplib::Response& res);
 
+    // Counters for the stats endpoint, as a JSON object
+    std::string stats_json() const;
+
+    // Writes state that is otherwise persisted lazily, e.g. before a successor
+    // process takes over
+    void flush() { sessions_.flush(); }
+
+    // Upstream calls and the work that follows them, still outstanding. Some
+    // outlive their request, e.g. the bookkeeping call of a two-phase turn.
+    size_t pending_work() const;
+
+    // Cancels the upstream calls still outstanding and waits until their
+    // callbacks have run. Call once serving has stopped and before Routes
+    // goes away. By then the server has shut the WorkerPool down, so
+    // defer() runs those continuations on the HTTP client's event loop
+    // (WorkerPool::post runs tasks inline after shutdown); that is fine
+    // with nothing else left to serve.
+    void shutdown();
+
 private:
     ClaudeAPI claude_;
     GeminiAPI gemini_;
-    std::unique_ptr<ContextManager> context_;
     ResponseParser parser_;
     MarkdownParser md_parser_;
 
-    std::string current_roleplay_id_;
     static constexpr const char* CAMPAIGNS_DIR = "campaigns";
     static constexpr const char* INDEX_FILE = "campaigns/roleplays.json";
+    static constexpr const char* GENERATION_CACHE_DIR = "campaigns/.cache/generate";
+    static constexpr size_t MAX_BATCH_ITEMS = 64;
+    static constexpr int BOOKKEEPING_MAX_TOKENS = 2048;  // five update blocks fit comfortably
+    static constexpr const char* SESSIONS_FILE = "campaigns/sessions.json";
+    static constexpr const char* SESSION_COOKIE = "rpg_session";
+    static constexpr const char* SESSION_HEADER = "X-Session-Id";
+    static constexpr const char* IDEMPOTENCY_HEADER = "Idempotency-Key";
+    static constexpr const char* REPLAYED_HEADER = "Idempotent-Replayed";
+    static constexpr size_t MAX_IDEMPOTENCY_KEY = 255;
+
+    CampaignRegistry campaigns_{CAMPAIGNS_DIR};
+    SessionStore sessions_{SESSIONS_FILE};
+
+    // Roleplay for sessions that have not picked one yet (the index's activeId).
+    // Guards default_roleplay_id_ and writes to the roleplays index.
+    std::mutex index_mutex_;
+    std::string default_roleplay_id_;
+
+    // Shares one parse and one response buffer between concurrent identical reads
+    SingleFlight reads_;
+
+    // Character and location generations by request hash; "regenerate" and
+    // "undo" in the editors tend to repeat an earlier request exactly
+    ResponseCache generations_{{GENERATION_CACHE_DIR}};
+
+    // Responses to message and generate requests by session, route and Idempotency-Key
+    IdempotencyStore idempotency_{{}};
+    class IdempotentReply;
+
+    WorkerPool* workers_ = nullptr;
+
+    // Held by each upstream callback and the continuation it defers, so
+    // none of them outlives Routes; shutdown() waits for the count to drop
+    using PendingWork = std::shared_ptr<void>;
+    PendingWork track_pending();
+    mutable std::mutex pending_mutex_;
+    std::condition_variable pending_cv_;
+    size_t pending_ = 0;
+    std::atomic<bool> shutting_down_{false};
+
+    // Token usage across every Claude call, for the stats endpoint
+    std::atomic<int64_t> input_tokens_{0};
+    std::atomic<int64_t> cache_write_tokens_{0};
+    std::atomic<int64_t> cache_read_tokens_{0};
+    std::atomic<int64_t> output_tokens_{0};
+
+    // Follow-up calls of two-phase turns
+    std::atomic<int64_t> bookkeeping_calls_{0};
+    std::atomic<int64_t> bookkeeping_failures_{0};
+    std::atomic<int64_t> bookkeeping_ms_{0};
+
+    // update_state operations that changed the campaign, and those that did not
+    std::atomic<int64_t> state_ops_applied_{0};
+    std::atomic<int64_t> state_ops_unchanged_{0};
+
+    // Tokens of earlier turns replayed into each narrator prompt
+    size_t history_budget_ = 4000;
+    size_t context_budget_ = 0;
+    size_t batch_concurrency_ = 4;
+    bool two_phase_turns_ = false;
+    std::string bookkeeping_model_;
 
     void set_cors_headers(httplib::Response& res);
-    std::string build_character_json(const Character& c) const;
-    std::string build_location_json(const Location& loc) const;
+    std::string build_character_json(const CampaignSnapshot& snap, const Character& c) const;
+    std::string build_location_json(const CampaignSnapshot& snap, const Location& loc) const;
     Character parse_character_json(std::string_view json) const;
     Location parse_location_json(std::string_view json) const;
 
+    // Key for reads_: one entry per campaign, resource and snapshot version
+    static std::string read_key(const std::string& campaign_id, const CampaignSnapshot& snap,
+                                const char* resource);
+    static void set_shared_content(httplib::Response& res, SingleFlight::Result body);
+
+    // Narrator prompt, most stable layers first with cache breakpoints after
+    // the system prompt, the entity lists and the replayed history
+    Prompt build_turn_prompt(const Campaign& campaign, std::string_view player_message) const;
+    void record_usage(const ClaudeResponse& response);
+
+    // Runs fn on a worker; for upstream completions that write files or take locks
+    void defer(std::function<void()> fn);
+
+    // One-shot creative-writing call through generations_. "nocache" in the
+    // query or body skips the lookup (the fresh result still replaces it).
+    // done runs on a worker, or right away on a cache hit.
+    void generate_cached(const httplib::Request& req, httplib::Response& res,
+                         const std::string& prompt, std::function<void(ClaudeResponse)> done);
+
+    struct GenerateBatch;
+    void launch_batch_item(const std::shared_ptr<GenerateBatch>& batch);
+    void finish_batch_item(const std::shared_ptr<GenerateBatch>& batch, size_t index);
+    void persist_batch(GenerateBatch& batch);
+
+    // Applies a finished narrator response to the campaign; returns the narrative
+    std::string commit_turn(Campaign& campaign, const std::string& player_message,
+                            const ClaudeResponse& response);
+    // [UPDATE] blocks and update_state tool calls of a response; campaign lock held
+    void apply_turn_updates(Campaign& campaign, const ClaudeResponse& response);
+
+    // Two-phase turns. The narrator call stops at [/NARRATIVE]; finishing it
+    // starts the bookkeeping call, which continues the same prompt after the
+    // narrative. Its completion records the narrative and the updates it
+    // makes together, on a worker, and only then lets the campaign's next
+    // turn in. settled (if set) is called with whether the updates were
+    // applied, once they are on disk; only when needs_bookkeeping(response).
+    void prepare_narrative_phase(Prompt& prompt) const;
+    static bool needs_bookkeeping(const ClaudeResponse& response);
+    std::string finish_narrative_phase(const std::shared_ptr<Campaign>& campaign,
+                                       const std::string& player_message, const ClaudeResponse& response,
+                                       Prompt prompt, std::shared_ptr<TurnSequencer::Turn> turn,
+                                       const UpstreamTag& tag, std::function<void(bool)> settled = {});
+
     // Roleplay helpers
     std::string generate_roleplay_id();
     std::string roleplay_dir(const std::string& id) const;
-    void load_roleplay(const std::string& id);
+    std::shared_ptr<Campaign> create_campaign(const std::string& name, const std::string& player_name,
+                                              const std::string& player_role);
+    void touch_last_played(const std::shared_ptr<Campaign>& campaign);
+
+    // Session helpers
+    std::string resolve_session(const httplib::Request& req, httplib::Response& res);
+    std::string session_roleplay_id(const std::string& session);
+    std::shared_ptr<Campaign> session_campaign(const httplib::Request& req, httplib::Response& res);
+    // Upstream calls share capacity fairly per campaign and session
+    UpstreamTag upstream_tag(const httplib::Request& req, httplib::Response& res, Priority priority);
     void save_roleplays_index(const std::vector<RoleplayInfo>& roleplays);
     std::vector<RoleplayInfo> read_roleplays_index();
     RoleplayInfo read_roleplay_metadata(const std::string& id);
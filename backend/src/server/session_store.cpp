@@ -0,0 +1,204 @@
+#include "session_store.h"
+#include "../util/json.h"
+#include "../util/file_utils.h"
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace rpg {
+
+SessionStore::SessionStore(std::string path) : path_(std::move(path)) {
+    load();
+    flusher_ = std::thread([this] { flush_loop(); });
+}
+
+SessionStore::~SessionStore() {
+    {
+        std::lock_guard<std::mutex> lock(flush_mutex_);
+        stopping_ = true;
+    }
+    flush_cv_.notify_all();
+    flusher_.join();
+    flush();
+}
+
+void SessionStore::set_max_sessions(size_t max_sessions) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    max_sessions_ = std::max<size_t>(1, max_sessions);
+    evict_oldest();
+}
+
+void SessionStore::evict_oldest() {
+    if (sessions_.size() <= max_sessions_) return;
+
+    // Down to 90% of the cap, so a stream of new sessions pays for one
+    // sort per tenth of the cap rather than a scan per session
+    size_t keep = max_sessions_ - max_sessions_ / 10;
+    std::vector<std::pair<std::time_t, std::string>> by_age;
+    by_age.reserve(sessions_.size());
+    for (const auto& [id, entry] : sessions_) by_age.emplace_back(entry.last_seen, id);
+    size_t drop = sessions_.size() - keep;
+    std::nth_element(by_age.begin(), by_age.begin() + drop, by_age.end());
+    for (size_t i = 0; i < drop; ++i) sessions_.erase(by_age[i].second);
+    dirty_ = true;
+}
+
+std::string SessionStore::generate_id() {
+    static thread_local std::mt19937_64 gen(std::random_device{}());
+    static const char* hex = "0123456789abcdef";
+
+    std::string id = "s_";
+    for (int i = 0; i < 2; ++i) {
+        uint64_t bits = gen();
+        for (int j = 0; j < 16; ++j) {
+            id += hex[bits & 0xF];
+            bits >>= 4;
+        }
+    }
+    return id;
+}
+
+bool SessionStore::is_valid_id(const std::string& id) {
+    if (id.empty() || id.size() > 64) return false;
+    for (char c : id) {
+        bool ok = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+                  (c >= '0' && c <= '9') || c == '_' || c == '-';
+        if (!ok) return false;
+    }
+    return true;
+}
+
+void SessionStore::add(const std::string& session_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sessions_[session_id].last_seen = std::time(nullptr);
+    dirty_ = true;
+    evict_oldest();
+}
+
+bool SessionStore::exists(const std::string& session_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return sessions_.count(session_id) > 0;
+}
+
+std::string SessionStore::active_roleplay(const std::string& session_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sessions_.find(session_id);
+    if (it == sessions_.end()) return "";
+    // Refreshed in memory only; persisted with the next real change
+    it->second.last_seen = std::time(nullptr);
+    return it->second.roleplay_id;
+}
+
+void SessionStore::set_active_roleplay(const std::string& session_id,
+                                       const std::string& roleplay_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Entry& entry = sessions_[session_id];
+    entry.roleplay_id = roleplay_id;
+    entry.last_seen = std::time(nullptr);
+    dirty_ = true;
+    evict_oldest();
+}
+
+bool SessionStore::is_live_anywhere(const std::string& roleplay_id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto now = std::time(nullptr);
+    for (const auto& [id, entry] : sessions_) {
+        if (entry.roleplay_id == roleplay_id && now - entry.last_seen <= LIVE_SECONDS) return true;
+    }
+    return false;
+}
+
+void SessionStore::release_roleplay(const std::string& roleplay_id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& [id, entry] : sessions_) {
+        if (entry.roleplay_id == roleplay_id) {
+            entry.roleplay_id.clear();
+            dirty_ = true;
+        }
+    }
+}
+
+std::unordered_map<std::string, SessionStore::Entry> SessionStore::read_entries() const {
+    std::unordered_map<std::string, Entry> entries;
+    std::string content = file::read_file(path_);
+    if (content.empty()) return entries;
+
+    auto now = std::time(nullptr);
+    for (auto item : json::split_array(json::extract_object(content, "sessions"))) {
+        std::string id(json::extract_string(item, "id"));
+        Entry entry;
+        entry.roleplay_id = std::string(json::extract_string(item, "roleplayId"));
+        entry.last_seen = static_cast<std::time_t>(json::extract_int(item, "lastSeen"));
+        if (!is_valid_id(id)) continue;
+        if (now - entry.last_seen > SESSION_TTL_SECONDS) continue;
+        entries.emplace(std::move(id), std::move(entry));
+    }
+    return entries;
+}
+
+void SessionStore::load() {
+    sessions_ = read_entries();
+}
+
+void SessionStore::flush() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dirty_) return;
+    }
+
+    // During a hot restart both processes write the file; keep whichever
+    // side saw each session last instead of overwriting the other's changes
+    auto on_disk = read_entries();
+
+    json::JsonBuilder j;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = false;
+
+        for (auto& [id, entry] : on_disk) {
+            auto it = sessions_.find(id);
+            if (it == sessions_.end()) sessions_.emplace(id, std::move(entry));
+            else if (entry.last_seen > it->second.last_seen) it->second = std::move(entry);
+        }
+
+        auto now = std::time(nullptr);
+        for (auto it = sessions_.begin(); it != sessions_.end();) {
+            if (now - it->second.last_seen > SESSION_TTL_SECONDS) it = sessions_.erase(it);
+            else ++it;
+        }
+        evict_oldest();
+        dirty_ = false;
+
+        j.begin_object();
+        j.key("sessions");
+        j.begin_array();
+        for (const auto& [id, entry] : sessions_) {
+            json::JsonBuilder e(256);
+            e.begin_object();
+            e.kv_string("id", id);
+            e.kv_string("roleplayId", entry.roleplay_id);
+            e.kv_int("lastSeen", entry.last_seen);
+            e.end_object();
+            j.value_raw(e.str());
+        }
+        j.end_array();
+        j.end_object();
+    }
+
+    file::write_file(path_, j.str());
+}
+
+void SessionStore::flush_loop() {
+    std::unique_lock<std::mutex> lock(flush_mutex_);
+    while (!stopping_) {
+        flush_cv_.wait_for(lock, std::chrono::seconds(FLUSH_INTERVAL_SECONDS));
+        if (stopping_) break;
+        lock.unlock();
+        flush();
+        lock.lock();
+    }
+}
+
+}
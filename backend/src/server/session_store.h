@@ -0,0 +1,79 @@
+#pragma once
+#include <condition_variable>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace rpg {
+
+// Remembers which roleplay each browser session last had active. Changes are
+// kept in memory and flushed to disk in the background, so loading a roleplay
+// never rewrites the shared roleplays index.
+class SessionStore {
+public:
+    explicit SessionStore(std::string path);
+    ~SessionStore();
+
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+
+    // Beyond this many sessions the least recently seen are forgotten, so
+    // clients that never keep their cookie (health checks, scripts) can't
+    // grow the store and its file without bound. Set before serving.
+    void set_max_sessions(size_t max_sessions);
+
+    static std::string generate_id();
+    static bool is_valid_id(const std::string& id);
+
+    // Records a session issued by this server; only known sessions are
+    // accepted back from clients
+    void add(const std::string& session_id);
+    bool exists(const std::string& session_id) const;
+
+    // Empty if the session has no roleplay yet
+    std::string active_roleplay(const std::string& session_id);
+    void set_active_roleplay(const std::string& session_id, const std::string& roleplay_id);
+
+    // True if a session seen within LIVE_SECONDS has the roleplay open
+    bool is_live_anywhere(const std::string& roleplay_id) const;
+
+    // Sessions that had the roleplay open go back to having none
+    void release_roleplay(const std::string& roleplay_id);
+
+    // Writes pending changes, merged with what another process (a hot
+    // restart's successor) may have written meanwhile
+    void flush();
+
+private:
+    struct Entry {
+        std::string roleplay_id;
+        std::time_t last_seen = 0;
+    };
+
+    static constexpr int FLUSH_INTERVAL_SECONDS = 5;
+    static constexpr std::time_t SESSION_TTL_SECONDS = 60 * 60 * 24 * 30;
+    static constexpr std::time_t LIVE_SECONDS = 60 * 30;
+
+    // Unexpired entries in the file
+    std::unordered_map<std::string, Entry> read_entries() const;
+    void load();
+    void flush_loop();
+
+    // mutex_ held
+    void evict_oldest();
+
+    std::string path_;
+    mutable std::mutex mutex_;
+    std::unordered_map<std::string, Entry> sessions_;
+    size_t max_sessions_ = 100000;
+    bool dirty_ = false;
+
+    std::mutex flush_mutex_;
+    std::condition_variable flush_cv_;
+    bool stopping_ = false;
+    std::thread flusher_;
+};
+
+}
@@ -0,0 +1,63 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace rpg {
+
+// Coalesces concurrent calls with the same key: the first caller computes the
+// result, everyone who arrives while it is running waits for and shares it.
+// Nothing is kept once the call completes, so keys must identify the state
+// being read (e.g. campaign id + version) for followers to get a fresh result.
+class SingleFlight {
+public:
+    using Result = std::shared_ptr<const std::string>;
+
+    Result run(const std::string& key, const std::function<std::string()>& compute) {
+        std::shared_ptr<std::promise<Result>> promise;
+        std::shared_future<Result> future;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = calls_.find(key);
+            if (it != calls_.end()) {
+                future = it->second;
+            } else {
+                promise = std::make_shared<std::promise<Result>>();
+                future = promise->get_future().share();
+                calls_.emplace(key, future);
+            }
+        }
+
+        if (!promise) {
+            ++shared_;
+            return future.get();
+        }
+
+        ++computed_;
+        try {
+            promise->set_value(std::make_shared<const std::string>(compute()));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            calls_.erase(key);
+        }
+        return future.get();
+    }
+
+    size_t computed() const { return computed_.load(); }
+    size_t shared() const { return shared_.load(); }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<Result>> calls_;
+    std::atomic<size_t> computed_{0};
+    std::atomic<size_t> shared_{0};
+};
+
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "../api/claude_api.h"
+
+namespace rpg {
+
+// The narrator records state changes through this tool rather than
+// rewriting sections in [UPDATE] blocks; see ContextManager::apply_state_ops
+inline constexpr const char* STATE_TOOL_NAME = "update_state";
+inline constexpr const char* STATE_TOOL_DESCRIPTION =
+    "Record what this turn changed in the player's inventory and quests, the characters "
+    "and the plot. Call it once after the narrative with every change, and not at all "
+    "when nothing changed. Each operation is one small edit; never restate unchanged state.";
+inline constexpr const char* STATE_TOOL_SCHEMA = R"({"type":"object","properties":{"operations":{"type":"array","items":{"type":"object","properties":{)"
+    R"("op":{"type":"string","enum":["add_item","remove_item","set_quest","set_character_field","add_plot_seed","add_note"]},)"
+    R"("item":{"type":"string","description":"add_item, remove_item: the item, e.g. Iron key"},)"
+    R"("quest":{"type":"string","description":"set_quest: the quest's name"},)"
+    R"("status":{"type":"string","enum":["active","completed","failed"],"description":"set_quest"},)"
+    R"("character":{"type":"string","description":"set_character_field: the character's name; a new name adds the character"},)"
+    R"("field":{"type":"string","enum":["role","first_encountered","appearance","background","motivations","personality","knows","doesnt_know"],"description":"set_character_field"},)"
+    R"("value":{"type":"string","description":"set_character_field: the field's full new text"},)"
+    R"("text":{"type":"string","description":"add_plot_seed: a secret seed to pay off later; add_note: a note for the player"}},)"
+    R"("required":["op"]}}},"required":["operations"]})";
+
+inline PromptTool state_tool() {
+    return {STATE_TOOL_NAME, STATE_TOOL_DESCRIPTION, STATE_TOOL_SCHEMA};
+}
+
+}
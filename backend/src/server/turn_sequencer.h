@@ -0,0 +1,117 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <utility>
+
+namespace rpg {
+
+// FIFO queue for narrator turns within one campaign. A turn holds its slot
+// from context assembly until its updates are persisted, so the next turn
+// always builds its prompt on top of the previous turn's state.
+//
+// Nobody waits on a thread: a turn that arrives while another runs is queued
+// and started by the thread that finishes the one before it.
+class TurnSequencer {
+public:
+    class Turn {
+    public:
+        Turn() = default;
+        Turn(Turn&& other) noexcept : seq_(other.seq_) { other.seq_ = nullptr; }
+        Turn& operator=(Turn&& other) noexcept {
+            if (this != &other) {
+                finish();
+                seq_ = other.seq_;
+                other.seq_ = nullptr;
+            }
+            return *this;
+        }
+        Turn(const Turn&) = delete;
+        Turn& operator=(const Turn&) = delete;
+        ~Turn() { finish(); }
+
+        // Lets the next turn start; called once this turn's state is on disk.
+        // The next turn's start runs on this thread, before finish() returns
+        // unless a start further up the stack is finishing it.
+        // Abandoned turns release their slot on destruction.
+        void finish() {
+            if (seq_) {
+                TurnSequencer* seq = seq_;
+                seq_ = nullptr;
+                seq->advance();
+            }
+        }
+
+    private:
+        friend class TurnSequencer;
+        explicit Turn(TurnSequencer* seq) : seq_(seq) {}
+        TurnSequencer* seq_ = nullptr;
+    };
+
+    using Start = std::function<void(Turn)>;
+
+    // Calls start with the turn once every earlier turn for this campaign has
+    // finished: right away on this thread when none is running, otherwise on
+    // the thread that finishes the previous one
+    void begin(Start start) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (busy_) {
+                waiting_.push_back(std::move(start));
+                return;
+            }
+            busy_ = true;
+        }
+        start(Turn(this));
+    }
+
+private:
+    // Finishes being handled by an advance() further up this thread's stack
+    struct Draining {
+        TurnSequencer* seq;
+        size_t finished;
+        Draining* outer;
+    };
+    static inline thread_local Draining* draining_ = nullptr;
+
+    void advance() {
+        // A start that finishes its turn at once (a client gone while it
+        // queued) calls back in here from inside next(). The outermost call
+        // on this thread hands the slot on in a loop instead, so a long
+        // queue of those can't run the stack out.
+        for (Draining* d = draining_; d; d = d->outer) {
+            if (d->seq == this) {
+                ++d->finished;
+                return;
+            }
+        }
+
+        Draining self{this, 1, draining_};
+        draining_ = &self;
+        struct Restore {
+            Draining& self;
+            ~Restore() { draining_ = self.outer; }
+        } restore{self};
+
+        while (self.finished > 0) {
+            --self.finished;
+            Start next;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (waiting_.empty()) {
+                    busy_ = false;
+                    continue;
+                }
+                next = std::move(waiting_.front());
+                waiting_.pop_front();
+            }
+            next(Turn(this));
+        }
+    }
+
+    std::mutex mutex_;
+    bool busy_ = false;
+    std::deque<Start> waiting_;
+};
+
+}
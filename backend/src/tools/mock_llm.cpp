@@ -0,0 +1,153 @@
+// Stand-in for the Anthropic Messages and Gemini generateContent APIs, for
+// full-stack load tests without spending tokens. Point the server at it with
+// ANTHROPIC_BASE_URL / GEMINI_BASE_URL=http://127.0.0.1:<port>.
+//
+//   mock_llm [--port 9100] [--latency fixed:800] [--event-ms 20] [--seed 1]
+//            [--threads 256] [--rpm 0] [--token-ms 0]
+//
+// --token-ms adds that much time per output token, so longer answers take
+// longer, spread across the events of a stream.
+// With --rpm, each x-api-key gets that many requests per minute, reported in
+// anthropic-ratelimit-requests-* headers, and a 429 once it runs out.
+#include "httplib.h"
+#include "api/synthetic.h"
+#include "util/json.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+    std::mutex latency_mutex;
+    rpg::synthetic::LatencyModel latency;
+
+    void wait_for_latency() {
+        long ms;
+        {
+            std::lock_guard<std::mutex> lock(latency_mutex);
+            ms = latency.sample_ms();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+    }
+
+    // Per-key request buckets, refilled continuously like the real API's
+    struct RateLimiter {
+        double per_minute = 0;  // 0 disables limiting
+        std::mutex mutex;
+        std::unordered_map<std::string, std::pair<double, std::chrono::steady_clock::time_point>> buckets;
+
+        // False when the key is out of requests; sets the rate-limit headers either way
+        bool admit(const std::string& key, httplib::Response& res) {
+            if (per_minute <= 0) return true;
+            std::lock_guard<std::mutex> lock(mutex);
+            auto now = std::chrono::steady_clock::now();
+            auto [it, fresh] = buckets.try_emplace(key, per_minute, now);
+            auto& [level, updated] = it->second;
+            if (!fresh) {
+                double elapsed = std::chrono::duration<double>(now - updated).count();
+                level = std::min(per_minute, level + per_minute * elapsed / 60.0);
+                updated = now;
+            }
+            bool ok = level >= 1;
+            if (ok) level -= 1;
+            res.set_header("anthropic-ratelimit-requests-limit", std::to_string(static_cast<long>(per_minute)));
+            res.set_header("anthropic-ratelimit-requests-remaining", std::to_string(static_cast<long>(level)));
+            if (!ok) {
+                long retry = static_cast<long>(std::ceil((1 - level) * 60.0 / per_minute));
+                res.set_header("retry-after", std::to_string(std::max(1L, retry)));
+            }
+            return ok;
+        }
+    };
+    RateLimiter limiter;
+
+    std::vector<std::string> split_events(const std::string& sse) {
+        std::vector<std::string> events;
+        size_t pos = 0;
+        while (pos < sse.size()) {
+            size_t end = sse.find("\n\n", pos);
+            end = end == std::string::npos ? sse.size() : end + 2;
+            events.push_back(sse.substr(pos, end - pos));
+            pos = end;
+        }
+        return events;
+    }
+}
+
+int main(int argc, char* argv[]) {
+    int port = 9100;
+    std::string latency_spec = "fixed:0";
+    long event_ms = 20;
+    unsigned seed = 1;
+    size_t threads = 256;
+    long token_ms = 0;
+
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (!std::strcmp(argv[i], "--port")) port = std::atoi(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--latency")) latency_spec = argv[i + 1];
+        else if (!std::strcmp(argv[i], "--event-ms")) event_ms = std::atol(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--seed")) seed = static_cast<unsigned>(std::atol(argv[i + 1]));
+        else if (!std::strcmp(argv[i], "--threads")) threads = static_cast<size_t>(std::atol(argv[i + 1]));
+        else if (!std::strcmp(argv[i], "--rpm")) limiter.per_minute = std::atof(argv[i + 1]);
+        else if (!std::strcmp(argv[i], "--token-ms")) token_ms = std::atol(argv[i + 1]);
+        else {
+            fprintf(stderr, "Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+    latency = rpg::synthetic::LatencyModel::parse(latency_spec, seed);
+
+    httplib::Server svr;
+    // Handlers sleep to simulate latency, so size the pool for the load
+    svr.new_task_queue = [threads] { return new httplib::ThreadPool(threads); };
+
+    svr.Post("/v1/messages", [event_ms, token_ms](const httplib::Request& req, httplib::Response& res) {
+        if (!limiter.admit(req.get_header_value("x-api-key"), res)) {
+            res.status = 429;
+            res.set_content(R"({"type":"error","error":{"type":"rate_limit_error","message":"Number of requests has exceeded your per-minute rate limit"}})",
+                            "application/json");
+            return;
+        }
+        auto reply = rpg::synthetic::reply(req.body);
+        int in = rpg::synthetic::count_tokens(req.body);
+        int out = rpg::synthetic::count_tokens(reply.text) + rpg::synthetic::count_tokens(reply.tool_input);
+        wait_for_latency();
+
+        long generation_ms = out * token_ms;
+
+        if (!rpg::json::extract_bool(req.body, "stream")) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(generation_ms));
+            res.set_content(rpg::synthetic::claude_message(reply, in, out), "application/json");
+            return;
+        }
+
+        auto events = std::make_shared<std::vector<std::string>>(
+            split_events(rpg::synthetic::claude_stream(reply, in, out)));
+        long gap_ms = event_ms + generation_ms / static_cast<long>(events->size());
+        res.set_chunked_content_provider("text/event-stream",
+            [events, gap_ms, next = size_t(0)](size_t, httplib::DataSink& sink) mutable {
+                if (next > 0) std::this_thread::sleep_for(std::chrono::milliseconds(gap_ms));
+                const std::string& event = (*events)[next++];
+                if (!sink.write(event.data(), event.size())) return false;
+                if (next == events->size()) sink.done();
+                return true;
+            });
+    });
+
+    svr.Post(R"(/v1beta/models/[^/]+:generateContent)", [](const httplib::Request&, httplib::Response& res) {
+        wait_for_latency();
+        res.set_content(rpg::synthetic::gemini_image(), "application/json");
+    });
+
+    printf("Mock LLM listening on http://127.0.0.1:%d (latency %s, %ld ms between stream events)\n",
+           port, latency_spec.c_str(), event_ms);
+    fflush(stdout);
+    return svr.listen("127.0.0.1", port) ? 0 : 1;
+}
@@ -1,4 +1,9 @@
 #pragma once
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
 #include <string>
 #include <fstream>
 #include <sstream>
@@ -13,11 +18,33 @@ inline std::string read_file(const std::string& path) {
     return ss.str();
 }
 
+// Writes to a temporary file and renames it over path, so a concurrent
+// reader sees either the old or the new content, never a truncated file.
+// The temporary name is unique, so two writers (two requests, or the old and
+// new process during a hot restart) never share one; the data is synced
+// before the rename so a crash can't publish an empty file.
 inline bool write_file(const std::string& path, const std::string& content) {
-    std::ofstream f(path);
-    if (!f) return false;
-    f << content;
-    return true;
+    std::string tmp = path + ".tmp.XXXXXX";
+    int fd = mkstemp(tmp.data());
+    if (fd < 0) return false;
+    fchmod(fd, 0644);
+
+    bool ok = true;
+    size_t written = 0;
+    while (written < content.size()) {
+        ssize_t n = ::write(fd, content.data() + written, content.size() - written);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        written += static_cast<size_t>(n);
+    }
+    if (ok) ok = fsync(fd) == 0;
+    if (::close(fd) != 0) ok = false;
+    if (ok) ok = std::rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok) std::remove(tmp.c_str());
+    return ok;
 }
 
 inline bool file_exists(const std::string& path) {
@@ -25,4 +52,17 @@ inline bool file_exists(const std::string& path) {
     return f.good();
 }
 
+// mkdir -p; existing directories are fine
+inline void make_dirs(const std::string& path) {
+    std::string tmp = path;
+    for (size_t i = 1; i < tmp.size(); ++i) {
+        if (tmp[i] == '/') {
+            tmp[i] = '\0';
+            mkdir(tmp.c_str(), 0755);
+            tmp[i] = '/';
+        }
+    }
+    mkdir(tmp.c_str(), 0755);
+}
+
 }}
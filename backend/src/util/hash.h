@@ -0,0 +1,53 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+
+namespace rpg { namespace hash {
+
+namespace detail {
+    inline uint64_t rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+    inline uint64_t fmix(uint64_t k) {
+        k ^= k >> 33; k *= 0xff51afd7ed558ccdULL;
+        k ^= k >> 33; k *= 0xc4ceb9fe1a85ec53ULL;
+        k ^= k >> 33;
+        return k;
+    }
+}
+
+// 128-bit content digest as 32 hex characters, for keying caches and
+// captures by request bytes. Two unrelated 64-bit hashes (FNV-1a and a
+// murmur-style word mix), so a collision needs both to collide at once.
+// Not cryptographic.
+inline std::string digest128(std::string_view data) {
+    uint64_t fnv = 0xcbf29ce484222325ULL;
+    for (unsigned char c : data) {
+        fnv ^= c;
+        fnv *= 0x100000001b3ULL;
+    }
+
+    uint64_t mix = 0x9e3779b97f4a7c15ULL;
+    size_t i = 0;
+    for (; i + 8 <= data.size(); i += 8) {
+        uint64_t k = 0;
+        for (int b = 0; b < 8; ++b) k |= static_cast<uint64_t>(static_cast<unsigned char>(data[i + b])) << (8 * b);
+        k *= 0x87c37b91114253d5ULL; k = detail::rotl(k, 31); k *= 0x4cf5ad432745937fULL;
+        mix ^= k;
+        mix = detail::rotl(mix, 27) * 5 + 0x52dce729;
+    }
+    uint64_t tail = 0;
+    for (int b = 0; i < data.size(); ++i, ++b) {
+        tail |= static_cast<uint64_t>(static_cast<unsigned char>(data[i])) << (8 * b);
+    }
+    mix ^= detail::fmix(tail ^ data.size());
+    mix = detail::fmix(mix);
+
+    char hex[33];
+    std::snprintf(hex, sizeof(hex), "%016llx%016llx",
+                  static_cast<unsigned long long>(fnv), static_cast<unsigned long long>(mix));
+    return hex;
+}
+
+} }
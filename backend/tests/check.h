@@ -0,0 +1,62 @@
+#pragma once
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Just enough of a test harness for the string transforms: TEST registers a
+// case, CHECK and CHECK_EQ report a failure and carry on
+namespace rpg::test {
+
+struct Case {
+    const char* name;
+    void (*run)();
+};
+
+inline std::vector<Case>& cases() {
+    static std::vector<Case> all;
+    return all;
+}
+
+inline int& failures() {
+    static int count = 0;
+    return count;
+}
+
+struct Register {
+    Register(const char* name, void (*run)()) { cases().push_back({name, run}); }
+};
+
+template <typename T>
+std::string describe(const T& value) {
+    std::ostringstream out;
+    out << value;
+    return out.str();
+}
+
+inline void fail(const char* file, int line, const std::string& what) {
+    ++failures();
+    fprintf(stderr, "%s:%d: %s\n", file, line, what.c_str());
+}
+
+}
+
+#define TEST(name)                                                   \
+    static void name();                                              \
+    static rpg::test::Register name##_registered(#name, name);       \
+    static void name()
+
+#define CHECK(cond)                                                  \
+    do {                                                             \
+        if (!(cond)) rpg::test::fail(__FILE__, __LINE__, #cond);     \
+    } while (0)
+
+#define CHECK_EQ(actual, expected)                                   \
+    do {                                                             \
+        auto&& actual_ = (actual);                                   \
+        auto&& expected_ = (expected);                               \
+        if (!(actual_ == expected_)) {                               \
+            rpg::test::fail(__FILE__, __LINE__, std::string(#actual) + "\n  got:      " + \
+                rpg::test::describe(actual_) + "\n  expected: " + rpg::test::describe(expected_)); \
+        }                                                            \
+    } while (0)
@@ -0,0 +1,33 @@
+#include "check.h"
+#include "api/claude_api.h"
+#include "server/state_tool.h"
+#include "util/json.h"
+
+TEST(json_valid_accepts_and_rejects) {
+    CHECK(rpg::json::valid(R"({"a":[1,-2.5e3,true,false,null,"x\"é"],"b":{}} )"));
+    CHECK(rpg::json::valid("[]"));
+    CHECK(!rpg::json::valid(R"({"a":1,})"));
+    CHECK(!rpg::json::valid(R"({"a" 1})"));
+    CHECK(!rpg::json::valid(R"(["tab	inside"])"));
+    CHECK(!rpg::json::valid(R"({"a":01})"));
+    CHECK(!rpg::json::valid(R"({"a":1} {})"));
+    CHECK(!rpg::json::valid(R"({"description":"e.g. "Iron key""})"));
+}
+
+TEST(json_every_tool_schema_is_valid) {
+    CHECK(rpg::json::valid(rpg::state_tool().input_schema));
+}
+
+TEST(json_request_body_is_valid) {
+    rpg::Prompt prompt = rpg::Prompt::plain("You are the narrator.\n\"Stay in character.\"",
+                                            "I say \"hello\"\tand wave\\\x01");
+    prompt.system.push_back({"World: a river town", true});
+    prompt.messages.push_back({"assistant", {{"[NARRATIVE]\nOld Tom nods.\n[/NARRATIVE]", false}}});
+    prompt.tools.push_back(rpg::state_tool());
+    prompt.stop_sequences.push_back("[/NARRATIVE]");
+
+    rpg::ClaudeAPI claude;
+    std::string body = claude.request_body(prompt);
+    CHECK(rpg::json::valid(body));
+    CHECK(body.find(R"("name":"update_state")") != std::string::npos);
+}
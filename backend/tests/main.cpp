@@ -0,0 +1,14 @@
+#include "check.h"
+
+int main() {
+    for (const auto& c : rpg::test::cases()) {
+        int before = rpg::test::failures();
+        c.run();
+        printf("%s %s\n", rpg::test::failures() == before ? "ok  " : "FAIL", c.name);
+    }
+    if (rpg::test::failures() > 0) {
+        printf("%d check(s) failed\n", rpg::test::failures());
+        return 1;
+    }
+    return 0;
+}
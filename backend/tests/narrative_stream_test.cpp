@@ -0,0 +1,57 @@
+#include "check.h"
+#include "parser/response_parser.h"
+#include <string>
+#include <vector>
+
+using rpg::NarrativeStream;
+
+namespace {
+    const std::string RESPONSE =
+        "Some preamble.\n[NARRATIVE]\n\nThe ferry creaks.\n\nOld Tom nods.\n[/NARRATIVE]\n"
+        "[UPDATE:plot.md]\nnothing\n[/UPDATE]\n";
+
+    // Feeds response in pieces of size bytes, checking no piece leaks a tag
+    std::string feed_in_pieces(const std::string& response, size_t size) {
+        NarrativeStream stream;
+        std::string out;
+        for (size_t i = 0; i < response.size(); i += size) {
+            std::string piece = stream.feed(std::string_view(response).substr(i, size));
+            CHECK(piece.find('[') == std::string::npos);
+            out += piece;
+        }
+        CHECK(stream.finished());
+        return out;
+    }
+}
+
+TEST(narrative_stream_matches_extract_narrative) {
+    std::string expected = rpg::ResponseParser().extract_narrative(RESPONSE);
+    CHECK_EQ(expected, "The ferry creaks.\n\nOld Tom nods.");
+    for (size_t size : {1, 2, 3, 7, 11, 1000}) {
+        CHECK_EQ(feed_in_pieces(RESPONSE, size), expected);
+    }
+}
+
+TEST(narrative_stream_holds_back_partial_tags) {
+    NarrativeStream stream;
+    CHECK_EQ(stream.feed("[NARR"), "");
+    CHECK_EQ(stream.feed("ATIVE]\nHello"), "Hello");
+    CHECK_EQ(stream.feed(" world\n[/NAR"), " world");
+    CHECK(!stream.finished());
+    CHECK_EQ(stream.feed("RATIVE] and after"), "");
+    CHECK(stream.finished());
+    CHECK_EQ(stream.feed("more text"), "");
+}
+
+TEST(narrative_stream_keeps_brackets_that_are_not_tags) {
+    NarrativeStream stream;
+    std::string out = stream.feed("[NARRATIVE]\nA sign reads [CLOSED]");
+    out += stream.feed(" today.\n[/NARRATIVE]");
+    CHECK_EQ(out, "A sign reads [CLOSED] today.");
+}
+
+TEST(narrative_stream_without_end_tag_releases_text) {
+    NarrativeStream stream;
+    CHECK_EQ(stream.feed("[NARRATIVE]\nCut short\n"), "Cut short");
+    CHECK(!stream.finished());
+}
@@ -0,0 +1,83 @@
+#include "check.h"
+#include "server/router.h"
+#include <stdexcept>
+
+using rpg::Router;
+
+namespace {
+    void add_api_routes(Router& router) {
+        router.add("GET", "/api/roleplays", 0);
+        router.add("GET", "/api/roleplays/current", 1);
+        router.add("GET", "/api/roleplays/:id", 2);
+        router.add("DELETE", "/api/roleplays/:id", 3);
+        router.add("POST", "/api/roleplays/:id/select", 4);
+        router.add("GET", "/api/images/:category/:id", 5);
+        router.add("GET", "/assets/*", 6);
+    }
+}
+
+TEST(router_literal_beats_parameter) {
+    Router router;
+    add_api_routes(router);
+    Router::Params params;
+    CHECK_EQ(router.match("GET", "/api/roleplays/current", params).value_or(99), 1u);
+    CHECK(params.empty());
+    CHECK_EQ(router.match("GET", "/api/roleplays", params).value_or(99), 0u);
+}
+
+TEST(router_binds_parameters) {
+    Router router;
+    add_api_routes(router);
+    Router::Params params;
+    CHECK_EQ(router.match("GET", "/api/roleplays/rp_1a2b", params).value_or(99), 2u);
+    CHECK_EQ(params["id"], "rp_1a2b");
+
+    params.clear();
+    CHECK_EQ(router.match("POST", "/api/roleplays/rp_1a2b/select", params).value_or(99), 4u);
+    CHECK_EQ(params["id"], "rp_1a2b");
+
+    params.clear();
+    CHECK_EQ(router.match("GET", "/api/images/characters/old_tom", params).value_or(99), 5u);
+    CHECK_EQ(params["category"], "characters");
+    CHECK_EQ(params["id"], "old_tom");
+}
+
+TEST(router_other_method_falls_through_to_parameter) {
+    // "current" is a literal for GET only; DELETE goes to the :id route
+    Router router;
+    add_api_routes(router);
+    Router::Params params;
+    CHECK_EQ(router.match("DELETE", "/api/roleplays/current", params).value_or(99), 3u);
+    CHECK_EQ(params["id"], "current");
+}
+
+TEST(router_wildcard_takes_the_rest) {
+    Router router;
+    add_api_routes(router);
+    Router::Params params;
+    CHECK_EQ(router.match("GET", "/assets/js/app.js", params).value_or(99), 6u);
+    CHECK_EQ(router.match("GET", "/assets/", params).value_or(99), 6u);
+}
+
+TEST(router_misses_leave_params_alone) {
+    Router router;
+    add_api_routes(router);
+    Router::Params params;
+    CHECK(!router.match("PUT", "/api/roleplays/rp_1", params));
+    CHECK(!router.match("GET", "/api/roleplays/", params));
+    CHECK(!router.match("GET", "/api/roleplays/rp_1/select", params));
+    CHECK(!router.match("GET", "/api/unknown", params));
+    CHECK(params.empty());
+}
+
+TEST(router_rejects_ambiguous_routes) {
+    Router router;
+    add_api_routes(router);
+    bool duplicate = false, renamed = false, wildcard = false;
+    try { router.add("GET", "/api/roleplays/:id", 7); } catch (const std::invalid_argument&) { duplicate = true; }
+    try { router.add("PUT", "/api/roleplays/:name", 7); } catch (const std::invalid_argument&) { renamed = true; }
+    try { router.add("GET", "/assets/*/x", 7); } catch (const std::invalid_argument&) { wildcard = true; }
+    CHECK(duplicate);
+    CHECK(renamed);
+    CHECK(wildcard);
+}
@@ -0,0 +1,158 @@
+#include "check.h"
+#include "context/context_manager.h"
+#include "util/file_utils.h"
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+using rpg::ContextManager;
+using rpg::StateOp;
+
+namespace {
+    // A fresh campaign directory holding the given player, plot and
+    // characters files, removed again at the end of the test
+    struct Campaign {
+        std::string dir;
+
+        Campaign(const std::string& player, const std::string& plot = "",
+                 const std::string& characters = "") {
+            char name[] = "/tmp/rpg_state_ops_XXXXXX";
+            if (mkdtemp(name)) dir = name;
+            rpg::file::write_file(dir + "/player.md", player);
+            rpg::file::write_file(dir + "/plot.md", plot);
+            rpg::file::write_file(dir + "/characters.md", characters);
+        }
+        ~Campaign() { std::filesystem::remove_all(dir); }
+    };
+
+    StateOp op(StateOp::Kind kind, std::string target, std::string field = "", std::string value = "") {
+        return {kind, std::move(target), std::move(field), std::move(value)};
+    }
+
+    const std::string PLAYER =
+        "# Character\nName: Ana\n\n"
+        "# Inventory\n- Rope (50 ft)\n- Torch\n\n"
+        "# Quest Log\n- [ ] Find the lost sibling\n\n"
+        "# Notes\n(None yet)\n";
+
+    const std::string CHARACTERS =
+        "# Characters\n\n"
+        "## Old Tom\n"
+        "### Basic Info\n- **Role**: Ferryman\n- **Boat**: The Heron\n\n"
+        "### Appearance\nWeathered.\n\n"
+        "### Knowledge\n- **Knows**: The river\n\n"
+        "---\n\n";
+}
+
+TEST(state_ops_edit_inventory) {
+    Campaign campaign(PLAYER);
+    ContextManager context(campaign.dir);
+    size_t applied = context.apply_state_ops({
+        op(StateOp::Kind::AddItem, "Iron key"),
+        op(StateOp::Kind::AddItem, "torch"),        // already listed
+        op(StateOp::Kind::RemoveItem, "rope"),      // names "Rope (50 ft)"
+        op(StateOp::Kind::RemoveItem, "Lantern"),   // not carried
+    });
+    CHECK_EQ(applied, 2u);
+    CHECK_EQ(context.snapshot()->player,
+        "# Character\nName: Ana\n\n"
+        "# Inventory\n- Torch\n- Iron key\n\n"
+        "# Quest Log\n- [ ] Find the lost sibling\n\n"
+        "# Notes\n(None yet)\n");
+    CHECK_EQ(rpg::file::read_file(campaign.dir + "/player.md"), context.snapshot()->player);
+}
+
+TEST(state_ops_set_quest_and_notes) {
+    Campaign campaign(PLAYER);
+    ContextManager context(campaign.dir);
+    size_t applied = context.apply_state_ops({
+        op(StateOp::Kind::SetQuest, "Find the lost sibling", "", "completed"),
+        op(StateOp::Kind::SetQuest, "Find the lost sibling", "", "completed"),  // no change
+        op(StateOp::Kind::SetQuest, "Repay the debt", "", "active"),
+        op(StateOp::Kind::AddNote, "", "", "The bridge\nis out"),
+    });
+    CHECK_EQ(applied, 3u);
+    CHECK_EQ(context.snapshot()->player,
+        "# Character\nName: Ana\n\n"
+        "# Inventory\n- Rope (50 ft)\n- Torch\n\n"
+        "# Quest Log\n- [x] Find the lost sibling\n- [ ] Repay the debt\n\n"
+        "# Notes\n- The bridge is out\n");
+}
+
+TEST(state_ops_add_missing_section) {
+    Campaign campaign(PLAYER, "# Story Arc\nThe river rises.");
+    ContextManager context(campaign.dir);
+    CHECK_EQ(context.apply_state_ops({op(StateOp::Kind::AddPlotSeed, "", "", "Tom owes the guild")}), 1u);
+    CHECK_EQ(context.snapshot()->plot, "# Story Arc\nThe river rises.\n\n# Planted Seeds\n- Tom owes the guild\n");
+    CHECK_EQ(context.apply_state_ops({op(StateOp::Kind::AddPlotSeed, "", "", "Tom owes the guild")}), 0u);
+}
+
+TEST(state_ops_patch_character_fields_in_place) {
+    Campaign campaign(PLAYER, "", CHARACTERS);
+    ContextManager context(campaign.dir);
+    size_t applied = context.apply_state_ops({
+        op(StateOp::Kind::SetCharacterField, "Old Tom", "role", "Smuggler"),
+        op(StateOp::Kind::SetCharacterField, "old tom", "appearance", "Scarred.\nTall."),
+        op(StateOp::Kind::SetCharacterField, "Old Tom", "doesnt_know", "Ana's name"),
+        op(StateOp::Kind::SetCharacterField, "Old Tom", "first encountered", "The docks"),
+        op(StateOp::Kind::SetCharacterField, "Old Tom", "role", "Smuggler"),  // no change
+        op(StateOp::Kind::SetCharacterField, "Old Tom", "hair", "Grey"),      // no such field
+    });
+    CHECK_EQ(applied, 4u);
+    CHECK_EQ(context.snapshot()->characters_md,
+        "# Characters\n\n"
+        "## Old Tom\n"
+        "### Basic Info\n- **Role**: Smuggler\n- **Boat**: The Heron\n- **First Encountered**: The docks\n\n"
+        "### Appearance\nScarred.\nTall.\n\n"
+        "### Knowledge\n- **Knows**: The river\n- **Doesn't know**: Ana's name\n\n"
+        "---\n\n");
+
+    const auto& characters = context.snapshot()->characters;
+    CHECK_EQ(characters.size(), 1u);
+    if (!characters.empty()) {
+        CHECK_EQ(characters[0].role, "Smuggler");
+        CHECK_EQ(characters[0].first_encountered, "The docks");
+        CHECK_EQ(characters[0].doesnt_know, "Ana's name");
+    }
+}
+
+TEST(state_ops_add_a_new_character) {
+    Campaign campaign(PLAYER, "", CHARACTERS);
+    ContextManager context(campaign.dir);
+    CHECK_EQ(context.apply_state_ops({
+        op(StateOp::Kind::SetCharacterField, "Mara", "role", "Guard"),
+        op(StateOp::Kind::SetCharacterField, "Mara", "personality", "Curt."),
+    }), 2u);
+    const std::string& md = context.snapshot()->characters_md;
+    CHECK_EQ(md.substr(0, CHARACTERS.size()), CHARACTERS);
+    CHECK_EQ(md.substr(CHARACTERS.size()),
+        "## Mara\n### Basic Info\n- **Role**: Guard\n\n### Personality\nCurt.\n\n---\n\n");
+    CHECK_EQ(context.snapshot()->characters.size(), 2u);
+}
+
+TEST(state_ops_build_on_another_servers_writes) {
+    // Two managers on one directory stand in for the old and new server
+    // of a hot restart
+    Campaign campaign(PLAYER);
+    ContextManager old_server(campaign.dir);
+    ContextManager new_server(campaign.dir);
+
+    new_server.begin_write();
+    new_server.apply_state_ops({op(StateOp::Kind::AddItem, "Iron key")});
+    new_server.end_write();
+
+    old_server.begin_write();
+    old_server.apply_state_ops({op(StateOp::Kind::RemoveItem, "Torch")});
+    old_server.end_write();
+
+    std::string expected =
+        "# Character\nName: Ana\n\n"
+        "# Inventory\n- Rope (50 ft)\n- Iron key\n\n"
+        "# Quest Log\n- [ ] Find the lost sibling\n\n"
+        "# Notes\n(None yet)\n";
+    CHECK_EQ(rpg::file::read_file(campaign.dir + "/player.md"), expected);
+
+    new_server.refresh();
+    CHECK_EQ(new_server.snapshot()->player, expected);
+}
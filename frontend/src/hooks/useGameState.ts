@@ -18,6 +18,10 @@ const initialState: GameState = {
   locations: [],
 };
 
+// Two-phase turns apply their state changes after the reply; the player
+// state is fetched again at these delays
+const PENDING_STATE_REFETCH_MS = [1000, 3000, 8000];
+
 export const useGameState = () => {
   const [gameState, setGameState] = useState<GameState>(initialState);
   const api = useApi();
@@ -112,6 +116,20 @@ export const useGameState = () => {
           : prev.playerState,
         isLoading: false,
       }));
+
+      if (response.playerState?.pending) {
+        for (const delay of PENDING_STATE_REFETCH_MS) {
+          setTimeout(async () => {
+            const later = await api.getPlayerState();
+            if (later) {
+              setGameState((prev) => ({
+                ...prev,
+                playerState: { ...prev.playerState, ...later.state, imageUrl: later.imageUrl },
+              }));
+            }
+          }, delay);
+        }
+      }
     } else {
       setGameState((prev) => ({ ...prev, isLoading: false }));
     }
@@ -55,7 +55,8 @@ export interface GameState {
 
 export interface ApiResponse {
   narrative: string;
-  playerState?: Partial<PlayerState>;
+  // pending: the turn's state changes are still being applied after the reply
+  playerState?: { updated: boolean; pending?: boolean };
 }
 
 export interface HistoryEntry {